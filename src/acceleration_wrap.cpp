@@ -139,6 +139,18 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
             if(batchSize >= batchLimit || idx == nbBlas - 1)
                 {
                     VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
+
+                    // The geometry may still be in flight on VK->m_upload:  submit it
+                    // ahead of this build and make its writes visible to the builder.
+                    VK->m_upload.flush();
+                    VkMemoryBarrier uploadBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+                    uploadBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                    uploadBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+                        | VK_ACCESS_SHADER_READ_BIT;
+                    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                         0, 1, &uploadBarrier, 0, nullptr, 0, nullptr);
+
                     cmdCreateBlas(cmdBuf, indices, buildAs, scratchAddress, queryPool);
                     VK->submitTempCmdBuffer(cmdBuf);
 
@@ -444,7 +456,7 @@ void RaytracingBuilderKHR::buildTlas(
 
     // Create a buffer holding the actual instance data (matrices++) for use by the AS builder
     printf("    Create a buffer for the TLAS\n");
-    BufferWrap instancesBuffer = VK->createStagedBufferWrap(cmdBuf, instances,
+    BufferWrap instancesBuffer = VK->createStagedBufferWrap(instances,
                                                       VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
                                                   | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr,
@@ -453,6 +465,8 @@ void RaytracingBuilderKHR::buildTlas(
     VkDeviceAddress           instBufferAddr = vkGetBufferDeviceAddress(m_device, &bufferInfo);
     
     // Make sure the copy of the instance buffer are copied before triggering the acceleration structure build
+    // (The copy is on VK->m_upload; submitting it first puts it ahead of cmdBuf on the queue.)
+    VK->m_upload.flush();
     VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
     barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
@@ -527,6 +541,7 @@ BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
 
 void VkApp::createRtAccelerationStructure()
 {
+    TRACE_FUNCTION();
     printf("\nVkApp::createRtAccelerationStructure\n");
     // BLAS - Storing each primitive in a geometry
     std::vector<BlasInput> allBlas;
@@ -1,8 +1,10 @@
 #include <iostream>
 #include <array>
+#include <chrono>
 
 #include "vkapp.h"
 #include "app.h"
+#include "benchmark.h"
 #include "extensions_vk.hpp"
 
 // GLFW Callback functions
@@ -32,6 +34,45 @@ void drawGUI(VkApp& VK)
 
     if (ImGui::Checkbox("Explicit Light", &VK.m_pcRay.explicitLight))
         VK.app->myCamera.modified = true;
+    if (ImGui::Checkbox("MIS", &VK.m_pcRay.mis))
+        VK.app->myCamera.modified = true;
+    if (ImGui::Combo("Light choice", &VK.m_pcRay.lightChoice, "Uniform\0Power\0Light tree\0"))
+        VK.app->myCamera.modified = true;
+    if (ImGui::SliderInt("Min depth", &VK.m_pcRay.minDepth, 1, VK.m_pcRay.maxDepth))
+        VK.app->myCamera.modified = true;
+    if (ImGui::SliderInt("Max depth", &VK.m_pcRay.maxDepth, 1, 32)) {
+        VK.m_pcRay.minDepth = std::min(VK.m_pcRay.minDepth, VK.m_pcRay.maxDepth);
+        VK.app->myCamera.modified = true; }
+    if (ImGui::Combo("Sampler", &VK.m_pcRay.samplerChoice, "Random\0Sobol\0"))
+        VK.app->myCamera.modified = true;
+
+    ImGui::SliderInt("Denoise iterations", &VK.m_num_atrous_iterations, 0, 5);
+    ImGui::Checkbox("Tiled denoiser", &VK.m_denoiseTiled);
+
+    const VkApp::FrameStats& fs = VK.m_frameStats;
+    ImGui::Text("%d frames in flight:  CPU %.2f ms, GPU %.2f ms", VK.m_framesInFlight, fs.cpuMs, fs.gpuMs);
+    ImGui::Text("  waiting on GPU %.2f ms, CPU/GPU overlap %.2f ms", fs.waitMs,
+                std::max(0.0f, fs.cpuMs + fs.gpuMs - fs.frameMs));
+
+    if (ImGui::CollapsingHeader("GPU profile")) {
+        if (!VK.m_profiler.enabled())
+            ImGui::Text("No GPU timestamp support");
+        ImGui::Text("%-24s %7s %7s %7s %7s", "ms (last 256 frames)", "avg", "p50", "p95", "p99");
+        for (const GpuProfiler::ZoneStats& z : VK.m_profiler.stats())
+            ImGui::Text("%*s%-*s %7.3f %7.3f %7.3f %7.3f", 2*z.depth, "", 24-2*z.depth, z.name.c_str(),
+                        z.avgMs, z.p50Ms, z.p95Ms, z.p99Ms); }
+
+    if (ImGui::CollapsingHeader("Memory")) {
+        MemoryStats mem = VK.m_allocator.stats();
+        ImGui::Text("%u vkAllocateMemory (%u dedicated), %u allocations",
+                    mem.deviceMemoryCount, mem.dedicatedCount, mem.allocationCount);
+        ImGui::Text("Fragmentation %.1f%%", 100.0f*mem.fragmentation);
+        for (size_t h=0;  h<mem.heaps.size();  h++) {
+            const MemoryHeapStats& hs = mem.heaps[h];
+            ImGui::Text("Heap %zu%s: %.1f / %.1f MB used/reserved", h,
+                        hs.deviceLocal ? " (device)" : "", hs.used/1048576.0, hs.reserved/1048576.0);
+            if (hs.budget)
+                ImGui::Text("    process %.1f of %.1f MB budget", hs.usage/1048576.0, hs.budget/1048576.0); } }
 
 }
 
@@ -48,30 +89,80 @@ int main(int argc, char** argv)
     app =  new App(argc, argv); // Constructs the glfw window and sets UI callbacks
 
     
+    Benchmark benchmark;
+    if (!app->benchmarkPath.empty() && !benchmark.init(app, app->benchmarkPath))
+        exit(-1);
+
     VkApp VK(app); // Creates and manages all things Vulkan.
 
     // The draw loop
     printf("looping =======================================\n");
-    while(!glfwWindowShouldClose(app->GLFW_window)) {
-        glfwPollEvents();
-        app->updateCamera();
+    int frames = 0;
+    double loopStart = app->time();
+    auto drawFrame = [&]() {
+        VK.drawFrame();
+        if (frames == 0)  // Submitted, that is;  the restart cost that startup's stage graph cuts
+            printf("First frame: %.1f ms after the process started\n", traceNow()/1e6); };
+    while((app->headless || !glfwWindowShouldClose(app->GLFW_window))
+          && (app->frameLimit == 0 || frames < app->frameLimit)
+          && (app->secondsLimit == 0 || app->time() - loopStart < app->secondsLimit)) {
+        TRACE_SCOPE("frame");
+        if (benchmark.active())
+            benchmark.beginFrame(frames);
+        
+        if (app->headless) {
+            drawFrame();
+            if (benchmark.active())
+                benchmark.endFrame(VK, frames);
+            frames++;
+            continue; }
+        
+        {
+            TRACE_SCOPE("glfwPollEvents");
+            glfwPollEvents();
+        }
+        if (!benchmark.active()) {
+            TRACE_SCOPE("updateCamera");
+            app->updateCamera();
+        }
         
         #ifdef GUI
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
-        if(app->m_show_gui)
-            drawGUI(VK);
+        {
+            TRACE_SCOPE("ImGui");
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            if(app->m_show_gui)
+                drawGUI(VK);
+        }
         #endif
 
-        VK.drawFrame();
+        drawFrame();
+        if (benchmark.active())
+            benchmark.endFrame(VK, frames);
+        frames++;
     }
 
+    if (benchmark.active()) {
+        app->measureFrames = std::max(0, frames - app->warmupFrames);  // Fewer, if -seconds ran out
+        benchmark.finish(VK); }
+
+    // Headless, save the tonemapped image exactly as post.frag wrote it.
+    if (!app->savePath.empty() && app->headless)
+        VK.saveImage(VK.m_offscreenTargets[VK.m_swapchainIndex], app->savePath,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    else if (!app->savePath.empty())
+        VK.saveImage(VK.m_scImageBuffer, app->savePath);
+
+    if (!app->tracePath.empty())
+        traceWrite(app->tracePath);
+
     // Cleanup
 
     VK.destroyAllVulkanResources();
 
-    glfwDestroyWindow(app->GLFW_window);
-    glfwTerminate();
+    if (!app->headless) {
+        glfwDestroyWindow(app->GLFW_window);
+        glfwTerminate(); }
 }
 
 void framebuffersize_cb(GLFWwindow* window, int w, int h)
@@ -128,10 +219,21 @@ void key_cb(GLFWwindow* window, int key, int scancode, int action, int mods)
 
     if (pressed && key == GLFW_KEY_ESCAPE)
         glfwSetWindowShouldClose(window, 1);
+
+    if (action == GLFW_PRESS && key == GLFW_KEY_T && !app->tracePath.empty())
+        traceWrite(app->tracePath);
 }
 
 static float lastTime = 0;
 
+double App::time()
+{
+    if (!headless)
+        return glfwGetTime();
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 void App::updateCamera()
 {
     float now = glfwGetTime();
@@ -170,15 +272,108 @@ void App::updateCamera()
 App::App(int argc, char** argv)
 {
     doApiDump = false;
+    framesInFlight = 2;
+    fp32 = false;
+    frameLimit = 0;
+    headless = false;
+    headlessWidth = headlessHeight = 0;
+    warmupFrames = 32;
+    measureFrames = 256;
+    jsonPath = "benchmark.json";
+    secondsLimit = 0;
+    explicitLight = false;
+    mis = true;
+    lightChoice = eLightPower;
+    minDepth = 2;
+    maxDepth = 16;
+    samplerChoice = eSamplerSobol;
+    denoiseIterations = 5;
+    GLFW_window = nullptr;
 
     int argi = 1;
     while (argi<argc) {
         std::string arg = argv[argi++];
         if (arg == "-d")
             doApiDump = true;
+        else if (arg == "-framesInFlight" && argi<argc)
+            framesInFlight = std::max(1, atoi(argv[argi++]));
+        else if (arg == "-fp32")
+            fp32 = true;
+        else if (arg == "-frames" && argi<argc)
+            frameLimit = std::max(0, atoi(argv[argi++]));
+        else if (arg == "-save" && argi<argc)
+            savePath = argv[argi++];
+        else if (arg == "-csv" && argi<argc)
+            csvPath = argv[argi++];
+        else if (arg == "-trace" && argi<argc)
+            tracePath = argv[argi++];
+        else if ((arg == "--headless" || arg == "-headless") && argi<argc) {
+            headless = true;
+            if (sscanf(argv[argi++], "%dx%d", &headlessWidth, &headlessHeight) != 2
+                || headlessWidth <= 0 || headlessHeight <= 0) {
+                printf("Expected --headless WIDTHxHEIGHT\n");
+                exit(-1); } }
+        else if (arg == "-benchmark" && argi<argc)
+            benchmarkPath = argv[argi++];
+        else if (arg == "-warmup" && argi<argc)
+            warmupFrames = std::max(0, atoi(argv[argi++]));
+        else if (arg == "-measure" && argi<argc)
+            measureFrames = std::max(1, atoi(argv[argi++]));
+        else if (arg == "-reference" && argi<argc)
+            referencePath = argv[argi++];
+        else if (arg == "-json" && argi<argc)
+            jsonPath = argv[argi++];
+        else if (arg == "-seconds" && argi<argc)
+            secondsLimit = std::max(0.0, atof(argv[argi++]));
+        else if (arg == "-explicitLight")
+            explicitLight = true;
+        else if (arg == "-noMis")
+            mis = false;
+        else if (arg == "-lights" && argi<argc) {
+            std::string choice = argv[argi++];
+            if (choice == "uniform")
+                lightChoice = eLightUniform;
+            else if (choice == "power")
+                lightChoice = eLightPower;
+            else if (choice == "tree")
+                lightChoice = eLightTree;
+            else {
+                printf("Expected -lights uniform, power or tree\n");
+                exit(-1); } }
+        else if (arg == "-sampler" && argi<argc) {
+            std::string choice = argv[argi++];
+            if (choice == "random")
+                samplerChoice = eSamplerRandom;
+            else if (choice == "sobol")
+                samplerChoice = eSamplerSobol;
+            else {
+                printf("Expected -sampler random or sobol\n");
+                exit(-1); } }
+        else if (arg == "-minDepth" && argi<argc)
+            minDepth = std::max(1, atoi(argv[argi++]));
+        else if (arg == "-maxDepth" && argi<argc)
+            maxDepth = std::max(1, atoi(argv[argi++]));
+        else if (arg == "-denoise" && argi<argc)
+            denoiseIterations = std::min(5, std::max(0, atoi(argv[argi++])));
         else {
             printf("Unknown argument: %s\n", arg.c_str());
             exit(-1); } }
+    minDepth = std::min(minDepth, maxDepth);
+
+    if (!tracePath.empty())
+        traceEnable(true);
+    TRACE_SCOPE("App::App");
+
+    // A benchmark runs exactly its warm-up and measured frames.
+    if (!benchmarkPath.empty())
+        frameLimit = warmupFrames + measureFrames;
+
+    // Headless there is no GLFW at all, so no display is needed.
+    if (headless) {
+        if (frameLimit == 0 && secondsLimit == 0)
+            frameLimit = 256;
+        printf("Headless %dx%d, %d frames\n", headlessWidth, headlessHeight, frameLimit);
+        return; }
 
     glfwSetErrorCallback(onErrorCallback);
 
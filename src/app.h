@@ -1,3 +1,4 @@
+#include <string>
 
 #include "camera.h"
 
@@ -7,6 +8,31 @@ public:
     GLFWwindow* GLFW_window;
     App(int argc, char** argv);
     bool doApiDump;
+    int framesInFlight;   // -framesInFlight N
+    bool fp32;            // -fp32:  RGBA32F render targets (see VkApp::RenderTargetFormats)
+    int frameLimit;       // -frames N:  exit after N frames;  0 for no limit
+    std::string savePath; // -save file.pfm:  write the final rendered image at exit
+    std::string csvPath;  // -csv file.csv:  stream GPU profiler zone times
+    std::string tracePath;// -trace file.json:  CPU trace (see trace.h), written at exit or on the T key
+    bool headless;        // --headless WxH:  no window, swapchain or GUI;  render offscreen
+    int headlessWidth, headlessHeight;
+    std::string benchmarkPath;  // -benchmark file.cam:  scripted camera run (see benchmark.h)
+    int warmupFrames;           // -warmup N
+    int measureFrames;          // -measure M
+    std::string referencePath;  // -reference file.pfm:  for the benchmark's convergence error
+    std::string jsonPath;       // -json file.json:  the benchmark report
+    double secondsLimit;  // -seconds S:  exit after S seconds of frames;  0 for no limit (for equal-time comparisons)
+    bool explicitLight;   // -explicitLight:  start with explicit light connections on
+    bool mis;             // -noMis:  weight explicit light and BRDF hits 0.5 each, not by MIS
+    int lightChoice;      // -lights uniform|power|tree:  how to choose emitters (see LightChoice);  power by default
+    int minDepth;         // -minDepth N:  path segments before Russian roulette
+    int maxDepth;         // -maxDepth N:  hard limit on path segments
+    int samplerChoice;    // -sampler random|sobol:  where sample values come from (see SamplerChoice)
+    int denoiseIterations;// -denoise N:  a-trous iterations;  0 to see (and measure) the raw accumulation
+    
+    double time();        // Seconds;  glfwGetTime() unless headless
+    int cameraFrame{-1};  // When >= 0, Camera::view is timed by this frame index
+    double cameraTime() { return cameraFrame >= 0 ? cameraFrame : time(); }
     
     bool m_show_gui = true;
     Camera myCamera;
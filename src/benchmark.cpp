@@ -0,0 +1,172 @@
+//////////////////////////////////////////////////////////////////////
+// Deterministic benchmark runs (see benchmark.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "vkapp.h"
+#include "app.h"
+#include "benchmark.h"
+#include "image_io.h"
+
+bool Benchmark::init(App* _app, const std::string& pathFile)
+{
+    std::ifstream file(pathFile);
+    if (!file.is_open()) {
+        printf("Could not read camera path %s\n", pathFile.c_str());
+        return false; }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream words(line);
+        Keyframe k;
+        if (!(words >> k.frame))
+            continue;  // Blank or a # comment
+        if (!(words >> k.spin >> k.tilt >> k.eye.x >> k.eye.y >> k.eye.z)
+            || (!m_keyframes.empty() && k.frame <= m_keyframes.back().frame)) {
+            printf("%s:%d:  expected increasing \"frame spin tilt eyeX eyeY eyeZ\"\n",
+                   pathFile.c_str(), lineNumber);
+            return false; }
+        m_keyframes.push_back(k); }
+
+    if (m_keyframes.empty()) {
+        printf("%s:  no keyframes\n", pathFile.c_str());
+        return false; }
+
+    app = _app;
+    m_frameMs.name = "frame";
+    m_cpuMs.name = "cpu";
+    printf("Benchmark:  %zu keyframes, %d warm-up and %d measured frames\n",
+           m_keyframes.size(), app->warmupFrames, app->measureFrames);
+    return true;
+}
+
+void Benchmark::beginFrame(int frame)
+{
+    Camera& cam = app->myCamera;
+    app->cameraFrame = frame;  // Camera::view's time is the frame index
+    int f = frame - app->warmupFrames;
+
+    if (frame == 0) {
+        const Keyframe& k = m_keyframes[0];
+        cam.reset(k.eye, cam.rate, k.spin, k.tilt, cam.ry, cam.front, cam.back);
+        cam.modified = true; }
+
+    for (size_t i=0;  i<m_keyframes.size();  i++) {
+        if (m_keyframes[i].frame != f)
+            continue;
+        // Arriving at a keyframe, view() stops interpolating;  restart
+        // accumulation at the exact pose.
+        cam.modified = true;
+        if (i+1 < m_keyframes.size()) {
+            const Keyframe& next = m_keyframes[i+1];
+            cam.animateTo(float(frame), float(next.frame - f), next.spin, next.tilt, next.eye); } }
+}
+
+void Benchmark::endFrame(VkApp& VK, int frame)
+{
+    double now = app->time();
+    if (frame >= app->warmupFrames && frame > 0) {
+        float frameMs = float(1000.0*(now - m_lastTime));
+        m_frameMs.ms.push_back(frameMs);
+        m_cpuMs.ms.push_back(frameMs - float(VK.m_frameWaitMs)); }
+    m_lastTime = now;
+
+    sampleGpu(VK);
+}
+
+// prepareFrame collects at most one frame per call, so sampling after
+// every frame sees each collected frame once.  Frames are collected in
+// the order submitted, so the nth collected is the nth rendered.
+void Benchmark::sampleGpu(VkApp& VK)
+{
+    uint64_t n = VK.m_profiler.frameNumber();
+    if (n == m_gpuFrames)
+        return;
+    m_gpuFrames = n;
+    if (n <= uint64_t(app->warmupFrames))
+        return;
+
+    for (const GpuProfiler::ZoneTime& z : VK.m_profiler.lastFrame()) {
+        auto s = std::find_if(m_gpu.begin(), m_gpu.end(),
+                              [&](const Series& s) { return s.name == z.name; });
+        if (s == m_gpu.end()) {
+            m_gpu.push_back(Series{z.name, z.depth});
+            s = m_gpu.end() - 1; }
+        s->ms.push_back(z.ms); }
+}
+
+static void writeStats(FILE* f, std::vector<float> sorted)
+{
+    if (sorted.empty()) {
+        fprintf(f, "{\"count\": 0}");
+        return; }
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](float p) { return sorted[size_t(p*(sorted.size() - 1) + 0.5f)]; };
+    double sum = 0;
+    for (float t : sorted)
+        sum += t;
+    fprintf(f, "{\"count\": %zu, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+            sorted.size(), sum/sorted.size(), percentile(0.50f), percentile(0.95f), percentile(0.99f),
+            sorted.back());
+}
+
+void Benchmark::finish(VkApp& VK)
+{
+    // The last frames in flight have not been collected yet.
+    vkDeviceWaitIdle(VK.m_device);
+    for (uint32_t i=0;  i<VK.m_framesInFlight;  i++) {
+        VK.m_profiler.collect((VK.m_frameIndex + i) % VK.m_framesInFlight);
+        sampleGpu(VK); }
+
+    // Convergence:  the final image against a reference.  Measure with
+    // -denoise 0, against a reference made with it too, or the error is
+    // the filter's bias, not the sampling's.
+    bool compared = false;
+    ImageDiff diff;
+    if (!app->referencePath.empty()) {
+        FloatImage reference;
+        FloatImage image = VK.readImage(VK.m_scImageBuffer);
+        if (readPfm(app->referencePath, reference)) {
+            if (reference.width == image.width && reference.height == image.height) {
+                diff = diffImages(image, reference);
+                compared = true; }
+            else
+                printf("Reference %s is %dx%d;  the render is %dx%d\n", app->referencePath.c_str(),
+                       reference.width, reference.height, image.width, image.height); } }
+
+    FILE* f = fopen(app->jsonPath.c_str(), "w");
+    if (!f) {
+        printf("Could not write %s\n", app->jsonPath.c_str());
+        return; }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VK.m_physicalDevice, &properties);
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"device\": \"%s\",\n", properties.deviceName);
+    fprintf(f, "  \"width\": %u, \"height\": %u,\n", VK.windowSize.width, VK.windowSize.height);
+    fprintf(f, "  \"warmupFrames\": %d, \"measuredFrames\": %d, \"framesInFlight\": %u,\n",
+            app->warmupFrames, app->measureFrames, VK.m_framesInFlight);
+    fprintf(f, "  \"denoiseIterations\": %d,\n", VK.m_num_atrous_iterations);
+    fprintf(f, "  \"frameMs\": ");
+    writeStats(f, m_frameMs.ms);
+    fprintf(f, ",\n  \"cpuMs\": ");
+    writeStats(f, m_cpuMs.ms);
+    fprintf(f, ",\n  \"gpuMs\": {");
+    for (size_t i=0;  i<m_gpu.size();  i++) {
+        fprintf(f, "%s\n    \"%s\": ", i ? "," : "", m_gpu[i].name.c_str());
+        writeStats(f, m_gpu[i].ms); }
+    fprintf(f, "\n  }");
+    if (compared)
+        fprintf(f, ",\n  \"convergence\": {\"reference\": \"%s\", \"rmse\": %.6g, \"relativeRmse\": %.6g, \"maxAbs\": %.6g}",
+                app->referencePath.c_str(), diff.rmse, diff.relativeRmse, diff.maxAbs);
+    fprintf(f, "\n}\n");
+    fclose(f);
+    printf("Benchmark:  report written to %s\n", app->jsonPath.c_str());
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Deterministic benchmark runs.
+//
+// A camera path file holds keyframes, one per line:
+//
+//     # frame  spin  tilt   eyeX  eyeY  eyeZ
+//     0        -20   10.66  2.28  1.68  6.64
+//     120      15    5      1.0   1.68  4.0
+//
+// Frame numbers count from the first measured frame.  The camera
+// holds the first pose through the warm-up frames, then moves between
+// keyframes with Camera::animateTo, timed by frame index rather than
+// the clock, so every run renders the same images.  Hold the last pose
+// for a while if the final image is to be compared with a reference.
+//
+// Each measured frame samples the CPU frame time and every GPU profiler
+// zone (see gpu_profiler.h).  finish() writes their averages and
+// percentiles, and the final image's error against a reference PFM if
+// one is given, to a JSON file.
+////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+class App;
+class VkApp;
+
+class Benchmark
+{
+public:
+    bool init(App* _app, const std::string& pathFile);  // False if the file is unreadable
+    bool active() const { return app != nullptr; }
+
+    void beginFrame(int frame);               // Pose the camera;  frame counts from 0, warm-up included
+    void endFrame(VkApp& VK, int frame);      // Sample frame times
+    void finish(VkApp& VK);                   // Write the JSON report
+
+private:
+    struct Keyframe
+    {
+        int frame;
+        float spin, tilt;
+        glm::vec3 eye;
+    };
+    struct Series
+    {
+        std::string name;
+        int depth{0};
+        std::vector<float> ms;
+    };
+
+    App* app{nullptr};
+    std::vector<Keyframe> m_keyframes;
+    std::vector<Series> m_gpu;        // In order of first appearance
+    Series   m_frameMs, m_cpuMs;
+    double   m_lastTime{0};
+    uint64_t m_gpuFrames{0};          // Profiler frames seen
+
+    void sampleGpu(VkApp& VK);
+};
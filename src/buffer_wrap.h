@@ -1,14 +1,15 @@
-
 # pragma once
 
+#include "memory_allocator.h"
+
 struct BufferWrap
 {
-    VkBuffer buffer;
-    VkDeviceMemory memory;
+    VkBuffer buffer{};
+    Allocation alloc;   // Sub-allocated by VkApp::m_allocator
     
     void destroy(VkDevice& device)
     {
         vkDestroyBuffer(device, buffer, nullptr);
-        vkFreeMemory(device, memory, nullptr);
+        alloc.free();
     }
 };
@@ -23,9 +23,9 @@ void Camera::reset(glm::vec3 _eye, float _rate,
     viewParms();
 }
 
-void Camera::animateTo(float deltaTime, float endSpin, float endTilt, const glm::vec3& endEye)
+void Camera::animateTo(float now, float deltaTime, float endSpin, float endTilt, const glm::vec3& endEye)
 {
-    startTime = glfwGetTime();
+    startTime = now;
     endTime = startTime + deltaTime;
     startSpin = spin;  spin = endSpin;
     startTilt = tilt;  tilt = endTilt;
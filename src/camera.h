@@ -41,7 +41,9 @@ class Camera
                float spin=0.0, float tilt=0.0,
                float ry=0.57, float front=0.1, float back=1000.0);
     
-    void animateTo(float deltaTime, float spin, float tilt, const glm::vec3& eye);
+    // Move smoothly from the current pose, over [now, now+deltaTime] as
+    // measured by the time later passed to view().
+    void animateTo(float now, float deltaTime, float spin, float tilt, const glm::vec3& eye);
     glm::mat4 perspective(const float aspect);
     glm::mat4 view(float time);
 
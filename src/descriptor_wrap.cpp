@@ -2,9 +2,10 @@
 #include "descriptor_wrap.h"
 #include <assert.h>
 
-void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt)
+void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt,
+                                 uint setCount)
 {
-    uint maxSets = 1;  // 1 is good enough for us.  In general, may want more;
+    uint maxSets = setCount;  // Usually 1; more for resources that alternate between frames
     bindingTable = _bt;
 
     // Build descSetLayout
@@ -44,16 +45,28 @@ void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptor
 
     vkCreateDescriptorPool(device, &descrPoolInfo, nullptr, &descPool);
 
-    // Allocate DescriptorSet
+    // Allocate the DescriptorSets, all from the above pool and all
+    // with the same layout.
+    std::vector<VkDescriptorSetLayout> layouts(maxSets, descSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
     allocInfo.descriptorPool              = descPool;
-    allocInfo.descriptorSetCount          = 1;
-    allocInfo.pSetLayouts                 = &descSetLayout;
+    allocInfo.descriptorSetCount          = maxSets;
+    allocInfo.pSetLayouts                 = layouts.data();
 
-    // Warning: The next line creates a single descriptor set from the
-    // above pool since that's all our program needs.  This is too
-    // restrictive in general, but fine for this program.
-    vkAllocateDescriptorSets(device, &allocInfo, &descSet);
+    descSets.resize(maxSets);
+    vkAllocateDescriptorSets(device, &allocInfo, descSets.data());
+    descSet = descSets[0];
+}
+
+// Send one write to the chosen set, or to every set.
+void DescriptorWrap::update(VkDevice& device, VkWriteDescriptorSet& writeSet, int set)
+{
+    assert(set == allSets || (set >= 0 && set < (int)descSets.size()));
+    for (int i=0;  i<(int)descSets.size();  i++) {
+        if (set != allSets && set != i)
+            continue;
+        writeSet.dstSet = descSets[i];
+        vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr); }
 }
 
 void DescriptorWrap::destroy(VkDevice device)
@@ -62,11 +75,11 @@ void DescriptorWrap::destroy(VkDevice device)
     vkDestroyDescriptorPool(device, descPool, nullptr);
 }
 
-void DescriptorWrap::write(VkDevice& device, uint index, const VkBuffer& buffer)
+void DescriptorWrap::write(VkDevice& device, uint index, const VkBuffer& buffer, VkDeviceSize range,
+                           int set)
 {
-    VkDescriptorBufferInfo desBuf{buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo desBuf{buffer, 0, range};
     VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-    writeSet.dstSet          = descSet;
     writeSet.dstBinding      = index;
     writeSet.dstArrayElement = 0;
     writeSet.descriptorCount = 1;
@@ -80,16 +93,16 @@ void DescriptorWrap::write(VkDevice& device, uint index, const VkBuffer& buffer)
            writeSet.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ||
            writeSet.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
     
-    vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr);
+    update(device, writeSet, set);
 
 }
 
-void DescriptorWrap::write(VkDevice& device, uint index, const VkDescriptorImageInfo& textureDesc)
+void DescriptorWrap::write(VkDevice& device, uint index, const VkDescriptorImageInfo& textureDesc,
+                           int set)
 {
     //VkDescriptorBufferInfo desBuf{nvbuffer.buffer, 0, VK_WHOLE_SIZE};
 
     VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-    writeSet.dstSet          = descSet;
     writeSet.dstBinding      = index;
     writeSet.dstArrayElement = 0;
     writeSet.descriptorCount = 1;
@@ -104,10 +117,11 @@ void DescriptorWrap::write(VkDevice& device, uint index, const VkDescriptorImage
            writeSet.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE  ||
            writeSet.descriptorType == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT);
     
-    vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr);
+    update(device, writeSet, set);
 }
 
-void DescriptorWrap::write(VkDevice& device, uint index, const std::vector<ImageWrap>& textures)
+void DescriptorWrap::write(VkDevice& device, uint index, const std::vector<ImageWrap>& textures,
+                           int set)
 {
     //VkDescriptorBufferInfo desBuf{nvbuffer.buffer, 0, VK_WHOLE_SIZE};
     std::vector<VkDescriptorImageInfo> des;
@@ -115,7 +129,6 @@ void DescriptorWrap::write(VkDevice& device, uint index, const std::vector<Image
         des.emplace_back(texture.Descriptor());
 
     VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-    writeSet.dstSet          = descSet;
     writeSet.dstBinding      = index;
     writeSet.dstArrayElement = 0;
     writeSet.descriptorCount = des.size();
@@ -130,10 +143,11 @@ void DescriptorWrap::write(VkDevice& device, uint index, const std::vector<Image
            writeSet.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE  ||
            writeSet.descriptorType == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT);
     
-    vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr);
+    update(device, writeSet, set);
 }
 
-void DescriptorWrap::write(VkDevice& device, uint index, const VkAccelerationStructureKHR& tlas)
+void DescriptorWrap::write(VkDevice& device, uint index, const VkAccelerationStructureKHR& tlas,
+                           int set)
 {
     VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
         VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
@@ -141,7 +155,6 @@ void DescriptorWrap::write(VkDevice& device, uint index, const VkAccelerationStr
     descASInfo.pAccelerationStructures    = &tlas;
   
     VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-    writeSet.dstSet          = descSet;
     writeSet.dstBinding      = index;
     writeSet.dstArrayElement = 0;
     writeSet.descriptorCount = 1;
@@ -152,5 +165,5 @@ void DescriptorWrap::write(VkDevice& device, uint index, const VkAccelerationStr
 
     assert(writeSet.descriptorType == VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR);
     
-    vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr);
+    update(device, writeSet, set);
 }
@@ -13,14 +13,26 @@ public:
     
     VkDescriptorSetLayout descSetLayout;
     VkDescriptorPool descPool;
-    VkDescriptorSet descSet;    // Could be  vector<VkDescriptorSet> for multiple sets;
+    VkDescriptorSet descSet;    // The first (usually only) set; same as descSets[0]
+    std::vector<VkDescriptorSet> descSets;  // setCount sets, all with the same layout
     
-    void setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt);
+    void setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt,
+                     uint setCount=1);
     void destroy(VkDevice device);
 
     // Any data can be written into a descriptor set.  Apparently I need only these few types:
-    void write(VkDevice& device, uint index, const VkBuffer& buffer);
-    void write(VkDevice& device, uint index, const VkDescriptorImageInfo& textureDesc);
-    void write(VkDevice& device, uint index, const std::vector<ImageWrap>& textures);
-    void write(VkDevice& device, uint index, const VkAccelerationStructureKHR& tlas);
+    // The set argument picks one of descSets; allSets writes the same thing into each.
+    static const int allSets = -1;
+    void write(VkDevice& device, uint index, const VkBuffer& buffer,
+               VkDeviceSize range=VK_WHOLE_SIZE,  // For a dynamic buffer:  the size of one slice
+               int set=allSets);
+    void write(VkDevice& device, uint index, const VkDescriptorImageInfo& textureDesc,
+               int set=allSets);
+    void write(VkDevice& device, uint index, const std::vector<ImageWrap>& textures,
+               int set=allSets);
+    void write(VkDevice& device, uint index, const VkAccelerationStructureKHR& tlas,
+               int set=allSets);
+
+private:
+    void update(VkDevice& device, VkWriteDescriptorSet& writeSet, int set);
 };
@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////////
+// Read-only whole file views (see file_view.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "file_view.h"
+
+// Per filebench, mapping wins somewhere past 32-64KB.
+size_t FileView::s_mapMinSize = 64<<10;
+
+FileView::FileView(FileView&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+FileView& FileView::operator=(FileView&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        std::swap(m_data,    other.m_data);
+        std::swap(m_size,    other.m_size);
+        std::swap(m_open,    other.m_open);
+        std::swap(m_mapped,  other.m_mapped);
+        std::swap(m_mapping, other.m_mapping); }
+    return *this;
+}
+
+bool FileView::open(const std::string& path)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false; }
+    m_size = (size_t)size.QuadPart;
+
+    if (m_size > 0 && m_size >= s_mapMinSize) {
+        if (HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)) {
+            if (void* base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) {
+                CloseHandle(file);
+                m_data = (const uint8_t*)base;
+                m_mapping = mapping;
+                m_mapped = m_open = true;
+                return true; }
+            CloseHandle(mapping); } }
+
+    uint8_t* buffer = m_size ? (uint8_t*)::operator new(m_size, std::align_val_t(kAlignment)) : nullptr;
+    size_t done = 0;
+    while (done < m_size) {
+        DWORD chunk = (DWORD)std::min<size_t>(m_size - done, 1u<<30), got = 0;
+        if (!ReadFile(file, buffer + done, chunk, &got, nullptr) || got == 0)
+            break;
+        done += got; }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false; }
+    m_size = (size_t)st.st_size;
+
+    if (m_size > 0 && m_size >= s_mapMinSize) {
+        void* base = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            ::close(fd);  // The mapping keeps its own reference to the file
+            m_data = (const uint8_t*)base;
+            m_mapped = m_open = true;
+            return true; } }
+
+    uint8_t* buffer = m_size ? (uint8_t*)::operator new(m_size, std::align_val_t(kAlignment)) : nullptr;
+    size_t done = 0;
+    while (done < m_size) {
+        ssize_t got = ::read(fd, buffer + done, m_size - done);
+        if (got <= 0)
+            break;
+        done += got; }
+    ::close(fd);
+#endif
+
+    m_data = buffer;
+    m_open = true;
+    if (done != m_size) {  // Shrunk while reading, or a read error
+        close();
+        return false; }
+    return true;
+}
+
+void FileView::close()
+{
+    if (m_mapped) {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle((HANDLE)m_mapping);
+#else
+        munmap((void*)m_data, m_size);
+#endif
+    }
+    else if (m_data)
+        ::operator delete((void*)m_data, std::align_val_t(kAlignment));
+
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+    m_mapped = false;
+    m_mapping = nullptr;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// A read-only view of a whole file.
+//
+//     FileView spv("spv/post.vert.spv");
+//     if (spv.isOpen())
+//         use(spv.as<uint32_t>(), spv.size());
+//
+// A large file is memory-mapped when it can be;  pages are then read
+// on first touch, straight from the OS file cache, with no copy.  A
+// small file (under s_mapMinSize), or one that fails to map, is read
+// with read() into a buffer of its own:  setting up and tearing down a
+// mapping costs more than copying a few pages.  Either way
+// data() is aligned to at least kAlignment bytes, so the bytes may be
+// used in place as arrays of uint32_t (SPIR-V), or of the 16-byte
+// aligned structures in the scene cache and .rtex files.
+//
+// The view is valid until close() or destruction.  Moving transfers
+// it;  copying is not allowed.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class FileView
+{
+public:
+    static const size_t kAlignment = 16;
+    static size_t s_mapMinSize;  // Smaller files are read;  SIZE_MAX never maps, 1 always does
+
+    FileView() = default;
+    explicit FileView(const std::string& path) { open(path); }
+    ~FileView() { close(); }
+
+    FileView(FileView&& other) noexcept;
+    FileView& operator=(FileView&& other) noexcept;
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    // False (and nothing open) if the file can not be read.  An empty
+    // file opens, with size() 0.
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return m_open; }
+    bool isMapped() const { return m_mapped; }
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    template <class T> const T* as(size_t offset=0) const { return (const T*)(m_data + offset); }
+
+private:
+    const uint8_t* m_data{nullptr};
+    size_t m_size{0};
+    bool   m_open{false};
+    bool   m_mapped{false};    // Else m_data is ours, from an aligned operator new
+    void*  m_mapping{nullptr}; // Windows file mapping handle
+};
@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////
+// Times whole file loading, the old way and through FileView.
+//
+//   filebench [-n repeats] file...
+//
+// For each file, and for the list as a whole, prints the median time
+// of each loader over the repeats:
+//
+//   istreambuf  the former VkApp::loadFile:  std::istreambuf_iterator
+//               into a std::string, a character at a time
+//   read        FileView with mapping turned off:  read() into an
+//               aligned buffer
+//   mmap        FileView, always memory-mapped
+//   FileView    FileView as the app uses it:  read() below
+//               FileView::s_mapMinSize, mapped above
+//
+// Every loader's bytes are summed, so the mapped pages are actually
+// faulted in and the comparison is of bytes in hand.  Files are warm
+// in the OS cache after the first repeat;  this measures the loaders,
+// not the disk.  "make file-bench" runs it on the shaders and the
+// scene caches.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "file_view.h"
+
+static uint64_t sumBytes(const uint8_t* data, size_t size)
+{
+    uint64_t sum = 0;
+    for (size_t i=0;  i<size;  i++)
+        sum += data[i];
+    return sum;
+}
+
+static uint64_t loadIstreambuf(const std::string& path)
+{
+    std::string result;
+    std::ifstream stream(path, std::ios::ate | std::ios::binary);
+    if (!stream.is_open())
+        return 0;
+    result.reserve(stream.tellg());
+    stream.seekg(0, std::ios::beg);
+    result.assign((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    return sumBytes((const uint8_t*)result.data(), result.size());
+}
+
+static uint64_t loadFileView(const std::string& path, size_t mapMinSize)
+{
+    size_t saved = FileView::s_mapMinSize;
+    FileView::s_mapMinSize = mapMinSize;
+    FileView file(path);
+    FileView::s_mapMinSize = saved;
+    return sumBytes(file.data(), file.size());
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 20;
+    std::vector<std::string> paths;
+    for (int argi=1;  argi<argc;  argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-n" && argi+1<argc)
+            repeats = std::max(1, atoi(argv[++argi]));
+        else if (arg[0] != '-')
+            paths.push_back(arg);
+        else {
+            printf("Usage: filebench [-n repeats] file...\n");
+            return 2; } }
+    if (paths.empty()) {
+        printf("Usage: filebench [-n repeats] file...\n");
+        return 2; }
+
+    const int kLoaders = 4;
+    const char* names[kLoaders] = {"istreambuf", "read", "mmap", "FileView"};
+    auto load = [](int loader, const std::string& path) {
+        switch (loader) {
+        case 0:  return loadIstreambuf(path);
+        case 1:  return loadFileView(path, SIZE_MAX);
+        case 2:  return loadFileView(path, 1);
+        default: return loadFileView(path, FileView::s_mapMinSize); } };
+
+    // Median milliseconds of each loader, per file.
+    double totals[kLoaders] = {};
+    size_t totalBytes = 0;
+    printf("%-44s %10s", "file", "bytes");
+    for (const char* name : names)
+        printf(" %12s", name);
+    printf("\n");
+    for (const std::string& path : paths) {
+        FileView probe(path);
+        if (!probe.isOpen()) {
+            printf("Could not read %s\n", path.c_str());
+            continue; }
+        totalBytes += probe.size();
+
+        printf("%-44s %10zu", path.c_str(), probe.size());
+        uint64_t sums[kLoaders];
+        for (int loader=0;  loader<kLoaders;  loader++) {
+            std::vector<double> ms;
+            for (int r=0;  r<repeats;  r++) {
+                auto start = std::chrono::steady_clock::now();
+                sums[loader] = load(loader, path);
+                ms.push_back(std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - start).count()); }
+            std::sort(ms.begin(), ms.end());
+            double median = ms[ms.size()/2];
+            totals[loader] += median;
+            printf(" %10.3fms", median); }
+        printf("\n");
+        if (std::count(sums, sums+kLoaders, sums[0]) != kLoaders)
+            printf("%s:  loaders disagree!\n", path.c_str()); }
+
+    printf("%-44s %10zu", "total", totalBytes);
+    for (double t : totals)
+        printf(" %10.3fms", t);
+    printf("\n");
+    for (int loader=1;  loader<kLoaders;  loader++)
+        if (totals[loader] > 0)
+            printf("%s is %.1fx faster than %s\n", names[loader], totals[0]/totals[loader], names[0]);
+    return 0;
+}
@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////////////////
+// Checks and times flattenMeshInstances (see mesh_flatten.h) against
+// the serial walk it replaced, on a synthetic model.
+//
+//   flattenbench [-grid N] [-instances K] [-repeat R]
+//
+// The model is K instances, each under its own transform, of an N x N
+// quad grid split into triangles (an all triangle mesh, so both its
+// vertices and faces split into chunks), and one mesh of N*N/4 quads
+// with no normals or texture coordinates (whose faces are one chunk).
+// The defaults make 6.8 million triangles.
+//
+// Both paths flatten the model R times;  it reports the best time of
+// each and the speedup, and compares the vertices, indices and matIndx
+// they produce byte for byte, exiting 1 if they differ.  "make
+// flatten-bench" builds and runs it.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mesh_flatten.h"
+
+// An n x n grid of quads in the unit square, each split into two
+// triangles.
+static aiMesh* gridMesh(unsigned int n, unsigned int material)
+{
+    aiMesh* mesh = new aiMesh;
+    mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+    mesh->mMaterialIndex = material;
+    mesh->mNumVertices = (n+1)*(n+1);
+    mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+    mesh->mNormals = new aiVector3D[mesh->mNumVertices];
+    mesh->mTextureCoords[0] = new aiVector3D[mesh->mNumVertices];
+    mesh->mNumUVComponents[0] = 2;
+    for (unsigned int j=0;  j<=n;  j++)
+        for (unsigned int i=0;  i<=n;  i++) {
+            unsigned int v = j*(n+1) + i;
+            float x = float(i)/n, y = float(j)/n;
+            mesh->mVertices[v] = aiVector3D(x, y, 0.1f*std::sin(7.0f*x)*std::cos(5.0f*y));
+            mesh->mNormals[v] = aiVector3D(0.0f, 0.0f, 1.0f);
+            mesh->mTextureCoords[0][v] = aiVector3D(x, y, 0.0f); }
+
+    mesh->mNumFaces = 2*n*n;
+    mesh->mFaces = new aiFace[mesh->mNumFaces];
+    for (unsigned int j=0, f=0;  j<n;  j++)
+        for (unsigned int i=0;  i<n;  i++) {
+            unsigned int v = j*(n+1) + i;
+            unsigned int quad[2][3] = {{v, v+1, v+n+2}, {v, v+n+2, v+n+1}};
+            for (auto& tri : quad) {
+                aiFace& face = mesh->mFaces[f++];
+                face.mNumIndices = 3;
+                face.mIndices = new unsigned int[3];
+                std::copy(tri, tri+3, face.mIndices); } }
+    return mesh;
+}
+
+// m separate quads, as polygons, with positions only.
+static aiMesh* quadMesh(unsigned int m, unsigned int material)
+{
+    aiMesh* mesh = new aiMesh;
+    mesh->mPrimitiveTypes = aiPrimitiveType_POLYGON;
+    mesh->mMaterialIndex = material;
+    mesh->mNumVertices = 4*m;
+    mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+    mesh->mNumFaces = m;
+    mesh->mFaces = new aiFace[m];
+    for (unsigned int q=0;  q<m;  q++) {
+        float x = float(q % 1024), y = float(q / 1024);
+        mesh->mVertices[4*q+0] = aiVector3D(x,      y,      1.0f);
+        mesh->mVertices[4*q+1] = aiVector3D(x+0.9f, y,      1.0f);
+        mesh->mVertices[4*q+2] = aiVector3D(x+0.9f, y+0.9f, 1.0f);
+        mesh->mVertices[4*q+3] = aiVector3D(x,      y+0.9f, 1.0f);
+        aiFace& face = mesh->mFaces[q];
+        face.mNumIndices = 4;
+        face.mIndices = new unsigned int[4];
+        for (unsigned int i=0;  i<4;  i++)
+            face.mIndices[i] = 4*q + i; }
+    return mesh;
+}
+
+template <typename T>
+static bool sameBytes(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()*sizeof(T)) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int grid = 1024, nbInstances = 3;
+    int repeat = 3;
+    for (int argi=1;  argi<argc;  argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-grid" && argi+1<argc)
+            grid = std::max(1, atoi(argv[++argi]));
+        else if (arg == "-instances" && argi+1<argc)
+            nbInstances = std::max(1, atoi(argv[++argi]));
+        else if (arg == "-repeat" && argi+1<argc)
+            repeat = std::max(1, atoi(argv[++argi]));
+        else {
+            printf("Usage: flattenbench [-grid N] [-instances K] [-repeat R]\n");
+            return 2; } }
+
+    // The model, and its instances as recurseModelNodes would record them.
+    aiMesh* meshes[2] = {gridMesh(grid, 1), quadMesh(std::max(1u, grid*grid/4), 2)};
+    std::vector<MeshInstance> instances;
+    size_t nbVertices = 0, nbTriangles = 0;
+    for (unsigned int k=0;  k<=nbInstances;  k++) {
+        const aiMesh* mesh = k < nbInstances ? meshes[0] : meshes[1];
+        aiMatrix4x4 transform, rotation, translation;
+        aiMatrix4x4::RotationZ(0.3f*k, rotation);
+        aiMatrix4x4::Translation(aiVector3D(1.5f*k, 0.0f, 0.25f*k), translation);
+        transform = translation*rotation;
+        instances.push_back({mesh, transform, nbVertices, nbTriangles});
+        nbVertices += mesh->mNumVertices;
+        for (unsigned int t=0;  t<mesh->mNumFaces;  t++)
+            nbTriangles += mesh->mFaces[t].mNumIndices - 2; }
+
+    printf("%zu mesh instances, %zu vertices, %zu triangles;  %u hardware threads\n",
+           instances.size(), nbVertices, nbTriangles, std::thread::hardware_concurrency());
+
+    auto best = [&](auto flatten, ModelData& out) {
+        double bestMs = 1e30;
+        for (int r=0;  r<repeat;  r++) {
+            ModelData meshdata;
+            auto start = std::chrono::high_resolution_clock::now();
+            flatten(meshdata);
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - start).count();
+            bestMs = std::min(bestMs, ms);
+            if (r == repeat-1)
+                out = std::move(meshdata); }
+        return bestMs; };
+
+    ModelData serial, parallel;
+    double serialMs = best([&](ModelData& m) { flattenMeshInstancesSerial(&m, instances); }, serial);
+    double parallelMs = best([&](ModelData& m) {
+        flattenMeshInstances(&m, instances, nbVertices, nbTriangles); }, parallel);
+
+    printf("  serial     %9.1f ms\n", serialMs);
+    printf("  parallel   %9.1f ms   %.2fx\n", parallelMs, serialMs/parallelMs);
+
+    bool same = sameBytes(serial.vertices, parallel.vertices)
+        && sameBytes(serial.indices, parallel.indices)
+        && sameBytes(serial.matIndx, parallel.matIndx);
+    printf("  output     %s\n", same ? "identical" : "DIFFERENT");
+
+    for (aiMesh* mesh : meshes)
+        delete mesh;
+    return same ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+//////////////////////////////////////////////////////////////////////
+// GPU timestamp profiler (see gpu_profiler.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cassert>
+
+#include "gpu_profiler.h"
+#include "vkapp.h"
+
+void GpuProfiler::init(VkApp* _VK, uint32_t framesInFlight, uint32_t maxZones)
+{
+    VK = _VK;
+    m_maxZones = maxZones;
+    m_frames.resize(framesInFlight);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VK->m_physicalDevice, &properties);
+
+    uint32_t familyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(VK->m_physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(VK->m_physicalDevice, &familyCount, families.data());
+    uint32_t validBits = families[VK->m_graphicsQueueIndex].timestampValidBits;
+
+    if (validBits == 0 || properties.limits.timestampPeriod == 0) {
+        printf("GPU profiler: no timestamp support\n");
+        return; }
+
+    m_period = properties.limits.timestampPeriod;
+    m_mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    qpci.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    qpci.queryCount = 2*m_maxZones*framesInFlight;
+    VkResult result = vkCreateQueryPool(VK->m_device, &qpci, nullptr, &m_pool);
+    assert(result == VK_SUCCESS);
+}
+
+void GpuProfiler::destroy()
+{
+    if (m_pool)
+        vkDestroyQueryPool(VK->m_device, m_pool, nullptr);
+    m_pool = VK_NULL_HANDLE;
+    if (m_csv)
+        fclose(m_csv);
+    m_csv = nullptr;
+}
+
+bool GpuProfiler::openCsv(const std::string& path)
+{
+    m_csv = fopen(path.c_str(), "w");
+    if (!m_csv) {
+        printf("Could not write %s\n", path.c_str());
+        return false; }
+    fprintf(m_csv, "frame,zone,depth,ms\n");
+    return true;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd, uint32_t frameIndex)
+{
+    m_current = frameIndex;
+    m_depth = 0;
+    FrameZones& frame = m_frames[m_current];
+    assert(!frame.pending);  // collect() must come first
+    frame.zones.clear();
+    if (!enabled())
+        return;
+
+    vkCmdResetQueryPool(cmd, m_pool, 2*m_maxZones*m_current, 2*m_maxZones);
+    begin(cmd, "frame");
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer cmd)
+{
+    if (!enabled())
+        return;
+    end(cmd, 0);  // "frame"
+    m_frames[m_current].pending = true;
+}
+
+int GpuProfiler::begin(VkCommandBuffer cmd, const std::string& name)
+{
+    FrameZones& frame = m_frames[m_current];
+    if (!enabled() || frame.zones.size() >= m_maxZones)
+        return -1;
+
+    Zone zone;
+    zone.name  = nameIndex(name, m_depth);
+    zone.depth = m_depth++;
+    zone.query = 2*(m_maxZones*m_current + uint32_t(frame.zones.size()));
+    frame.zones.push_back(zone);
+
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_pool, zone.query);
+    return int(frame.zones.size()) - 1;
+}
+
+void GpuProfiler::end(VkCommandBuffer cmd, int zone)
+{
+    if (zone < 0)
+        return;
+    m_depth--;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_pool,
+                        m_frames[m_current].zones[zone].query + 1);
+}
+
+void GpuProfiler::collect(uint32_t frameIndex)
+{
+    FrameZones& frame = m_frames[frameIndex];
+    if (!frame.pending)
+        return;
+    frame.pending = false;
+
+    // The frame's fence has signaled, so its results are available;
+    // no VK_QUERY_RESULT_WAIT_BIT.
+    uint32_t count = 2*uint32_t(frame.zones.size());
+    std::vector<uint64_t> ticks(count);
+    VkResult result = vkGetQueryPoolResults(VK->m_device, m_pool, 2*m_maxZones*frameIndex, count,
+                                            count*sizeof(uint64_t), ticks.data(), sizeof(uint64_t),
+                                            VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+        return;
+
+    // Sum same named zones, then record one sample per name.
+    std::vector<float> ms(m_history.size(), -1.0f);
+    for (size_t z=0;  z<frame.zones.size();  z++) {
+        float t = float(((ticks[2*z+1] - ticks[2*z]) & m_mask) * m_period * 1e-6);
+        int n = frame.zones[z].name;
+        ms[n] = std::max(ms[n], 0.0f) + t; }
+
+    m_frameNumber++;
+    m_lastFrame.clear();
+    for (size_t n=0;  n<ms.size();  n++) {
+        if (ms[n] < 0)
+            continue;
+        History& h = m_history[n];
+        m_lastFrame.push_back({h.name, h.depth, ms[n]});
+        if ((int)h.ms.size() < kHistory)
+            h.ms.push_back(ms[n]);
+        else
+            h.ms[h.next] = ms[n];
+        h.next = (h.next + 1) % kHistory;
+        h.lastMs = ms[n];
+        if (m_csv)
+            fprintf(m_csv, "%llu,%s,%d,%.4f\n", (unsigned long long)m_frameNumber,
+                    h.name.c_str(), h.depth, ms[n]); }
+}
+
+std::vector<GpuProfiler::ZoneStats> GpuProfiler::stats() const
+{
+    std::vector<ZoneStats> result;
+    for (const History& h : m_history) {
+        if (h.ms.empty())
+            continue;
+        std::vector<float> sorted = h.ms;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](float p) { return sorted[size_t(p*(sorted.size() - 1) + 0.5f)]; };
+
+        ZoneStats s;
+        s.name   = h.name;
+        s.depth  = h.depth;
+        s.lastMs = h.lastMs;
+        for (float t : sorted)
+            s.avgMs += t;
+        s.avgMs /= sorted.size();
+        s.p50Ms = percentile(0.50f);
+        s.p95Ms = percentile(0.95f);
+        s.p99Ms = percentile(0.99f);
+        s.maxMs = sorted.back();
+        result.push_back(s); }
+    return result;
+}
+
+float GpuProfiler::lastMs(const std::string& name) const
+{
+    for (const History& h : m_history)
+        if (h.name == name)
+            return h.lastMs;
+    return 0.0f;
+}
+
+int GpuProfiler::nameIndex(const std::string& name, int depth)
+{
+    for (size_t n=0;  n<m_history.size();  n++)
+        if (m_history[n].name == name)
+            return int(n);
+    History h;
+    h.name = name;
+    h.depth = depth;
+    m_history.push_back(h);
+    return int(m_history.size()) - 1;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// GPU timestamp profiler.
+//
+// Named zones are bracketed with vkCmdWriteTimestamp pairs in a
+// frame's command buffer.  Each frame in flight has its own range of
+// queries, read back by collect() only after that frame's fence has
+// signaled, so reading never waits on the GPU.  The last kHistory
+// times of each zone name are kept for rolling averages and
+// percentiles, and each frame can also be appended to a CSV file.
+//
+// Zones nest (the depth is kept for display), and zones with the same
+// name in one frame are summed.  If the device has no timestamp
+// support, everything here is a no-op.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class VkApp;
+
+class GpuProfiler
+{
+public:
+    void init(VkApp* _VK, uint32_t framesInFlight, uint32_t maxZones=64);
+    void destroy();
+    bool enabled() const { return m_period > 0; }
+
+    // Append each collected frame to a CSV file:  frame,zone,depth,ms
+    bool openCsv(const std::string& path);
+
+    // Recording, into frame frameIndex's command buffer.  beginFrame
+    // resets its queries and opens the outermost zone, "frame".
+    void beginFrame(VkCommandBuffer cmd, uint32_t frameIndex);
+    void endFrame(VkCommandBuffer cmd);
+    int  begin(VkCommandBuffer cmd, const std::string& name);  // Returns a zone for end()
+    void end(VkCommandBuffer cmd, int zone);
+
+    // Read frame frameIndex's timestamps.  Call once its fence has
+    // signaled and before its next beginFrame.
+    void collect(uint32_t frameIndex);
+
+    struct ZoneStats
+    {
+        std::string name;
+        int   depth{0};
+        float lastMs{0}, avgMs{0}, p50Ms{0}, p95Ms{0}, p99Ms{0}, maxMs{0};
+    };
+    std::vector<ZoneStats> stats() const;  // In order of first appearance
+    float lastMs(const std::string& name) const;
+
+    // Every zone of the most recently collected frame, and the number
+    // of frames collected so far (for sampling each frame exactly once).
+    struct ZoneTime
+    {
+        std::string name;
+        int   depth;
+        float ms;
+    };
+    const std::vector<ZoneTime>& lastFrame() const { return m_lastFrame; }
+    uint64_t frameNumber() const { return m_frameNumber; }
+
+private:
+    static const int kHistory = 256;
+
+    struct Zone
+    {
+        int name;           // Index into m_history
+        int depth;
+        uint32_t query;     // Begin timestamp;  the end is query+1
+    };
+    struct FrameZones
+    {
+        std::vector<Zone> zones;
+        bool pending{false};
+    };
+    struct History
+    {
+        std::string name;
+        int depth{0};
+        std::vector<float> ms;  // Ring of up to kHistory samples
+        int next{0};
+        float lastMs{0};
+    };
+
+    VkApp*      VK{nullptr};
+    VkQueryPool m_pool{};
+    float       m_period{0};   // ns per tick;  0 if timestamps are unsupported
+    uint64_t    m_mask{~0ull}; // Valid timestamp bits
+    uint32_t    m_maxZones{0};
+
+    std::vector<FrameZones> m_frames;
+    uint32_t m_current{0};     // Frame being recorded
+    int      m_depth{0};
+    std::vector<History> m_history;
+    uint64_t m_frameNumber{0};
+    std::vector<ZoneTime> m_lastFrame;
+    FILE*    m_csv{nullptr};
+
+    int nameIndex(const std::string& name, int depth);
+};
+
+// Brackets the rest of a C++ scope as a profiler zone.
+struct GpuZone
+{
+    GpuZone(GpuProfiler& profiler, VkCommandBuffer cmd, const std::string& name)
+        : P(profiler), cmd(cmd), zone(profiler.begin(cmd, name)) {}
+    ~GpuZone() { P.end(cmd, zone); }
+
+    GpuProfiler&    P;
+    VkCommandBuffer cmd;
+    int             zone;
+};
@@ -0,0 +1,167 @@
+//////////////////////////////////////////////////////////////////////
+// PFM files and image comparison (see image_io.h).
+//
+// PFM is a short text header ("PF", width height, scale) followed by
+// the raw floats, bottom row first.  A negative scale means little
+// endian, the only byte order written or read here.
+//
+// PNGs are written uncompressed (stored deflate blocks), which keeps
+// this free of a zlib dependency at the cost of file size.
+////////////////////////////////////////////////////////////////////////
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#include "image_io.h"
+
+bool writePfm(const std::string& path, const FloatImage& image)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        printf("Could not write %s\n", path.c_str());
+        return false; }
+
+    fprintf(f, "PF\n%d %d\n-1.0\n", image.width, image.height);
+    for (int y=image.height-1;  y>=0;  y--)
+        fwrite(&image.rgb[size_t(y)*image.width*3], sizeof(float), size_t(image.width)*3, f);
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+bool readPfm(const std::string& path, FloatImage& image)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        printf("Could not read %s\n", path.c_str());
+        return false; }
+
+    char magic[3] = {};
+    float scale = 0;
+    if (fscanf(f, "%2s %d %d %f", magic, &image.width, &image.height, &scale) != 4
+        || std::string(magic) != "PF" || scale >= 0
+        || image.width <= 0 || image.height <= 0) {
+        printf("%s: not a little endian RGB PFM file\n", path.c_str());
+        fclose(f);
+        return false; }
+    fgetc(f);  // The single whitespace character ending the header
+
+    image.rgb.resize(size_t(image.width)*image.height*3);
+    bool ok = true;
+    for (int y=image.height-1;  y>=0 && ok;  y--)
+        ok = fread(&image.rgb[size_t(y)*image.width*3], sizeof(float), size_t(image.width)*3, f)
+            == size_t(image.width)*3;
+    fclose(f);
+    if (!ok)
+        printf("%s: file is truncated\n", path.c_str());
+    return ok;
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc=0)
+{
+    static uint32_t table[256];
+    if (!table[1])
+        for (uint32_t n=0;  n<256;  n++) {
+            uint32_t c = n;
+            for (int k=0;  k<8;  k++)
+                c = c&1 ? 0xedb88320u ^ (c>>1) : c>>1;
+            table[n] = c; }
+
+    crc = ~crc;
+    for (size_t i=0;  i<size;  i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc>>8);
+    return ~crc;
+}
+
+static void putBE32(std::vector<uint8_t>& out, uint32_t v)
+{
+    out.insert(out.end(), {uint8_t(v>>24), uint8_t(v>>16), uint8_t(v>>8), uint8_t(v)});
+}
+
+// A chunk:  length, type, data, and a CRC over type and data.
+static void writeChunk(FILE* f, const char* type, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> chunk;
+    putBE32(chunk, (uint32_t)data.size());
+    chunk.insert(chunk.end(), type, type+4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBE32(chunk, crc32(chunk.data()+4, chunk.size()-4));
+    fwrite(chunk.data(), 1, chunk.size(), f);
+}
+
+bool writePng(const std::string& path, const FloatImage& image)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        printf("Could not write %s\n", path.c_str());
+        return false; }
+
+    // Each row is a filter type byte (0, none) and the RGB bytes.
+    size_t rowSize = 1 + size_t(image.width)*3;
+    std::vector<uint8_t> raw(rowSize*image.height);
+    for (int y=0;  y<image.height;  y++) {
+        uint8_t* row = &raw[y*rowSize];
+        row[0] = 0;
+        for (size_t i=0;  i<size_t(image.width)*3;  i++) {
+            float v = std::min(1.0f, std::max(0.0f, image.rgb[size_t(y)*image.width*3 + i]));
+            row[1+i] = uint8_t(v*255.0f + 0.5f); } }
+
+    // A zlib stream of stored blocks, then the Adler-32 of raw.
+    std::vector<uint8_t> idat = {0x78, 0x01};
+    for (size_t pos=0;  pos<raw.size() || pos==0; ) {
+        size_t n = std::min<size_t>(raw.size()-pos, 65535);
+        bool last = pos+n == raw.size();
+        idat.insert(idat.end(), {uint8_t(last), uint8_t(n), uint8_t(n>>8),
+                                 uint8_t(~n), uint8_t(~n>>8)});
+        idat.insert(idat.end(), raw.begin()+pos, raw.begin()+pos+n);
+        pos += n;
+        if (last)
+            break; }
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521; }
+    putBE32(idat, (b<<16) | a);
+
+    std::vector<uint8_t> ihdr;
+    putBE32(ihdr, image.width);
+    putBE32(ihdr, image.height);
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});  // 8 bit RGB, no interlace
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, f);
+    writeChunk(f, "IHDR", ihdr);
+    writeChunk(f, "IDAT", idat);
+    writeChunk(f, "IEND", {});
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+bool writeImage(const std::string& path, const FloatImage& image)
+{
+    std::string ext = path.size() >= 4 ? path.substr(path.size()-4) : "";
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".png" ? writePng(path, image) : writePfm(path, image);
+}
+
+ImageDiff diffImages(const FloatImage& image, const FloatImage& reference)
+{
+    ImageDiff diff;
+    double sumSq = 0, refSq = 0;
+    size_t n = std::min(image.rgb.size(), reference.rgb.size());
+    for (size_t i=0;  i<n;  i++) {
+        double d = double(image.rgb[i]) - reference.rgb[i];
+        sumSq += d*d;
+        refSq += double(reference.rgb[i])*reference.rgb[i];
+        diff.maxAbs = std::max(diff.maxAbs, std::abs(d)); }
+
+    if (n > 0) {
+        diff.rmse = std::sqrt(sumSq/n);
+        double refRms = std::sqrt(refSq/n);
+        diff.relativeRmse = refRms > 0 ? diff.rmse/refRms : diff.rmse; }
+    return diff;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Floating point image files (PFM), 8 bit PNG output, and image
+// comparison, used to save rendered frames (VkApp::saveImage) and to
+// check one render against another (imgdiff.cpp, "make imgdiff").
+////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+// An RGB image, 3 floats per pixel, top row first.
+struct FloatImage
+{
+    int width{0}, height{0};
+    std::vector<float> rgb;
+};
+
+bool writePfm(const std::string& path, const FloatImage& image);
+bool readPfm(const std::string& path, FloatImage& image);
+
+// Values are clamped to [0,1] and stored as is:  no gamma is applied.
+bool writePng(const std::string& path, const FloatImage& image);
+
+// PNG if path ends in .png, otherwise PFM.
+bool writeImage(const std::string& path, const FloatImage& image);
+
+struct ImageDiff
+{
+    double rmse{0};          // Over all channels of all pixels
+    double relativeRmse{0};  // rmse divided by the reference's RMS value
+    double maxAbs{0};        // Largest single channel difference
+};
+
+// Compare image against reference; the two must be the same size.
+ImageDiff diffImages(const FloatImage& image, const FloatImage& reference);
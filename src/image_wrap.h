@@ -1,18 +1,21 @@
 
 # pragma once
 
+#include "memory_allocator.h"
+
 struct ImageWrap
 {
     VkImage          image{};
-    VkDeviceMemory   memory{};
+    Allocation       alloc;      // Sub-allocated by VkApp::m_allocator
     VkSampler        sampler{};
     VkImageView      imageView{};
     VkImageLayout    imageLayout{};
+    VkFormat         format{};
     
     void destroy(VkDevice device)
     {
         vkDestroyImage(device, image, nullptr);
-        vkFreeMemory(device, memory, nullptr);
+        alloc.free();
         vkDestroyImageView(device, imageView, nullptr);
         vkDestroySampler(device, sampler, nullptr);
     }
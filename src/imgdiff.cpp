@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////
+// Compares two PFM images, as saved by "rtrt.exe -save file.pfm".
+//
+//   imgdiff [-t tolerance] image.pfm reference.pfm
+//
+// Prints the RMS and largest differences, and exits with status 1 if
+// the RMS difference relative to the reference exceeds the tolerance
+// (default 0.02) or the images differ in size.  "make precision-check"
+// uses it to compare the reduced precision render targets with the
+// FP32 ones (-fp32).
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "image_io.h"
+
+int main(int argc, char** argv)
+{
+    double tolerance = 0.02;
+    std::string paths[2];
+    int npaths = 0;
+
+    for (int argi=1;  argi<argc;  argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-t" && argi+1<argc)
+            tolerance = atof(argv[++argi]);
+        else if (npaths < 2 && arg[0] != '-')
+            paths[npaths++] = arg;
+        else {
+            printf("Usage: imgdiff [-t tolerance] image.pfm reference.pfm\n");
+            return 2; } }
+    if (npaths != 2) {
+        printf("Usage: imgdiff [-t tolerance] image.pfm reference.pfm\n");
+        return 2; }
+
+    FloatImage image, reference;
+    if (!readPfm(paths[0], image) || !readPfm(paths[1], reference))
+        return 2;
+    if (image.width != reference.width || image.height != reference.height) {
+        printf("Size mismatch: %dx%d vs %dx%d\n",
+               image.width, image.height, reference.width, reference.height);
+        return 1; }
+
+    ImageDiff diff = diffImages(image, reference);
+    bool pass = diff.relativeRmse <= tolerance;
+    printf("RMSE %.6f (%.4f%% of reference RMS), max difference %.6f:  %s (tolerance %.4f%%)\n",
+           diff.rmse, 100.0*diff.relativeRmse, diff.maxAbs,
+           pass ? "PASS" : "FAIL", 100.0*tolerance);
+    return pass ? 0 : 1;
+}
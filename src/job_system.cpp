@@ -0,0 +1,232 @@
+//////////////////////////////////////////////////////////////////////
+// The work-stealing job pool (see job_system.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "job_system.h"
+#include "trace.h"
+
+struct JobState
+{
+    const char* name;
+    std::function<void()> fn;
+    std::atomic<int> pending{1};        // Unfinished dependencies, +1 until submit() is done wiring
+    std::atomic<bool> finished{false};
+
+    std::mutex mutex;                   // Guards the rest
+    std::vector<JobHandle> dependents;  // Queued as this finishes
+    bool closed{false};                 // Finished:  no more dependents
+    std::exception_ptr error;           // Thrown by fn, or inherited from a dependency
+};
+
+namespace {
+thread_local int t_workerIndex = -1;    // -1 outside the pool
+}
+
+JobSystem& JobSystem::instance()
+{
+    static JobSystem* s_instance =
+        new JobSystem(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return *s_instance;
+}
+
+JobSystem::JobSystem(unsigned nbWorkers)
+{
+    nbWorkers = std::max(1u, nbWorkers);  // So submitted jobs always make progress
+    for (unsigned i=0;  i<nbWorkers;  i++)
+        m_queues.emplace_back(new Queue);
+    for (unsigned i=0;  i<nbWorkers;  i++)
+        m_workers.emplace_back(&JobSystem::workerLoop, this, int(i));
+}
+
+JobHandle JobSystem::submit(const char* name, std::function<void()> fn, const std::vector<JobHandle>& deps)
+{
+    JobHandle job = std::make_shared<JobState>();
+    job->name = name;
+    job->fn = std::move(fn);
+
+    for (const JobHandle& dep : deps) {
+        if (!dep)
+            continue;
+        std::lock_guard<std::mutex> lock(dep->mutex);
+        if (!dep->closed) {
+            job->pending++;
+            dep->dependents.push_back(job); }
+        else if (dep->error) {
+            std::lock_guard<std::mutex> jobLock(job->mutex);
+            if (!job->error)
+                job->error = dep->error; } }
+
+    if (--job->pending == 0)
+        enqueue(job);
+    return job;
+}
+
+void JobSystem::enqueue(JobHandle job)
+{
+    Queue& q = t_workerIndex >= 0 ? *m_queues[t_workerIndex] : m_shared;
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.jobs.push_back(std::move(job));
+    }
+    m_queued++;
+
+    // Taking the lock orders this with a sleeper's check of m_queued.
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_wake.notify_one();
+}
+
+// Newest of our own, else oldest shared, else steal the oldest of another worker's.
+JobHandle JobSystem::findJob()
+{
+    JobHandle job;
+    auto take = [&](Queue& q, bool newest) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.jobs.empty())
+            return false;
+        if (newest) {
+            job = std::move(q.jobs.back());
+            q.jobs.pop_back(); }
+        else {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front(); }
+        m_queued--;
+        return true; };
+
+    int self = t_workerIndex;
+    if (self >= 0 && take(*m_queues[self], true))
+        return job;
+    if (take(m_shared, false))
+        return job;
+    int n = (int)m_queues.size();
+    for (int i=1;  i<=n;  i++) {
+        int victim = (std::max(self, 0) + i) % n;
+        if (victim != self && take(*m_queues[victim], false))
+            return job; }
+    return nullptr;
+}
+
+void JobSystem::run(const JobHandle& job)
+{
+    if (!job->error) {  // Set only if a dependency failed
+        TRACE_SCOPE(job->name);
+        try {
+            job->fn(); }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->error = std::current_exception(); } }
+    job->fn = nullptr;  // Release whatever it captured
+    finish(job);
+}
+
+void JobSystem::finish(const JobHandle& job)
+{
+    std::vector<JobHandle> dependents;
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->closed = true;
+        dependents.swap(job->dependents);
+        error = job->error;
+    }
+    job->finished.store(true, std::memory_order_release);
+
+    for (JobHandle& d : dependents) {
+        if (error) {
+            std::lock_guard<std::mutex> lock(d->mutex);
+            if (!d->error)
+                d->error = error; }
+        if (--d->pending == 0)
+            enqueue(std::move(d)); }
+
+    // Anyone in wait() for this job.
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_wake.notify_all();
+}
+
+void JobSystem::workerLoop(int index)
+{
+    t_workerIndex = index;
+    if (g_traceEnabled.load(std::memory_order_relaxed))
+        traceThreadName("job worker");
+
+    for (;;) {
+        if (JobHandle job = findJob()) {
+            run(job);
+            continue; }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this]() { return m_queued.load() > 0; }); }
+}
+
+bool JobSystem::done(const JobHandle& job) const
+{
+    return !job || job->finished.load(std::memory_order_acquire);
+}
+
+int JobSystem::currentWorker()
+{
+    return t_workerIndex;
+}
+
+void JobSystem::wait(const JobHandle& job, bool help)
+{
+    if (!job)
+        return;
+    help = help || t_workerIndex >= 0;  // A worker that blocks could starve the pool
+    while (!done(job)) {
+        if (!help) {
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_wake.wait(lock, [&]() { return done(job); });
+            continue; }
+        if (JobHandle other = findJob()) {
+            run(other);
+            continue; }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [&]() { return done(job) || m_queued.load() > 0; }); }
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (job->error)
+        std::rethrow_exception(job->error);
+}
+
+void JobSystem::parallelFor(const char* name, size_t count, const std::function<void(size_t)>& fn, size_t grain)
+{
+    grain = std::max<size_t>(1, grain);
+    size_t batches = (count + grain - 1) / grain;
+    if (batches == 0)
+        return;
+
+    // Helpers and this thread pull batches off a shared counter until
+    // none are left;  a helper that starts late finds nothing to do.
+    std::atomic<size_t> next{0};
+    auto body = [&]() {
+        try {
+            for (size_t b=next++;  b<batches;  b=next++) {
+                size_t end = std::min(count, (b+1)*grain);
+                for (size_t i=b*grain;  i<end;  i++)
+                    fn(i); } }
+        catch (...) {
+            next = batches;  // Stop handing out batches
+            throw; } };
+
+    size_t nbHelpers = std::min<size_t>(m_workers.size(), batches-1);
+    std::vector<JobHandle> helpers;
+    for (size_t h=0;  h<nbHelpers;  h++)
+        helpers.push_back(submit(name, body));
+
+    std::exception_ptr error;
+    try {
+        TRACE_SCOPE(name);
+        body(); }
+    catch (...) {
+        error = std::current_exception(); }
+    for (const JobHandle& h : helpers) {
+        try {
+            wait(h); }
+        catch (...) {
+            if (!error)
+                error = std::current_exception(); } }
+    if (error)
+        std::rethrow_exception(error);
+}
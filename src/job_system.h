@@ -0,0 +1,96 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// A work-stealing thread pool, with job dependencies and parallel-for.
+//
+//     JobSystem& jobs = JobSystem::instance();
+//     JobHandle model = jobs.submit("read model", [&]() { readModel(...); });
+//     JobHandle decode = jobs.submit("decode textures", [&]() { ... }, {model});
+//     ...                       // Meanwhile, this thread does other work
+//     jobs.wait(decode);        // Rethrows anything the job (or model) threw
+//
+//     jobs.parallelFor("flatten", chunks.size(), [&](size_t c) { doChunk(chunks[c]); });
+//
+// Each worker keeps a deque of ready jobs:  it pushes and pops its
+// own at the back (newest first, cache-warm), and when that is empty
+// takes the oldest from a shared queue (where threads outside the pool
+// submit) or steals the oldest from another worker.  A job whose
+// dependencies are not all finished waits aside, and is queued by the
+// last of them to finish.  If a dependency throws, the job is skipped
+// and carries the same exception.
+//
+// wait() and parallelFor() never just block:  the calling thread runs
+// queued jobs until the one it wants is done, so jobs may wait on other
+// jobs, and the main thread lends a hand.  A thread whose own next step
+// is latency critical may wait without helping, rather than risk being
+// caught in some long job.
+//
+// Every job runs in a trace scope (see trace.h) under its name;  names
+// are not copied, so pass string literals.
+//
+// There is one pool, made on first use with a worker per core less one
+// (the main thread is the other), and deliberately never destroyed:
+// nothing is left running at exit, and a job may call exit().
+////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct JobState;
+typedef std::shared_ptr<JobState> JobHandle;
+
+class JobSystem
+{
+public:
+    static JobSystem& instance();
+
+    // Queue fn to run once every job in deps has finished.  Null
+    // handles in deps are ignored.
+    JobHandle submit(const char* name, std::function<void()> fn, const std::vector<JobHandle>& deps={});
+
+    // Until job has finished (running other jobs meanwhile, if help);
+    // then rethrows its exception, if any.  A null handle returns at
+    // once.  Only a thread outside the pool may decline to help.
+    void wait(const JobHandle& job, bool help=true);
+    bool done(const JobHandle& job) const;
+
+    // fn(i) for i in [0, count), spread over the pool and the calling
+    // thread, grain indices at a time.  Returns when all are done;
+    // rethrows the first exception thrown.
+    void parallelFor(const char* name, size_t count, const std::function<void(size_t)>& fn, size_t grain=1);
+
+    unsigned workerCount() const { return (unsigned)m_workers.size(); }
+    static int currentWorker();  // The calling thread's index in the pool;  -1 outside it
+
+private:
+    explicit JobSystem(unsigned nbWorkers);
+    ~JobSystem() = delete;  // See above
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<Queue>> m_queues;   // One per worker
+    Queue m_shared;                                 // Submitted from outside the pool
+
+    // Sleeping:  workers wait for m_queued > 0;  wait() also for its job.
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    std::atomic<int> m_queued{0};
+
+    void workerLoop(int index);
+    void enqueue(JobHandle job);
+    JobHandle findJob();
+    void run(const JobHandle& job);
+    void finish(const JobHandle& job);
+};
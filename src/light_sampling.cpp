@@ -0,0 +1,183 @@
+//////////////////////////////////////////////////////////////////////
+// Emitter choice:  the alias table and the light tree (see light_sampling.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include "light_sampling.h"
+
+static const float kPi = 3.14159265f;
+
+float emitterPower(const Emitter& emitter)
+{
+    const vec3& e = emitter.emission;
+    float luminance = 0.2126f*e.r + 0.7152f*e.g + 0.0722f*e.b;
+    float power = std::max(0.0f, luminance) * emitter.area;
+    return std::isfinite(power) ? power : 0.0f;
+}
+
+// Walker's alias table over the emitters, weighted by emitted power
+// (luminance x area), by Vose's construction:  each slot starts with
+// its emitter's probability scaled by n, and an under-full slot is
+// topped up from an over-full one, which becomes its alias.  Sampling
+// is then one uniform slot and one coin flip.  With no power at all
+// (which should not happen) the choice falls back to uniform.
+void buildAliasTable(std::vector<Emitter>& emitters)
+{
+    size_t n = emitters.size();
+    double total = 0.0;
+    std::vector<double> scaled(n);
+    for (size_t i=0;  i<n;  i++) {
+        scaled[i] = emitterPower(emitters[i]);
+        total += scaled[i]; }
+
+    std::vector<uint32_t> small, large;
+    for (size_t i=0;  i<n;  i++) {
+        double p = total > 0.0 ? scaled[i]/total : 1.0/n;
+        emitters[i].pdf = float(p);
+        scaled[i] = p*n;
+        (scaled[i] < 1.0 ? small : large).push_back(uint32_t(i)); }
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back();  small.pop_back();
+        uint32_t l = large.back();
+        emitters[s].aliasProb = float(scaled[s]);
+        emitters[s].alias = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l); } }
+
+    // What remains is full, up to rounding.
+    for (uint32_t i : small) {
+        emitters[i].aliasProb = 1.0f;
+        emitters[i].alias = i; }
+    for (uint32_t i : large) {
+        emitters[i].aliasProb = 1.0f;
+        emitters[i].alias = i; }
+}
+
+// A normal cone as an axis and a half angle.  Emitters are two-sided,
+// so a cone also holds the reflection of each normal through the apex;
+// a half angle of pi/2 holds every direction.
+struct Cone
+{
+    vec3  axis;
+    float angle;
+};
+
+// The smallest cone holding both (after Estevez and Kulla, "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting", 2018).
+static Cone mergeCones(Cone a, Cone b)
+{
+    if (dot(a.axis, b.axis) < 0.0f)
+        b.axis = -b.axis;  // The same cone, two-sided
+    if (b.angle > a.angle)
+        std::swap(a, b);
+    float between = std::acos(clamp(dot(a.axis, b.axis), -1.0f, 1.0f));
+    if (std::min(between + b.angle, kPi) <= a.angle)
+        return a;  // b is inside a
+
+    float angle = 0.5f*(a.angle + between + b.angle);
+    if (angle >= 0.5f*kPi)
+        return {a.axis, 0.5f*kPi};
+
+    // Turn a's axis toward b's by the growth in angle.
+    vec3 ortho = b.axis - a.axis*dot(a.axis, b.axis);
+    float len = length(ortho);
+    if (len < 1e-6f)
+        return {a.axis, angle};
+    float turn = angle - a.angle;
+    return {normalize(a.axis*std::cos(turn) + (ortho/len)*std::sin(turn)), angle};
+}
+
+static LightNode leafNode(const Emitter& emitter, uint32_t index)
+{
+    LightNode node{};
+    node.boundsMin = min(emitter.v0, min(emitter.v1, emitter.v2));
+    node.boundsMax = max(emitter.v0, max(emitter.v1, emitter.v2));
+    node.power = emitterPower(emitter);
+    const vec3& n = emitter.normal;
+    bool valid = std::isfinite(n.x) && std::isfinite(n.y) && std::isfinite(n.z);
+    node.axis = valid ? n : vec3(0, 0, 1);  // A degenerate triangle:  no power, any direction
+    node.cosAngle = valid ? 1.0f : 0.0f;
+    node.child = -1 - int(index);
+    return node;
+}
+
+static LightNode innerNode(const LightNode& a, const LightNode& b, int child)
+{
+    LightNode node{};
+    node.boundsMin = min(a.boundsMin, b.boundsMin);
+    node.boundsMax = max(a.boundsMax, b.boundsMax);
+    node.power = a.power + b.power;
+    Cone cone = mergeCones({a.axis, std::acos(clamp(a.cosAngle, -1.0f, 1.0f))},
+                           {b.axis, std::acos(clamp(b.cosAngle, -1.0f, 1.0f))});
+    node.axis = cone.axis;
+    node.cosAngle = std::cos(cone.angle);
+    node.child = child;
+    return node;
+}
+
+namespace {
+struct TreeBuilder
+{
+    std::vector<Emitter>& emitters;
+    std::vector<vec3> centroids;
+    std::vector<uint32_t> order;
+    std::vector<LightNode> nodes;
+
+    // Fills in nodes[node] from emitters order[begin, end);  trail holds
+    // the turns down to it, depth of them.
+    void build(int node, uint32_t begin, uint32_t end, uint32_t trail, int depth)
+    {
+        if (end - begin == 1) {
+            nodes[node] = leafNode(emitters[order[begin]], order[begin]);
+            emitters[order[begin]].treeTrail = trail;
+            return; }
+
+        vec3 lo = centroids[order[begin]], hi = lo;
+        for (uint32_t i=begin+1;  i<end;  i++) {
+            lo = min(lo, centroids[order[i]]);
+            hi = max(hi, centroids[order[i]]); }
+        vec3 extent = hi - lo;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+        uint32_t mid = begin + (end - begin)/2;
+        std::nth_element(order.begin()+begin, order.begin()+mid, order.begin()+end,
+                         [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        int child = (int)nodes.size();
+        nodes.resize(nodes.size() + 2);
+        build(child,   begin, mid, trail,                  depth+1);
+        build(child+1, mid,   end, trail | (1u << depth), depth+1);
+        nodes[node] = innerNode(nodes[child], nodes[child+1], child);
+    }
+};
+}
+
+std::vector<LightNode> buildLightTree(std::vector<Emitter>& emitters)
+{
+    if (emitters.empty())
+        return {};
+
+    TreeBuilder builder{emitters};
+    size_t n = emitters.size();
+    builder.centroids.resize(n);
+    builder.order.resize(n);
+    for (size_t i=0;  i<n;  i++) {
+        builder.centroids[i] = (emitters[i].v0 + emitters[i].v1 + emitters[i].v2) / 3.0f;
+        builder.order[i] = uint32_t(i); }
+
+    builder.nodes.reserve(2*n - 1);  // A full binary tree with n leaves
+    builder.nodes.resize(1);
+    builder.build(0, 0, uint32_t(n), 0, 0);
+    return std::move(builder.nodes);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Choosing the emitter that a shading point connects to (SampleLight
+// in raytrace.rgen), in one of three ways (see LightChoice):
+//
+//   uniform  every emitter alike
+//   power    in proportion to luminance x area, in O(1) from a Walker
+//            alias table kept in the emitter list itself
+//   tree     by estimated contribution to the shading point, down a
+//            light tree in O(log n)
+//
+// The light tree is a binary BVH over the emitters.  Each node bounds
+// the positions of the emitters below it with a box, and their normals
+// with a cone, and sums their power.  From those, LightImportance
+// bounds what the node can contribute at a point:  power over squared
+// distance, times the best emitter and receiver cosines any point in
+// the box could have.  ChooseEmitterFromTree walks down from the root,
+// taking each child with probability in proportion to its importance,
+// and the product of those probabilities is the chosen emitter's pdf.
+// (Both are in shaders/light_choice.h, which raytrace.rgen and
+// lightbench.cpp share.)  The bounds are conservative, so an emitter
+// that can light the point is never given probability 0, and the
+// choice stays unbiased.
+//
+// The tree is built top down, splitting each node's emitters at the
+// median of their centroids along the longest axis:  O(n log n), and
+// no more than log2(n)+1 levels.  Children sit side by side (child and
+// child+1), and the root is node 0.  Each emitter's treeTrail records
+// the way down to it, one bit per level, so that a BRDF sampled ray
+// that hits an emitter can find the pdf of having chosen it
+// (PdfEmitterFromTree) without a search.
+//
+// lightbench.cpp measures all three on synthetic scenes of 10 to 100k
+// emitters.  Power is the default:  there the tree's lower variance does
+// not pay for its longer walk at 100 emitters or more, and it has not
+// been measured on a GPU;  -lights tree (or the GUI) turns it on.
+////////////////////////////////////////////////////////////////////////
+
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+float emitterPower(const Emitter& emitter);  // Luminance x area
+
+// Fills in pdf, aliasProb and alias of every emitter.
+void buildAliasTable(std::vector<Emitter>& emitters);
+
+// Empty for no emitters.  Fills in treeTrail of every emitter.
+std::vector<LightNode> buildLightTree(std::vector<Emitter>& emitters);
@@ -0,0 +1,225 @@
+//////////////////////////////////////////////////////////////////////
+// Scales the three ways of choosing an emitter (see light_sampling.h)
+// from 10 to 100k emitters, on the CPU.
+//
+//   lightbench [-points P] [-samples S] [-seed N]
+//
+// Each scene scatters n small two-sided emitters of widely varying
+// power and orientation through a 10x10x10 box, from 1 to 11 above a
+// floor.  At P random points on the floor, each method takes S samples
+// of a one-sample estimate of the unshadowed direct light:
+//
+//     Le |cos at the light| |cos at the point| / d^2  /  (pdf of the emitter / its area)
+//
+// and reports, averaged over the points, the relative variance of
+// that estimate (variance / mean^2) and the time per sample.  Their
+// product is the work-normalized variance:  what matters at equal
+// time.  The means of the three agree, within noise, when every method
+// is unbiased;  the ratios of the total over all points are printed.
+//
+// The choices themselves are raytrace.rgen's own, from
+// shaders/light_choice.h.
+// "make light-bench" builds and runs it.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include "light_sampling.h"
+
+static const std::vector<Emitter>* s_emitters;
+static const std::vector<LightNode>* s_tree;
+#define EMITTER(i)     (*s_emitters)[i]
+#define EMITTER_COUNT  uint(s_emitters->size())
+#define LIGHT_NODE(i)  (*s_tree)[i]
+#include "shaders/light_choice.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Rng
+{
+    std::mt19937 engine;
+    std::uniform_real_distribution<float> uniform{0.0f, 1.0f};
+    float operator()() { return std::min(uniform(engine), 0.99999994f); }
+
+    vec3 direction()
+    {
+        float z = 2.0f*(*this)() - 1.0f, phi = 6.2831853f*(*this)();
+        float s = std::sqrt(std::max(0.0f, 1.0f - z*z));
+        return vec3(s*std::cos(phi), s*std::sin(phi), z);
+    }
+};
+
+static std::vector<Emitter> makeScene(size_t n, Rng& rng)
+{
+    std::lognormal_distribution<float> sizes(0.0f, 0.7f), brightness(0.0f, 1.5f);
+    std::vector<Emitter> emitters(n);
+    for (size_t i=0;  i<n;  i++) {
+        Emitter& e = emitters[i];
+        vec3 center(10.0f*rng(), 1.0f + 10.0f*rng(), 10.0f*rng());
+        vec3 normal = rng.direction();
+        vec3 t = normalize(cross(normal, std::abs(normal.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0)));
+        vec3 b = cross(normal, t);
+        float size = 0.05f*sizes(rng.engine);
+        e.v0 = center + size*t;
+        e.v1 = center + size*(-0.5f*t + 0.866f*b);
+        e.v2 = center + size*(-0.5f*t - 0.866f*b);
+        e.normal = normalize(cross(e.v1 - e.v0, e.v2 - e.v0));
+        e.area = 0.5f*length(cross(e.v1 - e.v0, e.v2 - e.v0));
+        e.emission = brightness(rng.engine) * vec3(0.5f + 0.5f*rng(), 0.5f + 0.5f*rng(), 0.5f + 0.5f*rng());
+        e.index = uint32_t(i); }
+    buildAliasTable(emitters);
+    return emitters;
+}
+
+static vec3 sampleTriangle(Rng& rng, const Emitter& e)
+{
+    float b1 = rng(), b2 = rng();
+    if (b1 + b2 > 1.0f) {
+        b1 = 1.0f - b1;
+        b2 = 1.0f - b2; }
+    return (1.0f - b1 - b2)*e.v0 + b1*e.v1 + b2*e.v2;
+}
+
+static EmitterChoice chooseUniform(Rng& rng, const std::vector<Emitter>& emitters, const vec3&, const vec3&)
+{
+    return {ChooseEmitterUniformly(rng()), 1.0f/emitters.size()};
+}
+
+static EmitterChoice choosePower(Rng& rng, const std::vector<Emitter>& emitters, const vec3&, const vec3&)
+{
+    float u = rng();
+    uint32_t i = ChooseEmitterByPower(vec2(u, rng()));
+    return {i, emitters[i].pdf};
+}
+
+static EmitterChoice chooseTree(Rng& rng, const std::vector<Emitter>&, const vec3& P, const vec3& N)
+{
+    return ChooseEmitterFromTree(rng(), P, N);
+}
+
+struct Result
+{
+    double relVariance{0}, nsPerSample{0};
+    std::vector<double> means;  // Per point
+};
+
+typedef EmitterChoice (*Chooser)(Rng&, const std::vector<Emitter>&, const vec3&, const vec3&);
+
+static Result measure(Chooser choose, const std::vector<Emitter>& emitters,
+                      const std::vector<vec3>& points, const std::vector<vec3>& normals,
+                      int samples, Rng& rng)
+{
+    Result result;
+    double ns = 0;
+    for (size_t p=0;  p<points.size();  p++) {
+        const vec3& P = points[p];
+        const vec3& N = normals[p];
+        double sum = 0, sum2 = 0;
+        Clock::time_point start = Clock::now();
+        for (int s=0;  s<samples;  s++) {
+            EmitterChoice c = choose(rng, emitters, P, N);
+            const Emitter& e = emitters[c.index];
+            vec3 X = sampleTriangle(rng, e);
+            vec3 D = X - P;
+            float d2 = dot(D, D);
+            float lum = 0.2126f*e.emission.r + 0.7152f*e.emission.g + 0.0722f*e.emission.b;
+            float f = lum * std::abs(dot(D, e.normal)) * std::abs(dot(D, N)) / (d2*d2);
+            float estimate = c.pdf > 0.0f ? f * e.area / c.pdf : 0.0f;
+            sum += estimate;
+            sum2 += double(estimate)*estimate; }
+        ns += 1e6*msSince(start);
+        double mean = sum/samples;
+        double variance = std::max(0.0, sum2/samples - mean*mean);
+        result.means.push_back(mean);
+        if (mean > 0.0)
+            result.relVariance += variance/(mean*mean); }
+    result.relVariance /= points.size();
+    result.nsPerSample = ns/(double(points.size())*samples);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int nbPoints = 64, samples = 4096;
+    unsigned seed = 1;
+    for (int argi=1;  argi<argc;  argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-points" && argi+1<argc)
+            nbPoints = std::max(1, atoi(argv[++argi]));
+        else if (arg == "-samples" && argi+1<argc)
+            samples = std::max(2, atoi(argv[++argi]));
+        else if (arg == "-seed" && argi+1<argc)
+            seed = unsigned(atoi(argv[++argi]));
+        else {
+            printf("Usage: lightbench [-points P] [-samples S] [-seed N]\n");
+            return 2; } }
+
+    printf("%d shading points x %d samples per method;  relVar is variance/mean^2,\n"
+           "work the relative variance x ns per sample (lower is better)\n\n", nbPoints, samples);
+    printf("%8s %9s %9s %6s %5s | %-21s | %-21s | %-21s | %8s %15s\n", "emitters", "alias ms", "tree ms",
+           "nodes", "depth", "uniform relVar    ns", "power relVar      ns", "tree relVar       ns",
+           "tree/pow", "mean/power's");
+    printf("%8s %9s %9s %6s %5s | %-21s | %-21s | %-21s | %8s %15s\n", "", "", "", "", "",
+           "", "", "", "work", "uniform   tree");
+
+    for (size_t n : {size_t(10), size_t(100), size_t(1000), size_t(10000), size_t(100000)}) {
+        Rng rng{std::mt19937(seed)};
+
+        Clock::time_point start = Clock::now();
+        std::vector<Emitter> emitters = makeScene(n, rng);
+        s_emitters = &emitters;
+        double aliasMs = msSince(start);  // Scene generation included;  it is small beside the table
+        start = Clock::now();
+        std::vector<LightNode> tree = buildLightTree(emitters);
+        double treeMs = msSince(start);
+        s_tree = &tree;
+
+        int depth = 0;
+        std::vector<int> level(tree.size(), 0);
+        for (size_t i=0;  i<tree.size();  i++)
+            if (tree[i].child >= 0)
+                level[tree[i].child] = level[tree[i].child + 1] = level[i] + 1;
+        for (int l : level)
+            depth = std::max(depth, l + 1);
+
+        std::vector<vec3> points, normals;
+        for (int p=0;  p<nbPoints;  p++) {
+            points.push_back(vec3(10.0f*rng(), 0.0f, 10.0f*rng()));
+            normals.push_back(vec3(0, 1, 0)); }
+
+        Result uniform = measure(chooseUniform, emitters, points, normals, samples, rng);
+        Result power   = measure(choosePower,   emitters, points, normals, samples, rng);
+        Result treeRes = measure(chooseTree,    emitters, points, normals, samples, rng);
+
+        double total[3] = {0, 0, 0};
+        for (int p=0;  p<nbPoints;  p++) {
+            total[0] += uniform.means[p];
+            total[1] += power.means[p];
+            total[2] += treeRes.means[p]; }
+
+        printf("%8zu %9.2f %9.2f %6zu %5d | %10.3g %8.1f | %10.3g %8.1f | %10.3g %8.1f | %8.3f %7.3f %7.3f\n",
+               n, aliasMs, treeMs, tree.size(), depth,
+               uniform.relVariance, uniform.nsPerSample, power.relVariance, power.nsPerSample,
+               treeRes.relVariance, treeRes.nsPerSample,
+               (treeRes.relVariance*treeRes.nsPerSample) / (power.relVariance*power.nsPerSample),
+               total[0]/total[1], total[2]/total[1]);
+        fflush(stdout); }
+    return 0;
+}
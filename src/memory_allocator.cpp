@@ -0,0 +1,349 @@
+//////////////////////////////////////////////////////////////////////
+// Block based device memory sub-allocation (see memory_allocator.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+
+#include "memory_allocator.h"
+
+static const VkDeviceSize defaultBlockSize = VkDeviceSize(64) << 20;
+
+static VkDeviceSize nextPow2(VkDeviceSize v)
+{
+    VkDeviceSize p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
+void Allocation::free()
+{
+    if (owner)
+        owner->free(*this);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Buddy allocation within a block.
+
+void MemoryBlock::initBuddy()
+{
+    int orders = 0;
+    while ((minSize << orders) < size) orders++;
+    freeLists.resize(orders+1);
+    freeLists[orders].insert(0);
+}
+
+bool MemoryBlock::allocBuddy(VkDeviceSize size, VkDeviceSize alignment,
+                             VkDeviceSize& offset, VkDeviceSize& rounded)
+{
+    // A buddy range is aligned to its own size, so rounding up to the
+    // alignment also satisfies it.
+    rounded = nextPow2(std::max({size, alignment, minSize}));
+    size_t order = 0;
+    while ((minSize << order) < rounded) order++;
+    if (order >= freeLists.size())
+        return false;
+
+    size_t o = order;
+    while (o < freeLists.size() && freeLists[o].empty()) o++;
+    if (o == freeLists.size())
+        return false;
+
+    offset = *freeLists[o].begin();
+    freeLists[o].erase(freeLists[o].begin());
+
+    // Split down to the requested order, freeing the upper halves.
+    while (o > order) {
+        o--;
+        freeLists[o].insert(offset + (minSize << o)); }
+
+    used += rounded;
+    liveCount++;
+    return true;
+}
+
+void MemoryBlock::freeBuddy(VkDeviceSize offset, VkDeviceSize rounded)
+{
+    size_t order = 0;
+    while ((minSize << order) < rounded) order++;
+
+    // Merge with the buddy for as long as it is free too.
+    while (order+1 < freeLists.size()) {
+        VkDeviceSize buddy = offset ^ (minSize << order);
+        if (freeLists[order].erase(buddy) == 0)
+            break;
+        offset = std::min(offset, buddy);
+        order++; }
+    freeLists[order].insert(offset);
+
+    used -= rounded;
+    liveCount--;
+}
+
+VkDeviceSize MemoryBlock::largestFree() const
+{
+    if (linear)
+        return size - top;
+    for (size_t o=freeLists.size();  o-- > 0; )
+        if (!freeLists[o].empty())
+            return minSize << o;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Linear allocation within a block.
+
+bool MemoryBlock::allocLinear(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+    VkDeviceSize start = (top + alignment - 1) / alignment * alignment;
+    if (start + size > this->size)
+        return false;
+    offset = start;
+    top = start + size;
+    used += size;
+    liveCount++;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, bool hasMemoryBudget)
+{
+    m_physicalDevice = physicalDevice;
+    m_device = device;
+    m_hasMemoryBudget = hasMemoryBudget;
+    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_memProperties);
+
+    // Blocks are at most 1/8 of their heap, so a small heap (such as a
+    // 256MB host visible BAR) is not swallowed by a couple of blocks.
+    for (uint32_t h=0;  h<m_memProperties.memoryHeapCount;  h++) {
+        VkDeviceSize size = defaultBlockSize;
+        while (size > (VkDeviceSize(1) << 20) && size > m_memProperties.memoryHeaps[h].size/8)
+            size >>= 1;
+        m_blockSize[h] = size; }
+}
+
+void MemoryAllocator::destroy()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_allocationCount > 0)
+        printf("MemoryAllocator: %u allocations still live at shutdown\n", m_allocationCount);
+
+    for (Pool& pool : m_pools)
+        for (auto& block : pool.blocks)
+            freeDeviceMemory(block->memory, block->mapped != nullptr);
+    m_pools.clear();
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+    for (uint32_t i = 0; i < m_memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i))
+            && (m_memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i; } }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool MemoryAllocator::allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, bool deviceAddress,
+                                           VkDeviceMemory& memory, void*& mapped)
+{
+    VkMemoryAllocateFlagsInfo memFlags = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, nullptr,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
+
+    VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocInfo.pNext = deviceAddress ? &memFlags : nullptr;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        return false;
+
+    mapped = nullptr;
+    if (m_memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VkResult result = vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        assert(result == VK_SUCCESS); }
+
+    m_deviceMemoryCount++;
+    return true;
+}
+
+void MemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, bool mapped)
+{
+    if (mapped)
+        vkUnmapMemory(m_device, memory);
+    vkFreeMemory(m_device, memory, nullptr);
+    m_deviceMemoryCount--;
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements,
+                                     VkMemoryPropertyFlags properties, MemoryUsage usage)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Allocation result;
+    result.owner = this;
+
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+    result.memoryType = memoryType;
+    uint32_t heap = m_memProperties.memoryTypes[memoryType].heapIndex;
+    VkDeviceSize blockSize = m_blockSize[heap];
+    bool isBuffer = usage != eMemImage && usage != eMemDedicated;
+
+    // Dedicated: its own VkDeviceMemory.
+    if (usage == eMemDedicated || requirements.size > blockSize/2) {
+        void* mapped;
+        if (!allocateDeviceMemory(memoryType, requirements.size, true, result.memory, mapped))
+            throw std::runtime_error("failed to allocate device memory!");
+        result.size = requirements.size;
+        result.mapped = mapped;
+        m_dedicatedCount++;
+        m_dedicatedBytes[heap] += requirements.size;
+        m_allocationCount++;
+        return result; }
+
+    // Find (or make) the pool for this memory type and usage.  Buffers
+    // and images never share a pool.
+    Pool* pool = nullptr;
+    for (Pool& p : m_pools)
+        if (p.memoryType == memoryType && p.usage == usage)
+            pool = &p;
+    if (!pool) {
+        m_pools.push_back({memoryType, usage, {}});
+        pool = &m_pools.back(); }
+
+    bool linear = usage == eMemStaging;
+    auto tryBlock = [&](MemoryBlock* block) {
+        VkDeviceSize offset, size = requirements.size;
+        bool ok = linear ? block->allocLinear(requirements.size, requirements.alignment, offset)
+                         : block->allocBuddy(requirements.size, requirements.alignment, offset, size);
+        if (!ok)
+            return false;
+        result.memory = block->memory;
+        result.offset = offset;
+        result.size = size;
+        result.mapped = block->mapped ? block->mapped + offset : nullptr;
+        result.block = block;
+        return true; };
+
+    for (auto& block : pool->blocks)
+        if (tryBlock(block.get())) {
+            m_allocationCount++;
+            return result; }
+
+    // No room:  a new block.
+    auto block = std::make_unique<MemoryBlock>();
+    void* mapped;
+    if (!allocateDeviceMemory(memoryType, blockSize, isBuffer, block->memory, mapped))
+        throw std::runtime_error("failed to allocate device memory!");
+    block->size = blockSize;
+    block->mapped = (uint8_t*)mapped;
+    block->memoryType = memoryType;
+    block->linear = linear;
+    if (!linear)
+        block->initBuddy();
+    pool->blocks.push_back(std::move(block));
+
+    bool ok = tryBlock(pool->blocks.back().get());
+    assert(ok);
+    m_allocationCount++;
+    return result;
+}
+
+void MemoryAllocator::free(Allocation& allocation)
+{
+    if (!allocation.memory)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_allocationCount--;
+
+    MemoryBlock* block = allocation.block;
+    if (!block) {
+        uint32_t heap = m_memProperties.memoryTypes[allocation.memoryType].heapIndex;
+        m_dedicatedBytes[heap] -= allocation.size;
+        m_dedicatedCount--;
+        freeDeviceMemory(allocation.memory, allocation.mapped != nullptr);
+        allocation = Allocation();
+        return; }
+
+    if (block->linear) {
+        block->used -= allocation.size;
+        if (--block->liveCount == 0)
+            block->top = 0; }  // Everything in it is free:  rewind
+    else
+        block->freeBuddy(allocation.offset, allocation.size);
+
+    // Release an empty block, as long as its pool keeps another one.
+    if (block->liveCount == 0)
+        for (Pool& pool : m_pools) {
+            auto it = std::find_if(pool.blocks.begin(), pool.blocks.end(),
+                                   [block](auto& b) { return b.get() == block; });
+            if (it == pool.blocks.end())
+                continue;
+            bool otherEmpty = std::any_of(pool.blocks.begin(), pool.blocks.end(),
+                                          [block](auto& b) { return b.get() != block && b->liveCount == 0; });
+            if (otherEmpty) {
+                freeDeviceMemory(block->memory, block->mapped != nullptr);
+                pool.blocks.erase(it); }
+            break; }
+
+    allocation = Allocation();
+}
+
+MemoryStats MemoryAllocator::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    MemoryStats s;
+    s.deviceMemoryCount = m_deviceMemoryCount;
+    s.dedicatedCount = m_dedicatedCount;
+    s.allocationCount = m_allocationCount;
+    s.heaps.resize(m_memProperties.memoryHeapCount);
+    for (uint32_t h=0;  h<m_memProperties.memoryHeapCount;  h++) {
+        s.heaps[h].heapSize = m_memProperties.memoryHeaps[h].size;
+        s.heaps[h].deviceLocal = m_memProperties.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        s.heaps[h].reserved = m_dedicatedBytes[h];
+        s.heaps[h].used = m_dedicatedBytes[h]; }
+
+    VkDeviceSize totalFree = 0, largest = 0;
+    for (Pool& pool : m_pools)
+        for (auto& block : pool.blocks) {
+            uint32_t h = m_memProperties.memoryTypes[block->memoryType].heapIndex;
+            s.heaps[h].reserved += block->size;
+            s.heaps[h].used += block->used;
+            if (!block->linear) {
+                totalFree += block->size - block->used;
+                largest = std::max(largest, block->largestFree()); } }
+    s.fragmentation = totalFree ? 1.0f - float(largest)/float(totalFree) : 0.0f;
+
+    if (m_hasMemoryBudget) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+        VkPhysicalDeviceMemoryProperties2 props2{
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2, &budget};
+        vkGetPhysicalDeviceMemoryProperties2(m_physicalDevice, &props2);
+        for (uint32_t h=0;  h<m_memProperties.memoryHeapCount;  h++) {
+            s.heaps[h].budget = budget.heapBudget[h];
+            s.heaps[h].usage = budget.heapUsage[h]; } }
+
+    return s;
+}
+
+void MemoryAllocator::printStats()
+{
+    MemoryStats s = stats();
+    printf("Memory: %u vkAllocateMemory (%u dedicated), %u allocations, %.1f%% fragmentation\n",
+           s.deviceMemoryCount, s.dedicatedCount, s.allocationCount, 100.0f*s.fragmentation);
+    for (size_t h=0;  h<s.heaps.size();  h++) {
+        const MemoryHeapStats& hs = s.heaps[h];
+        printf("  heap %zu%s: %.1f/%.1f MB used/reserved of %.0f MB",
+               h, hs.deviceLocal ? " (device local)" : "",
+               hs.used/1048576.0, hs.reserved/1048576.0, hs.heapSize/1048576.0);
+        if (m_hasMemoryBudget)
+            printf(";  process usage %.1f MB of %.1f MB budget", hs.usage/1048576.0, hs.budget/1048576.0);
+        printf("\n"); }
+}
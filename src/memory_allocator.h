@@ -0,0 +1,135 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// A sub-allocating device memory allocator used by createBufferWrap
+// and createImageWrap, so that buffers and images share a few large
+// VkDeviceMemory blocks instead of each making its own
+// vkAllocateMemory call.
+//
+// Pools are kept per memory type, with buffers and images in separate
+// pools (so bufferImageGranularity never matters).  Three strategies:
+//   Long lived buffers/images: buddy allocation in 64MB blocks.
+//   Staging buffers:  linear (bump pointer) allocation; a block is
+//                     rewound once everything in it has been freed.
+//   Dedicated:        render targets and anything bigger than a block
+//                     get a VkDeviceMemory of their own.
+// Host visible blocks are mapped once, for their whole lifetime.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class MemoryAllocator;
+struct MemoryBlock;
+
+// A piece of device memory handed out by MemoryAllocator.  Bind with
+// (memory, offset); free() returns it to its allocator.
+struct Allocation
+{
+    VkDeviceMemory   memory{};
+    VkDeviceSize     offset{0};
+    VkDeviceSize     size{0};
+    void*            mapped{nullptr};   // Host address of offset, if host visible
+    MemoryAllocator* owner{nullptr};
+    MemoryBlock*     block{nullptr};    // nullptr for a dedicated allocation
+    uint32_t         memoryType{0};
+
+    void free();
+};
+
+enum MemoryUsage
+{
+    eMemBuffer,      // Long lived buffer:  buddy sub-allocation
+    eMemStaging,     // Short lived upload buffer:  linear sub-allocation
+    eMemImage,       // Long lived image:  buddy sub-allocation
+    eMemDedicated,   // Its own VkDeviceMemory (render targets)
+};
+
+// Per heap numbers for display.
+struct MemoryHeapStats
+{
+    VkDeviceSize heapSize{0};
+    VkDeviceSize reserved{0};    // Sum of this allocator's VkDeviceMemory on the heap
+    VkDeviceSize used{0};        // Of that, handed out to resources
+    VkDeviceSize budget{0};      // VK_EXT_memory_budget: whole process budget and usage
+    VkDeviceSize usage{0};       //    (0 if the extension is not available)
+    bool         deviceLocal{false};
+};
+
+struct MemoryStats
+{
+    uint32_t deviceMemoryCount{0};   // Live vkAllocateMemory allocations
+    uint32_t dedicatedCount{0};      //    of which are dedicated
+    uint32_t allocationCount{0};     // Live sub-allocations
+    float    fragmentation{0};       // 1 - largest free range / total free, over buddy blocks
+    std::vector<MemoryHeapStats> heaps;
+};
+
+class MemoryAllocator
+{
+public:
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, bool hasMemoryBudget);
+    void destroy();
+
+    Allocation allocate(const VkMemoryRequirements& requirements,
+                        VkMemoryPropertyFlags properties, MemoryUsage usage);
+    void free(Allocation& allocation);
+
+    MemoryStats stats();
+    void printStats();
+
+private:
+    struct Pool
+    {
+        uint32_t memoryType;
+        MemoryUsage usage;
+        std::vector<std::unique_ptr<MemoryBlock>> blocks;
+    };
+
+    VkPhysicalDevice m_physicalDevice{};
+    VkDevice         m_device{};
+    bool             m_hasMemoryBudget{false};
+    VkPhysicalDeviceMemoryProperties m_memProperties{};
+    VkDeviceSize     m_blockSize[VK_MAX_MEMORY_HEAPS]{};
+
+    std::mutex m_mutex;
+    std::vector<Pool> m_pools;
+    uint32_t m_deviceMemoryCount{0};
+    uint32_t m_dedicatedCount{0};
+    uint32_t m_allocationCount{0};
+    VkDeviceSize m_dedicatedBytes[VK_MAX_MEMORY_HEAPS]{};
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    bool allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, bool deviceAddress,
+                              VkDeviceMemory& memory, void*& mapped);
+    void freeDeviceMemory(VkDeviceMemory memory, bool mapped);
+};
+
+// A VkDeviceMemory block that sub-allocations are carved from.
+struct MemoryBlock
+{
+    VkDeviceMemory memory{};
+    VkDeviceSize   size{0};
+    uint8_t*       mapped{nullptr};
+    uint32_t       memoryType{0};
+    bool           linear{false};
+    VkDeviceSize   used{0};
+    uint32_t       liveCount{0};
+
+    // Linear blocks:  bump pointer
+    VkDeviceSize   top{0};
+
+    // Buddy blocks:  free offsets per order; order k holds ranges of minSize<<k bytes.
+    static const VkDeviceSize minSize = 256;
+    std::vector<std::set<VkDeviceSize>> freeLists;
+
+    void initBuddy();
+    bool allocBuddy(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& rounded);
+    void freeBuddy(VkDeviceSize offset, VkDeviceSize rounded);
+    bool allocLinear(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    VkDeviceSize largestFree() const;
+};
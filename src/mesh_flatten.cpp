@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////
+// Flattening assimp meshes into ModelData;  see mesh_flatten.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "mesh_flatten.h"
+#include "job_system.h"
+#include "trace.h"
+
+// Writes the meshes found by recurseModelNodes into meshdata.  Each
+// mesh copies the vertex/normal/texture data with its node's model
+// transformation applied, and records its faces as triangle indices.
+// Work is split into chunks of vertices and of faces so that a single
+// huge mesh still spreads across all cores.  Every output element has
+// a fixed position and is computed exactly as a serial walk would, so
+// the result does not depend on the number of threads.
+void flattenMeshInstances(ModelData* meshdata,
+                          const std::vector<MeshInstance>& instances,
+                          size_t nbVertices, size_t nbTriangles)
+{
+    TRACE_FUNCTION();
+    meshdata->vertices.resize(nbVertices);
+    meshdata->indices.resize(3*nbTriangles);
+    meshdata->matIndx.resize(nbTriangles);
+
+    // A chunk of work: a range of vertices, or a range of faces, of one mesh instance.
+    struct Chunk { size_t instance;  bool faces;  unsigned int begin, end; };
+    const unsigned int chunkSize = 1<<16;
+    
+    std::vector<Chunk> chunks;
+    for (size_t k=0;  k<instances.size();  k++) {
+        const aiMesh* aimesh = instances[k].aimesh;
+        for (unsigned int b=0;  b<aimesh->mNumVertices;  b+=chunkSize)
+            chunks.push_back({k, false, b, std::min(b+chunkSize, aimesh->mNumVertices)});
+        
+        // A face's output position is only known from those before it,
+        // so faces are split only when the mesh is all triangles.
+        if (aimesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+            for (unsigned int b=0;  b<aimesh->mNumFaces;  b+=chunkSize)
+                chunks.push_back({k, true, b, std::min(b+chunkSize, aimesh->mNumFaces)}); }
+        else if (aimesh->mNumFaces > 0)
+            chunks.push_back({k, true, 0, aimesh->mNumFaces}); }
+
+    auto doChunk = [&](const Chunk& chunk) {
+        const MeshInstance& inst = instances[chunk.instance];
+        const aiMesh* aimesh = inst.aimesh;
+
+        if (!chunk.faces) {
+            const aiMatrix4x4& childTr = inst.transform;
+            aiMatrix3x3 normalTr = aiMatrix3x3(childTr); // Really should be inverse-transpose for full generality
+            Vertex* out = &meshdata->vertices[inst.vertexOffset];
+            for (unsigned int t=chunk.begin;  t<chunk.end;  ++t) {
+                aiVector3D aipnt = childTr*aimesh->mVertices[t];
+                aiVector3D ainrm = aimesh->HasNormals() ? normalTr*aimesh->mNormals[t] : aiVector3D(0,0,1);
+                aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
+
+                out[t] = {{aipnt.x, aipnt.y, aipnt.z},
+                          {ainrm.x, ainrm.y, ainrm.z},
+                          {aitex.x, aitex.y}}; }
+            return; }
+
+        // Loop through the faces, recording indices.  For an all
+        // triangle mesh face t is triangle t; otherwise the chunk is
+        // the whole mesh and the triangle count just runs on.
+        uint faceOffset = inst.vertexOffset;
+        size_t tri = inst.triangleOffset + chunk.begin;
+        for (unsigned int t=chunk.begin;  t<chunk.end;  ++t) {
+            const aiFace* aiface = &aimesh->mFaces[t];
+            for (int i=2;  i<aiface->mNumIndices;  i++, tri++) {
+                meshdata->matIndx[tri] = aimesh->mMaterialIndex;
+                meshdata->indices[3*tri+0] = aiface->mIndices[0]+faceOffset;
+                meshdata->indices[3*tri+1] = aiface->mIndices[i-1]+faceOffset;
+                meshdata->indices[3*tri+2] = aiface->mIndices[i]+faceOffset; } } };
+
+    JobSystem::instance().parallelFor("flatten", chunks.size(),
+                                      [&](size_t c) { doChunk(chunks[c]); });
+}
+
+// The reference:  the meshes, one after another, appended in turn.
+void flattenMeshInstancesSerial(ModelData* meshdata,
+                                const std::vector<MeshInstance>& instances)
+{
+    TRACE_FUNCTION();
+    for (const MeshInstance& inst : instances) {
+        const aiMesh* aimesh = inst.aimesh;
+        const aiMatrix4x4& childTr = inst.transform;
+        aiMatrix3x3 normalTr = aiMatrix3x3(childTr);
+        
+        uint faceOffset = meshdata->vertices.size();
+        for (unsigned int t=0;  t<aimesh->mNumVertices;  ++t) {
+            aiVector3D aipnt = childTr*aimesh->mVertices[t];
+            aiVector3D ainrm = aimesh->HasNormals() ? normalTr*aimesh->mNormals[t] : aiVector3D(0,0,1);
+            aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
+
+            meshdata->vertices.push_back({{aipnt.x, aipnt.y, aipnt.z},
+                                          {ainrm.x, ainrm.y, ainrm.z},
+                                          {aitex.x, aitex.y}}); }
+        
+        for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t) {
+            const aiFace* aiface = &aimesh->mFaces[t];
+            for (int i=2;  i<aiface->mNumIndices;  i++) {
+                meshdata->matIndx.push_back(aimesh->mMaterialIndex);
+                meshdata->indices.push_back(aiface->mIndices[0]+faceOffset);
+                meshdata->indices.push_back(aiface->mIndices[i-1]+faceOffset);
+                meshdata->indices.push_back(aiface->mIndices[i]+faceOffset); } } }
+}
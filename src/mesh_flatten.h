@@ -0,0 +1,40 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// The second pass of flattening an assimp model into ModelData (the
+// first, recurseModelNodes in vkapp_loadModel.cpp, walks the node
+// tree).  Each (node, mesh) pair arrives as a MeshInstance that knows
+// where its output lands, so the meshes' vertices and faces are
+// written in parallel, in chunks, straight into presized arrays.
+//
+// flattenMeshInstancesSerial is the plain push_back walk this replaced,
+// kept as the reference the parallel path must match byte for byte:
+// flattenbench.cpp runs both on a synthetic multi-million triangle
+// model, checks that, and times them.
+////////////////////////////////////////////////////////////////////////
+
+#include <vector>
+
+#include <assimp/scene.h>
+
+#include "scene_cache.h"
+
+// One (node, mesh) pair of the flattened model: the mesh, its
+// accumulated transformation, and where its output goes in ModelData.
+struct MeshInstance
+{
+    const aiMesh* aimesh;
+    aiMatrix4x4   transform;
+    size_t        vertexOffset;     // Into ModelData::vertices
+    size_t        triangleOffset;   // Into ModelData::matIndx (and 3x into ModelData::indices)
+};
+
+// Fills meshdata from instances, which must be in output order and
+// account for exactly nbVertices and nbTriangles past whatever meshdata
+// already holds.
+void flattenMeshInstances(ModelData* meshdata,
+                          const std::vector<MeshInstance>& instances,
+                          size_t nbVertices, size_t nbTriangles);
+
+void flattenMeshInstancesSerial(ModelData* meshdata,
+                                const std::vector<MeshInstance>& instances);
@@ -0,0 +1,196 @@
+//////////////////////////////////////////////////////////////////////
+// Compares ways of combining explicit light samples with BRDF samples
+// that hit an emitter (see MisWeight in raytrace.rgen), on the CPU,
+// for living_room's materials.
+//
+//   misbench [-samples S] [-seed N]
+//
+// A point on a surface, seen from 30 degrees off its normal, is lit by
+// one square emitter, 3 away in the mirror direction:  the highlight,
+// where glossy materials are hardest.  Each sample takes one point on
+// the emitter, as SampleLight does, and one BRDF direction, as
+// SampleBrdf does, and combines them, as the path tracer's first
+// bounce does.  Methods:
+//
+//   old        0.5 each;  BRDF directions by cosine only
+//   half       0.5 each;  BRDF directions from the diffuse or glossy lobe
+//   mis cos    power heuristic;  BRDF directions by cosine only
+//   mis        power heuristic;  BRDF directions from either lobe (the new one)
+//
+// It reports each one's relative variance (variance / mean^2), and its
+// ratio to the old one's:  the samples, and so the time, each needs
+// for a given error, relative to the old.  The means of the four
+// agree, within noise, when every method is unbiased.  The BRDF, its
+// sampling and the power heuristic are the shader's own (brdf.h and
+// path.h), compiled as C++.  "make mis-bench" builds and runs it.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include "shaders/shared_structs.h"
+#include "shaders/brdf.h"
+#include "shaders/path.h"
+
+struct Mat
+{
+    const char* name;
+    float kd, ks, shininess;  // Grey:  living_room's are, near enough
+
+    Material material() const { return {vec3(kd), vec3(ks), vec3(0.0f), shininess, -1}; }
+};
+
+// One grey channel of EvalBrdf, and a BRDF direction with its pdf:
+// either BrdfDirection and PdfBrdf, or, for the old methods, cosine
+// sampling alone.
+static float Brdf(vec3 N, vec3 Wi, vec3 Wo, const Material& mat)
+{
+    return EvalBrdf(N, Wi, Wo, mat).x;
+}
+
+static vec3 SampleBrdf(float lobe, vec2 u, vec3 N, vec3 Wo, const Material& mat, bool glossy)
+{
+    return glossy ? BrdfDirection(lobe, u, N, Wo, mat) : SampleLobe(N, std::sqrt(u.x), pi2*u.y);
+}
+
+static float PdfBrdf(vec3 N, vec3 Wi, vec3 Wo, const Material& mat, bool glossy)
+{
+    return glossy ? PdfBrdf(N, Wi, Wo, mat) : std::max(dot(N, Wi), 0.0f) / pi;
+}
+
+static float Weight(float pdf, float otherPdf, bool mis)
+{
+    return mis ? PowerHeuristic(pdf, otherPdf) : 0.5f;
+}
+
+////////////////////////////////////////////////////////////////////////
+
+struct Light
+{
+    vec3 center, normal, s, t;  // Its axes s and t, each half its side
+    float area;
+
+    // Where the ray from P along D meets it, if it does.
+    bool hit(vec3 P, vec3 D, vec3& X) const
+    {
+        float dn = dot(D, normal);
+        if (std::abs(dn) < 1e-8f)
+            return false;
+        float dist = dot(center - P, normal) / dn;
+        if (dist <= 0.0f)
+            return false;
+        X = P + dist*D;
+        vec3 r = X - center;
+        return std::abs(dot(r, s)) <= dot(s, s) && std::abs(dot(r, t)) <= dot(t, t);
+    }
+};
+
+static float PdfLightSolidAngle(const Light& light, vec3 P, vec3 X)
+{
+    vec3 D = X - P;
+    float d2 = dot(D, D);
+    return (1.0f/light.area) * d2 / std::max(std::abs(dot(light.normal, D)) / std::sqrt(d2), 1e-8f);
+}
+
+struct Method { const char* name; bool mis, glossy; };
+
+int main(int argc, char** argv)
+{
+    int samples = 1 << 20;
+    unsigned seed = 1;
+    for (int argi=1;  argi<argc;  argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-samples" && argi+1<argc)
+            samples = std::max(2, atoi(argv[++argi]));
+        else if (arg == "-seed" && argi+1<argc)
+            seed = unsigned(atoi(argv[++argi]));
+        else {
+            printf("Usage: misbench [-samples S] [-seed N]\n");
+            return 2; } }
+
+    // living_room's materials:  an Ns 256 one (which all have Ks 0), and the glossy ones.
+    const Mat mats[] = {
+        {"Carpet (Ns 256)",     0.80f, 0.00f, 256.0f},
+        {"SofaLeather",         0.90f, 0.20f, 10.0f},
+        {"TableGlossy",         0.99f, 0.10f, 2048.0f},
+        {"Picture",             1.00f, 0.20f, 8000.0f},
+    };
+    const Method methods[] = {
+        {"old",     false, false},
+        {"half",    false, true},
+        {"mis cos", true,  false},
+        {"mis",     true,  true},
+    };
+    const float sizes[] = {0.1f, 1.0f, 4.0f};  // The emitter's side
+
+    vec3 N(0, 0, 1);
+    vec3 Wo = normalize(vec3(std::sin(0.5236f), 0.0f, std::cos(0.5236f)));
+    vec3 R = 2.0f*dot(Wo, N)*N - Wo;
+
+    printf("%d samples per method;  relative variance, and its ratio to old's\n\n", samples);
+    printf("  %-16s %5s", "material", "light");
+    for (const Method& m : methods)
+        printf(" | %-17s", m.name);
+    printf(" | %s\n", "mean/old's");
+
+    for (const Mat& grey : mats) {
+        Material mat = grey.material();
+        for (float size : sizes) {
+            Light light;
+            light.center = 3.0f*R;
+            light.normal = -R;
+            light.s = 0.5f*size*normalize(cross(R, vec3(0, 1, 0)));
+            light.t = 0.5f*size*normalize(cross(R, light.s));
+            light.area = size*size;
+
+            printf("  %-16s %5.1f", grey.name, size);
+            double oldVar = 0, oldMean = 0, means[4];
+            for (int mi=0;  mi<4;  mi++) {
+                const Method& method = methods[mi];
+                std::mt19937 engine(seed);
+                std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+                auto rnd = [&]() { return std::min(uniform(engine), 0.99999994f); };
+
+                double sum = 0, sum2 = 0;
+                for (int k=0;  k<samples;  k++) {
+                    double estimate = 0;
+
+                    // The light sample
+                    vec3 X = light.center + (2.0f*rnd() - 1.0f)*light.s + (2.0f*rnd() - 1.0f)*light.t;
+                    vec3 Wi = normalize(X);
+                    float pl = PdfLightSolidAngle(light, vec3(0), X);
+                    if (dot(N, Wi) > 0.0f && pl > 0.0f) {
+                        float w = Weight(pl, PdfBrdf(N, Wi, Wo, mat, method.glossy), method.mis);
+                        estimate += w * dot(N, Wi) * Brdf(N, Wi, Wo, mat) / pl; }
+
+                    // The BRDF sample, if it hits the emitter
+                    float lobe = rnd(), u = rnd(), v = rnd();
+                    Wi = SampleBrdf(lobe, vec2(u, v), N, Wo, mat, method.glossy);
+                    float pb = PdfBrdf(N, Wi, Wo, mat, method.glossy);
+                    if (dot(N, Wi) > 0.0f && pb >= 1e-6f && light.hit(vec3(0), Wi, X)) {
+                        float w = Weight(pb, PdfLightSolidAngle(light, vec3(0), X), method.mis);
+                        estimate += w * dot(N, Wi) * Brdf(N, Wi, Wo, mat) / pb; }
+
+                    sum += estimate;
+                    sum2 += estimate*estimate; }
+
+                double mean = sum/samples;
+                double relVar = std::max(0.0, sum2/samples - mean*mean) / (mean*mean);
+                means[mi] = mean;
+                if (mi == 0) {
+                    oldVar = relVar;
+                    oldMean = mean; }
+                printf(" | %8.3g %7.2fx", relVar, relVar/oldVar); }
+            printf(" | %.3f %.3f %.3f\n", means[1]/oldMean, means[2]/oldMean, means[3]/oldMean);
+            fflush(stdout); } }
+    return 0;
+}
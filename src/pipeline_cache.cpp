@@ -0,0 +1,145 @@
+//////////////////////////////////////////////////////////////////////
+// A VkPipelineCache kept on disk between runs (see pipeline_cache.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+namespace fs = std::filesystem;
+
+#include "pipeline_cache.h"
+#include "vkapp.h"
+
+void PipelineCache::init(VkApp* _VK, const std::string& path)
+{
+    VK = _VK;
+    m_path = path;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VK->m_physicalDevice, &properties);
+    memcpy(m_expected.magic, "RTPC", 4);
+    m_expected.version       = kVersion;
+    m_expected.vendorID      = properties.vendorID;
+    m_expected.deviceID      = properties.deviceID;
+    m_expected.driverVersion = properties.driverVersion;
+    memcpy(m_expected.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    // Read the file, keeping its data only if everything matches.
+    std::vector<uint8_t> data;
+    const char* rejected = "no file";
+    if (FILE* f = fopen(path.c_str(), "rb")) {
+        FileHeader header;
+        if (fread(&header, sizeof(header), 1, f) != 1
+            || memcmp(header.magic, m_expected.magic, 4) != 0 || header.version != kVersion)
+            rejected = "not a pipeline cache file";
+        else if (header.vendorID != m_expected.vendorID || header.deviceID != m_expected.deviceID
+                 || memcmp(header.uuid, m_expected.uuid, VK_UUID_SIZE) != 0)
+            rejected = "written by a different device";
+        else if (header.driverVersion != m_expected.driverVersion)
+            rejected = "written by a different driver version";
+        else {
+            // The file is exactly what destroy() wrote, header then data;
+            // check the size before allocating anything by it.
+            std::error_code ec;
+            uint64_t remaining = fs::file_size(path, ec) - sizeof(header);
+            if (ec || header.dataSize == 0 || header.dataSize < remaining)
+                rejected = "bad size";
+            else if (header.dataSize > remaining)
+                rejected = "truncated";
+            else {
+                data.resize(header.dataSize);
+                if (fread(data.data(), 1, data.size(), f) != data.size()) {
+                    data.clear();
+                    rejected = "truncated"; } } }
+        fclose(f); }
+
+    // The driver's own header:  length, version one, vendor, device, UUID.
+    if (!data.empty()) {
+        VkPipelineCacheHeaderVersionOne vk{};
+        if (data.size() >= sizeof(vk))
+            memcpy(&vk, data.data(), sizeof(vk));
+        if (vk.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+            || vk.vendorID != m_expected.vendorID || vk.deviceID != m_expected.deviceID
+            || memcmp(vk.pipelineCacheUUID, m_expected.uuid, VK_UUID_SIZE) != 0) {
+            data.clear();
+            rejected = "driver header does not match"; } }
+
+    if (data.empty())
+        printf("Pipeline cache %s:  %s;  starting empty\n", path.c_str(), rejected);
+    else
+        printf("Pipeline cache %s:  %zu bytes loaded\n", path.c_str(), data.size());
+
+    VkPipelineCacheCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData    = data.empty() ? nullptr : data.data();
+    VkResult result = vkCreatePipelineCache(VK->m_device, &createInfo, nullptr, &m_cache);
+    assert(result == VK_SUCCESS);
+}
+
+void PipelineCache::destroy()
+{
+    printf("Pipeline cache:  %u hits, %u misses, %.1f ms creating pipelines (summed over threads)\n",
+           m_hits, m_misses, m_createMs);
+
+    size_t size = 0;
+    vkGetPipelineCacheData(VK->m_device, m_cache, &size, nullptr);
+    std::vector<uint8_t> data(size);
+    VkResult result = vkGetPipelineCacheData(VK->m_device, m_cache, &size, data.data());
+    vkDestroyPipelineCache(VK->m_device, m_cache, nullptr);
+    if (result != VK_SUCCESS || size == 0)
+        return;
+
+    // Write a temporary file and rename it, so an interrupted write
+    // never leaves a truncated cache behind.
+    std::string temp = m_path + ".tmp";
+    FileHeader header = m_expected;
+    header.dataSize = size;
+    FILE* f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        printf("Could not write %s\n", temp.c_str());
+        return; }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(data.data(), 1, size, f) == size;
+    ok = fclose(f) == 0 && ok;
+    std::error_code ec;
+    if (ok)
+        fs::rename(temp, m_path, ec);
+    if (!ok || ec) {
+        printf("Could not write %s\n", m_path.c_str());
+        fs::remove(temp, ec); }
+}
+
+PipelineCache::Feedback::Feedback(PipelineCache& cache, const char* name)
+    : m_owner(cache), m_name(name)
+{
+    m_info.pPipelineCreationFeedback = &m_feedback;
+    m_info.pipelineStageCreationFeedbackCount = 0;  // Whole pipelines only
+    m_start = std::chrono::steady_clock::now();
+}
+
+const void* PipelineCache::Feedback::chain(const void* next)
+{
+    m_info.pNext = next;
+    return &m_info;
+}
+
+void PipelineCache::Feedback::report()
+{
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+
+    std::lock_guard<std::mutex> lock(m_owner.m_mutex);
+    m_owner.m_createMs += wallMs;
+
+    if (!(m_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT)) {
+        printf("Pipeline %s:  %.2f ms (no creation feedback)\n", m_name, wallMs);
+        return; }
+
+    bool hit = m_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT;
+    if (hit)
+        m_owner.m_hits++;
+    else
+        m_owner.m_misses++;
+    printf("Pipeline %s:  cache %s, %.2f ms\n", m_name, hit ? "hit" : "miss", m_feedback.duration*1e-6);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// A VkPipelineCache kept on disk between runs.
+//
+// init() seeds the cache from the file, if the file was written by
+// the same device (vendor, device ID and pipelineCacheUUID) and the
+// same driver version;  anything else starts an empty cache.  The
+// driver's own header at the start of the data is checked too.
+// destroy() writes the cache back.
+//
+// Pipelines are created with m_cache and a Feedback's creation
+// feedback structure on their pNext chain;  Feedback::report() then
+// prints whether the pipeline came from the cache and how long it
+// took, and adds to the totals printed at shutdown.
+//
+// Pipelines may be created on several threads at once:  the Vulkan
+// cache is internally synchronized, each creation has its own
+// Feedback, and the totals are guarded by a mutex.  init() may run on
+// any thread (at startup, a job system worker does it), once the
+// device exists and before any pipeline is created with m_cache;
+// destroy() likewise, once every creation has finished.  Neither may
+// overlap the other, or a creation.
+////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+class VkApp;
+
+class PipelineCache
+{
+public:
+    void init(VkApp* _VK, const std::string& path);
+    void destroy();
+
+    VkPipelineCache m_cache{};
+
+    // One pipeline creation, from construction to report().
+    class Feedback
+    {
+    public:
+        Feedback(PipelineCache& cache, const char* name);
+        Feedback(const Feedback&) = delete;
+        Feedback& operator=(const Feedback&) = delete;
+
+        // For the create info's pNext;  next is its existing pNext.
+        const void* chain(const void* next=nullptr);
+        void report();
+
+    private:
+        PipelineCache& m_owner;
+        const char* m_name;
+        VkPipelineCreationFeedback m_feedback{};
+        VkPipelineCreationFeedbackCreateInfo m_info{VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO};
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    // For reporting;  guarded by m_mutex
+    uint32_t m_hits{0}, m_misses{0};
+    double   m_createMs{0};
+
+private:
+    // Ours, ahead of the driver's data:  the driver version is not in
+    // the Vulkan cache header.
+    struct FileHeader
+    {
+        char     magic[4];     // "RTPC"
+        uint32_t version;      // kVersion
+        uint32_t vendorID, deviceID, driverVersion;
+        uint8_t  uuid[VK_UUID_SIZE];
+        uint64_t dataSize;     // Bytes of cache data following
+    };
+    static const uint32_t kVersion = 1;
+
+    VkApp* VK{nullptr};
+    std::string m_path;
+    FileHeader  m_expected{};
+    std::mutex  m_mutex;
+};
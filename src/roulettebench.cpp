@@ -0,0 +1,180 @@
+//////////////////////////////////////////////////////////////////////
+// Compares ways of ending paths (see RussianRoulette in shaders/path.h,
+// as raytrace.rgen's path loop uses it) on a model of that loop, on the
+// CPU.
+//
+//   roulettebench [-pixels P] [-frames F] [-seed N]
+//
+// A path's every segment hits an emitter (radiance 1) with probability
+// pLight, ending it, or else a diffuse surface whose RGB albedo is drawn
+// per hit;  cosine sampling makes the BRDF's f/p that albedo.  The
+// expected radiance is then known exactly:
+//
+//     pLight / (1 - (1-pLight) x mean albedo)       per channel
+//
+// so the bias of each method is measured too.  Methods:
+//
+//   frame depth   the old one:  a depth drawn per frame (1, then +1
+//                 with probability rr=0.7, at most 4), shared by every
+//                 pixel, and each bounce divided by rr
+//   fixed N       N segments always, no roulette
+//   rr min/max    per path:  after min segments, go on with probability
+//                 the throughput's largest component, up to max
+//
+// Each traces F frames of P pixels, one path per pixel per frame, and
+// reports the bias, the variance of a pixel (relative, variance /
+// mean^2), the variance of a frame's average over all its pixels
+// (flicker that accumulation has to average away), and segments per
+// path, which is rays traced and so the time on the GPU.  Work is
+// pixel variance x segments, relative to the old method's:  lower is
+// better at equal time.  "make roulette-bench" builds and runs it.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include "shaders/shared_structs.h"
+#include "shaders/path.h"
+
+struct Rng
+{
+    std::mt19937 engine;
+    std::uniform_real_distribution<double> uniform{0.0, 1.0};
+    double operator()() { return uniform(engine); }
+};
+
+struct Scene
+{
+    const char* name;
+    double pLight;
+    double albedoLo, albedoHi;  // Each channel's albedo, per hit, uniform in this range
+    double exact() const { return pLight / (1.0 - (1.0 - pLight)*0.5*(albedoLo + albedoHi)); }
+};
+
+struct Method
+{
+    const char* name;
+    int minDepth, maxDepth;     // minDepth 0 for the old frame depth
+};
+
+struct Result
+{
+    double mean{0}, pixelRelVar{0}, frameRelVar{0}, segments{0};
+};
+
+static const double s_rr = 0.7;
+
+static int frameDepth(Rng& rng)
+{
+    int depth = 1;
+    while (rng() < s_rr)
+        depth++;
+    return std::min(depth, 4);
+}
+
+// One path;  returns its radiance (the channels' average) and counts
+// its segments.
+static double tracePath(Rng& rng, const Scene& scene, const Method& method, int depth, long& segments)
+{
+    vec3 W(1.0f);
+    for (int i=0;  i<depth;  i++) {
+        segments++;
+        if (rng() < scene.pLight)
+            return (W.x + W.y + W.z) / 3.0;
+
+        for (int c=0;  c<3;  c++)
+            W[c] *= float(scene.albedoLo + (scene.albedoHi - scene.albedoLo)*rng());
+        if (method.minDepth == 0) {
+            W /= float(s_rr);
+            continue; }
+
+        if (i+1 >= method.minDepth && !RussianRoulette(W, float(rng())))
+            break; }
+    return 0.0;
+}
+
+static Result measure(const Scene& scene, const Method& method, int pixels, int frames, Rng& rng)
+{
+    double sum = 0, sum2 = 0, frameSum = 0, frameSum2 = 0;
+    long segments = 0;
+    for (int f=0;  f<frames;  f++) {
+        int depth = method.minDepth == 0 ? frameDepth(rng) : method.maxDepth;
+        double frame = 0;
+        for (int p=0;  p<pixels;  p++) {
+            double L = tracePath(rng, scene, method, depth, segments);
+            sum += L;
+            sum2 += L*L;
+            frame += L; }
+        frame /= pixels;
+        frameSum += frame;
+        frameSum2 += frame*frame; }
+
+    Result result;
+    double n = double(pixels)*frames;
+    result.mean = sum/n;
+    double mean2 = result.mean*result.mean;
+    result.pixelRelVar = std::max(0.0, sum2/n - mean2) / mean2;
+    result.frameRelVar = std::max(0.0, frameSum2/frames - mean2) / mean2;
+    result.segments = segments/n;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int pixels = 4096, frames = 256;
+    unsigned seed = 1;
+    for (int argi=1;  argi<argc;  argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-pixels" && argi+1<argc)
+            pixels = std::max(1, atoi(argv[++argi]));
+        else if (arg == "-frames" && argi+1<argc)
+            frames = std::max(2, atoi(argv[++argi]));
+        else if (arg == "-seed" && argi+1<argc)
+            seed = unsigned(atoi(argv[++argi]));
+        else {
+            printf("Usage: roulettebench [-pixels P] [-frames F] [-seed N]\n");
+            return 2; } }
+
+    const Scene scenes[] = {
+        {"dark",   0.05, 0.05, 0.50},
+        {"medium", 0.10, 0.20, 0.80},
+        {"bright", 0.02, 0.60, 0.95},
+    };
+    const Method methods[] = {
+        {"frame depth",  0, 4},
+        {"fixed 4",      4, 4},
+        {"fixed 16",    16, 16},
+        {"rr 1/16",      1, 16},
+        {"rr 2/16",      2, 16},
+        {"rr 3/16",      3, 16},
+        {"rr 5/16",      5, 16},
+    };
+
+    printf("%d frames of %d pixels per method;  relative variances (variance / mean^2)\n",
+           frames, pixels);
+    for (const Scene& scene : scenes) {
+        printf("\n%s scene:  pLight %.2f, albedo %.2f-%.2f, exact radiance %.4f\n",
+               scene.name, scene.pLight, scene.albedoLo, scene.albedoHi, scene.exact());
+        printf("  %-12s %8s %10s %12s %9s %7s\n", "", "bias", "pixel var", "frame var", "segments", "work");
+        double baseWork = 0;
+        for (const Method& method : methods) {
+            Rng rng{std::mt19937(seed)};
+            Result r = measure(scene, method, pixels, frames, rng);
+            double work = r.pixelRelVar * r.segments;
+            if (baseWork == 0)
+                baseWork = work;
+            printf("  %-12s %+7.2f%% %10.3f %12.3g %9.2f %7.2f\n", method.name,
+                   100.0*(r.mean/scene.exact() - 1.0), r.pixelRelVar, r.frameRelVar, r.segments,
+                   work/baseWork);
+            fflush(stdout); } }
+    return 0;
+}
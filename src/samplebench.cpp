@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////
+// Compares the path tracer's two samplers (see sampler.glsl) on the
+// CPU, by how fast a pixel's running average converges.
+//
+//   samplebench [-pixels P] [-frames F] [-seed N]
+//
+// Each of P pixels takes one sample per frame, for F frames, of three
+// integrands over the unit cube, shaped like what the path tracer's
+// sample values feed:
+//
+//   choice    1D:  a step per eighth of [0, 1), as choosing one of
+//             eight emitters of unequal contribution
+//   shadow    2D:  a smooth function cut by a diagonal edge, as a point
+//             on a partly occluded emitter
+//   bounce    4D:  a cosine lobe's 2D sample times the shadow's, as a
+//             bounce and then a light connection (padded dimensions)
+//
+// It reports each one's relative RMSE over the pixels after 1, 4, 16,
+// ... frames, and how many frames sobol needs to reach the error random
+// has after F:  the frames to a given error in the benchmark harness.
+// The samplers are sampler.glsl's own code, compiled as C++.  "make
+// sample-bench" builds and runs it.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include "shaders/shared_structs.h"
+#include "shaders/rng.glsl"
+#include "shaders/sampler.glsl"
+
+static const double s_steps[8] = {0.2, 1.7, 0.1, 0.9, 3.1, 0.4, 0.0, 1.6};
+
+static double choice(Sampler& s)
+{
+    return s_steps[std::min(7, int(8.0f*Sample1D(s)))];
+}
+
+static double shadowAt(double u, double v)
+{
+    return u + 0.6*v > 0.7 ? 0.5 + u*v : 0.0;
+}
+
+static double shadow(Sampler& s)
+{
+    vec2 u = Sample2D(s);
+    return shadowAt(u.x, u.y);
+}
+
+static double bounce(Sampler& s)
+{
+    vec2 u = Sample2D(s);
+    double lobe = 2.0*u.x * (1.0 + std::cos(6.2831853*u.y));  // Mean 1
+    return lobe * shadow(s);
+}
+
+int main(int argc, char** argv)
+{
+    int nbPixels = 1024, frames = 1024;
+    unsigned seed = 1;
+    for (int argi=1;  argi<argc;  argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-pixels" && argi+1<argc)
+            nbPixels = std::max(1, atoi(argv[++argi]));
+        else if (arg == "-frames" && argi+1<argc)
+            frames = std::max(1, atoi(argv[++argi]));
+        else if (arg == "-seed" && argi+1<argc)
+            seed = unsigned(atoi(argv[++argi]));
+        else {
+            printf("Usage: samplebench [-pixels P] [-frames F] [-seed N]\n");
+            return 2; } }
+
+    // Exact values:  the step's mean, and the shadow's by a fine midpoint grid.
+    double choiceExact = 0, shadowExact = 0;
+    for (double step : s_steps)
+        choiceExact += step/8;
+    const int grid = 4096;
+    for (int i=0;  i<grid;  i++)
+        for (int j=0;  j<grid;  j++)
+            shadowExact += shadowAt((i + 0.5)/grid, (j + 0.5)/grid);
+    shadowExact /= double(grid)*grid;
+
+    struct Integrand { const char* name; double (*fn)(Sampler&); double exact; };
+    const Integrand integrands[] = {
+        {"choice", choice, choiceExact},
+        {"shadow", shadow, shadowExact},
+        {"bounce", bounce, shadowExact},
+    };
+
+    printf("%d pixels x %d frames;  relative RMSE of the pixels' averages after N frames\n\n",
+           nbPixels, frames);
+    printf("  %-8s %-7s", "", "");
+    for (int n=1;  n<=frames;  n*=4)
+        printf(" %9d", n);
+    printf("   frames to random's error at %d\n", frames);
+
+    for (const Integrand& integrand : integrands) {
+        std::vector<double> errors[2];  // Per frame count, random then sobol
+        for (int method=0;  method<2;  method++) {
+            std::mt19937 rng(seed);
+            uint sequenceSeed = rng();
+            std::vector<double> sums(nbPixels, 0.0);
+            for (int f=0;  f<frames;  f++) {
+                uint frameSeed = rng();
+                double sq = 0;
+                for (int p=0;  p<nbPixels;  p++) {
+                    Sampler s = SamplerStart(uint(p), uint(f), sequenceSeed, frameSeed, method == 1);
+                    sums[p] += integrand.fn(s);
+                    double e = sums[p]/(f + 1) - integrand.exact;
+                    sq += e*e; }
+                errors[method].push_back(std::sqrt(sq/nbPixels) / integrand.exact); } }
+
+        for (int method=0;  method<2;  method++) {
+            printf("  %-8s %-7s", method == 0 ? integrand.name : "", method == 0 ? "random" : "sobol");
+            for (int n=1;  n<=frames;  n*=4)
+                printf(" %9.2e", errors[method][n-1]);
+            if (method == 1) {
+                double target = errors[0].back();
+                int n = 0;
+                while (n < frames && errors[1][n] > target)
+                    n++;
+                if (n < frames)
+                    printf("   %d (%.1fx fewer)", n+1, double(frames)/(n+1));
+                else
+                    printf("   more than %d", frames); }
+            printf("\n"); } }
+    return 0;
+}
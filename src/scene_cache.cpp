@@ -0,0 +1,212 @@
+//////////////////////////////////////////////////////////////////////
+// Reading and writing the binary scene cache (see scene_cache.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "scene_cache.h"
+
+static const char sceneCacheMagic[8] = {'R','T','S','C','E','N','E','\0'};
+
+// A cheap 64 bit hash; processes 8 bytes per step so that hashing a
+// large OBJ file costs little compared to parsing it.
+static uint64_t hashBytes(const void* data, size_t size, uint64_t h)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint64_t prime = 0x100000001b3ull;
+
+    while (size >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * prime;
+        h ^= h >> 29;
+        p += 8;
+        size -= 8; }
+
+    while (size > 0) {
+        h = (h ^ *p++) * prime;
+        size--; }
+
+    return h;
+}
+
+static bool hashFile(const std::string& path, uint64_t& h)
+{
+    FileView file(path);
+    if (!file.isOpen())
+        return false;
+    h = hashBytes(file.data(), file.size(), h);
+    return true;
+}
+
+uint64_t SceneCache::sourceKey(const std::string& path, uint32_t importFlags,
+                               const std::string& variant)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    uint32_t version = SCENE_CACHE_VERSION;
+    h = hashBytes(&version, sizeof(version), h);
+    h = hashBytes(&importFlags, sizeof(importFlags), h);
+    h = hashBytes(variant.data(), variant.size(), h);
+    hashFile(path, h);
+
+    // An OBJ file's materials live in separate .mtl files; a change there must
+    // invalidate the cache too.
+    if (fs::path(path).extension() == ".obj") {
+        std::ifstream stream(path);
+        std::string line;
+        while (std::getline(stream, line)) {
+            if (line.compare(0, 7, "mtllib ") != 0)
+                continue;
+            std::istringstream names(line.substr(7));
+            std::string name;
+            while (names >> name) {
+                fs::path mtlPath = path;
+                mtlPath.replace_filename(name);
+                h = hashBytes(name.data(), name.size(), h);
+                hashFile(mtlPath.string(), h); } } }
+
+    return h;
+}
+
+bool SceneCache::open(const std::string& path, uint64_t key)
+{
+    close();
+
+    if (!m_file.open(path))
+        return false;
+    m_base = m_file.data();
+    m_size = m_file.size();
+
+    // Validate the header before trusting any offsets in it.
+    header = (const SceneCacheHeader*)m_base;
+    auto inFile = [&](uint64_t offset, uint64_t count, size_t elemSize) {
+        return offset % 16 == 0 && offset <= m_size && count <= (m_size-offset)/elemSize; };
+
+    bool valid = m_size >= sizeof(SceneCacheHeader)
+        && memcmp(header->magic, sceneCacheMagic, sizeof(sceneCacheMagic)) == 0
+        && header->version == SCENE_CACHE_VERSION
+        && header->headerSize == sizeof(SceneCacheHeader)
+        && header->structSizes[0] == sizeof(Vertex)
+        && header->structSizes[1] == sizeof(Material)
+        && header->structSizes[2] == sizeof(Emitter)
+        && header->structSizes[3] == sizeof(uint32_t)
+        && header->key == key
+        && header->fileSize == m_size
+        && inFile(header->vertexOffset,   header->vertexCount,   sizeof(Vertex))
+        && inFile(header->indexOffset,    header->indexCount,    sizeof(uint32_t))
+        && inFile(header->materialOffset, header->materialCount, sizeof(Material))
+        && inFile(header->matIndxOffset,  header->matIndxCount,  sizeof(int32_t))
+        && inFile(header->emitterOffset,  header->emitterCount,  sizeof(Emitter))
+        && inFile(header->textureOffset,  0, 1);
+
+    if (!valid) {
+        close();
+        return false; }
+
+    vertices  = (const Vertex*)  (m_base + header->vertexOffset);
+    indices   = (const uint32_t*)(m_base + header->indexOffset);
+    materials = (const Material*)(m_base + header->materialOffset);
+    matIndx   = (const int32_t*) (m_base + header->matIndxOffset);
+    emitters  = (const Emitter*) (m_base + header->emitterOffset);
+
+    // Texture paths: a packed list of '\0' terminated strings.
+    const char* p   = (const char*)(m_base + header->textureOffset);
+    const char* end = (const char*)(m_base + m_size);
+    for (uint64_t i=0;  i<header->textureCount;  i++) {
+        const char* e = (const char*)memchr(p, '\0', end-p);
+        if (!e) {
+            close();
+            return false; }
+        textures.emplace_back(p, e);
+        p = e+1; }
+
+    return true;
+}
+
+void SceneCache::close()
+{
+    m_file.close();
+    m_base = nullptr;
+    m_size = 0;
+    header = nullptr;
+    vertices = nullptr;
+    indices = nullptr;
+    materials = nullptr;
+    matIndx = nullptr;
+    emitters = nullptr;
+    textures.clear();
+}
+
+bool SceneCache::write(const std::string& path, uint64_t key, double importMs,
+                       const ModelData& meshdata, const std::vector<Emitter>& emitters)
+{
+    SceneCacheHeader h{};
+    memcpy(h.magic, sceneCacheMagic, sizeof(sceneCacheMagic));
+    h.version = SCENE_CACHE_VERSION;
+    h.headerSize = sizeof(SceneCacheHeader);
+    h.structSizes[0] = sizeof(Vertex);
+    h.structSizes[1] = sizeof(Material);
+    h.structSizes[2] = sizeof(Emitter);
+    h.structSizes[3] = sizeof(uint32_t);
+    h.key = key;
+    h.importMs = importMs;
+
+    std::string textureBlob;
+    for (const std::string& t : meshdata.textures) {
+        textureBlob += t;
+        textureBlob += '\0'; }
+
+    // Lay out the arrays, each starting on a 16 byte boundary.
+    uint64_t offset = sizeof(SceneCacheHeader);
+    auto place = [&offset](uint64_t& arrayOffset, uint64_t& arrayCount,
+                           uint64_t count, size_t elemSize) {
+        offset = (offset + 15) & ~uint64_t(15);
+        arrayOffset = offset;
+        arrayCount = count;
+        offset += count*elemSize; };
+
+    place(h.vertexOffset,   h.vertexCount,   meshdata.vertices.size(),  sizeof(Vertex));
+    place(h.indexOffset,    h.indexCount,    meshdata.indices.size(),   sizeof(uint32_t));
+    place(h.materialOffset, h.materialCount, meshdata.materials.size(), sizeof(Material));
+    place(h.matIndxOffset,  h.matIndxCount,  meshdata.matIndx.size(),   sizeof(int32_t));
+    place(h.emitterOffset,  h.emitterCount,  emitters.size(),           sizeof(Emitter));
+    place(h.textureOffset,  h.textureCount,  textureBlob.size(),        1);
+    h.textureCount = meshdata.textures.size();
+    h.fileSize = offset;
+
+    // Write to a temporary name and rename, so a crash mid-write
+    // never leaves a truncated cache behind.
+    std::string tmpPath = path + ".tmp";
+    std::ofstream stream(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+        return false;
+
+    auto writeAt = [&stream](uint64_t offset, const void* data, size_t size) {
+        static const char zeros[16] = {};
+        uint64_t pos = stream.tellp();
+        stream.write(zeros, offset-pos);  // Alignment padding
+        stream.write((const char*)data, size); };
+
+    stream.write((const char*)&h, sizeof(h));
+    writeAt(h.vertexOffset,   meshdata.vertices.data(),  meshdata.vertices.size()*sizeof(Vertex));
+    writeAt(h.indexOffset,    meshdata.indices.data(),   meshdata.indices.size()*sizeof(uint32_t));
+    writeAt(h.materialOffset, meshdata.materials.data(), meshdata.materials.size()*sizeof(Material));
+    writeAt(h.matIndxOffset,  meshdata.matIndx.data(),   meshdata.matIndx.size()*sizeof(int32_t));
+    writeAt(h.emitterOffset,  emitters.data(),           emitters.size()*sizeof(Emitter));
+    writeAt(h.textureOffset,  textureBlob.data(),        textureBlob.size());
+    stream.close();
+
+    if (!stream) {
+        fs::remove(tmpPath);
+        return false; }
+
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    return !ec;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// A binary cache of a model after it has been read by assimp and
+// flattened by recurseModelNodes.  The file is a fixed header
+// followed by 16-byte aligned arrays of exactly the structures the
+// GPU buffers want, so a warm start can memory-map the file and
+// upload straight from the mapped pages without touching assimp.
+//
+// The cache key is a hash of the source file(s) and the import
+// flags; any mismatch (or a version/layout change) is a cache miss.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shaders/shared_structs.h"
+#include "file_view.h"
+
+// The model data produced by the assimp path (see vkapp_loadModel.cpp).
+struct ModelData
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Material> materials;
+    std::vector<int32_t>     matIndx;
+    std::vector<std::string> textures;
+
+    void readAssimpFile(const std::string& path, const mat4& M);
+};
+
+// Bump this whenever the file layout, or any of the structures stored
+// in it, changes meaning.
+#define SCENE_CACHE_VERSION 3
+
+struct SceneCacheHeader
+{
+    char     magic[8];          // "RTSCENE\0"
+    uint32_t version;           // SCENE_CACHE_VERSION
+    uint32_t headerSize;        // sizeof(SceneCacheHeader)
+    uint32_t structSizes[4];    // sizeof Vertex, Material, Emitter, uint32_t  (layout check)
+    uint64_t key;               // Hash of source file(s) + import flags
+    double   importMs;          // How long the assimp path took when this was written
+
+    // Each array: byte offset from start of file, and element count.
+    uint64_t vertexOffset,   vertexCount;
+    uint64_t indexOffset,    indexCount;
+    uint64_t materialOffset, materialCount;
+    uint64_t matIndxOffset,  matIndxCount;
+    uint64_t emitterOffset,  emitterCount;
+    uint64_t textureOffset,  textureCount;  // Concatenated '\0' terminated paths
+    uint64_t fileSize;
+};
+
+// A read-only cache file, viewed through a FileView (memory-mapped when
+// possible).  The array pointers point directly into the view and are
+// valid until close() (or destruction).
+class SceneCache
+{
+public:
+    ~SceneCache() { close(); }
+
+    // Key for a model file: hashes the file contents (and any OBJ
+    // mtllib files it names) along with the assimp import flags.  The
+    // variant string distinguishes build-time edits of the loaded data
+    // (e.g. the SANM scene additions).
+    static uint64_t sourceKey(const std::string& path, uint32_t importFlags,
+                              const std::string& variant="");
+
+    // The cache file that goes with a model file.
+    static std::string cachePath(const std::string& path) { return path + ".rtcache"; }
+
+    // Map and validate a cache file. Returns false (and leaves nothing
+    // mapped) if the file is missing, stale, or malformed.
+    bool open(const std::string& path, uint64_t key);
+    void close();
+
+    // Write a cache file for already flattened model data.
+    static bool write(const std::string& path, uint64_t key, double importMs,
+                      const ModelData& meshdata, const std::vector<Emitter>& emitters);
+
+    const SceneCacheHeader* header{nullptr};
+    const Vertex*   vertices{nullptr};
+    const uint32_t* indices{nullptr};
+    const Material* materials{nullptr};
+    const int32_t*  matIndx{nullptr};
+    const Emitter*  emitters{nullptr};
+    std::vector<std::string> textures;
+
+private:
+    FileView       m_file;
+    const uint8_t* m_base{nullptr};   // m_file's data
+    uint64_t       m_size{0};
+};
@@ -0,0 +1,104 @@
+#ifndef BRDF_H
+#define BRDF_H
+
+// The path tracer's BRDF (Phong lobe microfacets, with Schlick's
+// Fresnel term), and how raytrace.rgen samples it, compiled both as
+// GLSL and as C++, like light_choice.h, so the CPU benches
+// (misbench.cpp) run the shader's own code.  Include it after
+// shared_structs.h (for Material);  C++ includers bring glm's names
+// into scope (using namespace glm).
+
+#define pi (3.141592f)
+#define pi2 (2.0f*pi)
+
+float X(float d)
+{
+    if(d > 0.0f)
+        return 1.0f;
+    else
+        return 0.0f;
+}
+float D_Factor(vec3 m, vec3 N, float a)
+{
+    return X(dot(m, N)) * ((a + 2.0f) / pi2) * pow(dot(m, N), a);
+}
+vec3 F_Factor(vec3 Ks, float d)
+{
+    return Ks + (vec3(1.0f) - Ks) * pow(1.0f - abs(d), 5.0f);
+}
+float G1_Factor(vec3 v, vec3 m, vec3 N, float alpha)
+{
+    float tan_v = sqrt(1.0f - pow(dot(v, N), 2.0f)) / dot(v, N);
+    float a = sqrt(alpha / 2.0f + 1.0f) / tan_v;
+
+    return X(dot(v, m) / dot(v, N)) * (a < 1.6f ? (3.535f * a + 2.181f * a * a) / (1.0f + 2.276f * a + 2.577f * a * a) : 1.0f);
+}
+float G_Factor(vec3 Wi, vec3 Wo, vec3 m, vec3 N, Material mat)
+{
+    return G1_Factor(Wi, m, N, mat.shininess) * G1_Factor(Wo, m, N, mat.shininess);
+}
+
+vec3 EvalBrdf(vec3 N, vec3 L, vec3 V, Material mat)
+{
+    float alpha = mat.shininess;
+    vec3 H = normalize(L + V);
+
+    float D = D_Factor(H, N, alpha);
+    vec3 F = F_Factor(mat.specular, dot(L, H));
+    //float G = 1.0f / pow(dot(L, H), 2.0f);
+    float G = G_Factor(L, V, H, N, mat);
+
+    return X(dot(N, L)) * (mat.diffuse / pi) + (D * F * G) / (4.0f * dot(L, N) * dot(V, N));
+}
+
+// A direction c (the cosine) off axis A, at angle phi around it.
+vec3 SampleLobe(vec3 A, float c, float phi)
+{
+    float s = sqrt(1.0f - c * c);
+    // Create vector K around Z-axis and rotate to A-axis
+    vec3 K = vec3(s * cos(phi), s * sin(phi), c);
+
+    // A = Z so no rotation
+    if(abs(A.z - 1.0f) < 1e-3f)
+        return K;
+    // A = -Z so rotate 180 around X axis
+    if(abs(A.z + 1.0f) < 1e-3f)
+        return vec3(K.x, -K.y, -K.z);
+
+    // B = Z x A
+    vec3 B = normalize(vec3(-A.y, A.x, 0.0f));
+    vec3 C = cross(A, B);
+
+    return K.x * B + K.y * C + K.z * A;
+}
+
+// BrdfDirection picks EvalBrdf's diffuse or glossy lobe, in proportion
+// to the average of Kd and of Ks, by sample value lobe.  The diffuse
+// lobe is sampled by cosine, the glossy one by drawing the half vector
+// from D_Factor and reflecting Wo about it;  u places the direction
+// within the lobe.  PdfBrdf is its pdf.
+float SpecularChance(Material mat)
+{
+    float d = dot(mat.diffuse, vec3(1.0f/3.0f));
+    float s = dot(mat.specular, vec3(1.0f/3.0f));
+    return d + s > 0.0f ? s / (d + s) : 0.0f;
+}
+vec3 BrdfDirection(float lobe, vec2 u, vec3 N, vec3 Wo, Material mat)
+{
+    if (lobe >= SpecularChance(mat))
+        return SampleLobe(N, sqrt(u.x), pi2 * u.y);
+    vec3 m = SampleLobe(N, pow(u.x, 1.0f / (mat.shininess + 2.0f)), pi2 * u.y);
+    return 2.0f * dot(Wo, m) * m - Wo;
+}
+float PdfBrdf(vec3 N, vec3 Wi, vec3 Wo, Material mat)
+{
+    float s = SpecularChance(mat);
+    float diffuse = max(dot(N, Wi), 0.0f) / pi;
+    if (s == 0.0f)
+        return diffuse;
+    vec3 m = normalize(Wo + Wi);
+    float glossy = D_Factor(m, N, mat.shininess) * abs(dot(m, N)) / (4.0f * abs(dot(Wi, m)));
+    return (1.0f - s) * diffuse + s * glossy;
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef LIGHT_CHOICE_H
+#define LIGHT_CHOICE_H
+
+// How SampleLight in raytrace.rgen chooses an emitter (see
+// light_sampling.h), compiled both as GLSL and as C++, like
+// shared_structs.h, so the CPU benches (lightbench.cpp) run the
+// shader's own code.  C++ includers bring glm's names into scope
+// (using namespace glm), and define the accessors below over their own
+// arrays;  raytrace.rgen includes this after declaring its buffers.
+//
+//   EMITTER(i)      emitter i of the list (with its alias table)
+//   EMITTER_COUNT   how many there are, as a uint
+//   LIGHT_NODE(i)   node i of the light tree
+
+#ifndef __cplusplus
+#define EMITTER(i)     emitter.list[i]
+#define EMITTER_COUNT  uint(emitter.list.length())
+#define LIGHT_NODE(i)  lightTree.nodes[i]
+#endif
+
+// An emitter's index, and the chance of having chosen it.
+struct EmitterChoice
+{
+    uint  index;
+    float pdf;
+};
+
+// Every emitter alike, from one sample value.
+uint ChooseEmitterUniformly(float u)
+{
+    uint n = EMITTER_COUNT;
+    return min(uint(u * float(n)), n - 1u);
+}
+
+// In proportion to power, from the alias table kept in the list:  a
+// uniform slot, then a coin flip between its emitter and its alias.
+// The chosen emitter's pdf is its .pdf.
+uint ChooseEmitterByPower(vec2 u)
+{
+    uint i = ChooseEmitterUniformly(u.x);
+    if (u.y >= EMITTER(i).aliasProb)
+        i = EMITTER(i).alias;
+    return i;
+}
+
+// cos(max(0, a - b)) from the cosines of angles a and b in [0, pi/2].
+float CosSubClamped(float cosA, float cosB)
+{
+    if (cosA >= cosB)
+        return 1.0f;  // a <= b
+    float sinA = sqrt(max(0.0f, 1.0f - cosA*cosA));
+    float sinB = sqrt(max(0.0f, 1.0f - cosB*cosB));
+    return cosA*cosB + sinA*sinB;
+}
+
+// A bound on what a light tree node's emitters contribute at point P
+// with normal N:  power over squared distance, times the best emitter
+// and receiver cosines any point in the node's box could have.  The
+// angles are kept as cosines throughout:  no trigonometry, just the
+// angle difference identities.
+float LightImportance(LightNode node, vec3 P, vec3 N)
+{
+    vec3 center = 0.5f*(node.boundsMin + node.boundsMax);
+    vec3 diagonal = node.boundsMax - node.boundsMin;
+    vec3 toLight = center - P;
+    float d2 = dot(toLight, toLight);
+    float r2 = 0.25f*dot(diagonal, diagonal);  // The bounding sphere's radius, squared
+    if (d2 <= r2)  // Within the bounding sphere, the angles are unbounded
+        return node.power / max(r2, 1e-8f);
+
+    vec3 w = toLight / sqrt(d2);
+    float cosBound = sqrt(1.0f - r2/d2);  // Of half the angle the sphere subtends at P
+
+    // At the emitters:  the angle from the cone (either way) to P, less
+    // the cone's own angle, less the sphere's.
+    float cosOut = CosSubClamped(min(1.0f, abs(dot(node.axis, w))), node.cosAngle);
+    float cosEmit = CosSubClamped(cosOut, cosBound);
+
+    // At P:  the angle from the normal (either way) to the sphere's center, less the sphere's.
+    float cosReceive = CosSubClamped(min(1.0f, abs(dot(N, w))), cosBound);
+    return node.power * cosEmit * cosReceive / d2;
+}
+
+// The chance of taking the first of the light tree children c and c+1.
+float LightChildChance(int c, vec3 P, vec3 N)
+{
+    float i0 = LightImportance(LIGHT_NODE(c), P, N);
+    float i1 = LightImportance(LIGHT_NODE(c+1), P, N);
+    if (!(i0 + i1 > 0.0f)) {
+        i0 = LIGHT_NODE(c).power;
+        i1 = LIGHT_NODE(c+1).power; }
+    return i0 + i1 > 0.0f ? i0/(i0 + i1) : 0.5f;
+}
+
+// Walks down the light tree, taking each child in proportion to its
+// importance at P;  the emitter's pdf is the product of the choices.
+// One sample value makes every choice:  each level rescales what is
+// left of it to [0, 1), so stratified values stay stratified.
+EmitterChoice ChooseEmitterFromTree(float u, vec3 P, vec3 N)
+{
+    int node = 0;
+    float pdf = 1.0f;
+    while (LIGHT_NODE(node).child >= 0) {
+        int c = LIGHT_NODE(node).child;
+        float p0 = LightChildChance(c, P, N);
+        if (u < p0) {
+            node = c;
+            pdf *= p0;
+            u = min(u / p0, 0.99999994f); }
+        else {
+            node = c + 1;
+            pdf *= 1.0f - p0;
+            u = min((u - p0) / (1.0f - p0), 0.99999994f); } }
+
+    EmitterChoice choice;
+    choice.index = uint(-1 - LIGHT_NODE(node).child);
+    choice.pdf = pdf;
+    return choice;
+}
+
+// The chance that ChooseEmitterFromTree, at P with normal N, chooses
+// the emitter at the end of treeTrail:  the trail retraces its choices.
+float PdfEmitterFromTree(uint treeTrail, vec3 P, vec3 N)
+{
+    int node = 0;
+    float pdf = 1.0f;
+    for (int depth = 0;  LIGHT_NODE(node).child >= 0;  depth++) {
+        int c = LIGHT_NODE(node).child;
+        float p0 = LightChildChance(c, P, N);
+        if ((treeTrail & (1u << depth)) == 0u) {
+            node = c;
+            pdf *= p0; }
+        else {
+            node = c + 1;
+            pdf *= 1.0f - p0; } }
+    return pdf;
+}
+
+#endif
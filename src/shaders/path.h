@@ -0,0 +1,33 @@
+#ifndef PATH_H
+#define PATH_H
+
+// Steps of raytrace.rgen's path loop that need nothing of the scene,
+// compiled both as GLSL and as C++, like light_choice.h, so the CPU
+// benches (roulettebench.cpp, misbench.cpp) run the shader's own code.  C++ includers
+// bring glm's names into scope (using namespace glm).
+
+// Russian roulette, per path:  go on, given sample value u, with
+// probability the throughput W's largest component (at most 1), and
+// scale W up by its inverse to stay unbiased;  false ends the path.
+// Dark paths end early;  bright ones keep going.
+bool RussianRoulette(INOUT(vec3) W, float u)
+{
+    float survive = min(1.0f, max(W.x, max(W.y, W.z)));
+    if (u >= survive)
+        return false;
+    W /= survive;
+    return true;
+}
+
+// The weight of a sample from one of two techniques, with the pdfs of
+// both for it:  Veach's power heuristic, with exponent 2.  The weights
+// of the two sum to 1, so the pair stays unbiased.
+float PowerHeuristic(float pdf, float otherPdf)
+{
+    if (!(pdf > 0.0f))
+        return 0.0f;
+    float r = otherPdf / pdf;  // As a ratio, so large pdfs do not overflow
+    return 1.0f / (1.0f + r * r);
+}
+
+#endif
@@ -6,7 +6,7 @@ layout(set = 0, binding = 0) uniform sampler2D renderedImage;
 
 void main()
 {
-    vec2 uv = gl_FragCoord.xy/vec2(1280, 768);
+    vec2 uv = gl_FragCoord.xy/vec2(textureSize(renderedImage, 0));
     //fragColor = vec4(uv, 0, 1);
     fragColor = pow(texture(renderedImage, uv), vec4(1.0 / 2.2));
 }
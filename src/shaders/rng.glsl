@@ -1,5 +1,7 @@
 
 
+// Compiled as C++ too, after shared_structs.h (see sampler.glsl).
+
 // Generate a random unsigned int from two unsigned int values, using 16 pairs
 // of rounds of the Tiny Encryption Algorithm. See Zafar, Olano, and Curtis,
 // "GPU Random Numbers via the Tiny Encryption Algorithm"
@@ -21,7 +23,7 @@ uint tea(uint val0, uint val1)
 
 // Generate a random unsigned int in [0, 2^24) given the previous RNG state
 // using the Numerical Recipes linear congruential generator
-uint lcg(inout uint prev)
+uint lcg(INOUT(uint) prev)
 {
     uint LCG_A = 1664525u;
     uint LCG_C = 1013904223u;
@@ -30,7 +32,7 @@ uint lcg(inout uint prev)
 }
 
 // Generate a random float in [0, 1) given the previous RNG state
-float rnd(inout uint prev)
+float rnd(INOUT(uint) prev)
 {
     return (float(lcg(prev)) / float(0x01000000));
 }
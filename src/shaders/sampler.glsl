@@ -0,0 +1,129 @@
+// The path tracer's source of sample values, in one of two ways (see
+// SamplerChoice):
+//
+//   random  the TEA seeded LCG of rng.glsl, reseeded every frame
+//   sobol   the first two dimensions of the Sobol sequence, Owen
+//           scrambled by hashing (Burley, "Practical Hash-based Owen
+//           Scrambling", JCGT 2020), indexed by the pixel's sample count
+//
+// Each call to Sample1D or Sample2D takes the next dimension.  A 2D
+// call takes its two values from one Sobol point, so they are
+// stratified together (a (0,2)-sequence:  every power of two run of
+// samples fills each of the plane's elementary intervals once), and
+// samples of either are stratified across frames.  Successive
+// dimensions are padded:  each gets its own shuffle of the index and
+// its own scramble, both hashed from the pixel's seed and the
+// dimension, so no two are correlated, and neither are two pixels.
+//
+// The index is pcRay.sampleIndex, the frames since the image was last
+// cleared, and the seed pcRay.sequenceSeed, redrawn at each clear:
+// while the camera holds still, a pixel's samples are one sequence;
+// while it moves, each frame is the sequence's first point under a new
+// scramble, which is uniform random.
+//
+// All but SamplerInit, which reads pcRay, compile as C++ too, after
+// shared_structs.h and rng.glsl, like light_choice.h:  samplebench.cpp
+// runs this code on the CPU.  C++ includers bring glm's names into
+// scope (using namespace glm).
+
+struct Sampler
+{
+    uint index;     // Sample number of this pixel
+    uint seed;      // Per pixel;  or the LCG state, when random
+    uint dim;       // Dimensions taken so far
+    bool sobol;
+};
+
+// A cheap, well mixed 32 bit hash (Wellons' lowbias32).
+uint hashUint(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+uint hashCombine(uint seed, uint v)
+{
+    return hashUint(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// Burley's variant of the Laine-Karras permutation:  flipping each bit
+// depends only on the bits below it, so on reversed bits it is an Owen
+// scramble.
+uint laineKarras(uint x, uint seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+uint nestedUniformScramble(uint x, uint seed)
+{
+    return bitfieldReverse(laineKarras(bitfieldReverse(x), seed));
+}
+
+// The second Sobol dimension;  the first is bitfieldReverse(index).
+uint sobol1(uint index)
+{
+    uint x = 0u;
+    for (uint v = 1u << 31;  index != 0u;  index >>= 1, v ^= v >> 1)
+        if ((index & 1u) != 0u)
+            x ^= v;
+    return x;
+}
+
+float uintToUnit(uint x)  // In [0, 1)
+{
+    return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// The sampler of pixel pixelIndex for its sample sampleIndex:  seeded
+// from sequenceSeed when sobol, from frameSeed when random.
+Sampler SamplerStart(uint pixelIndex, uint sampleIndex, uint sequenceSeed, uint frameSeed, bool sobol)
+{
+    Sampler s;
+    s.index = sampleIndex;
+    s.dim = 0u;
+    s.sobol = sobol;
+    if (s.sobol)
+        s.seed = hashCombine(hashUint(pixelIndex), sequenceSeed);
+    else
+        s.seed = tea(pixelIndex, frameSeed);
+    return s;
+}
+
+#ifndef __cplusplus
+Sampler SamplerInit(uvec2 pixel, uvec2 size)
+{
+    return SamplerStart(pixel.y*size.x + pixel.x, uint(pcRay.sampleIndex), uint(pcRay.sequenceSeed),
+                        uint(pcRay.frameSeed), pcRay.samplerChoice == eSamplerSobol);
+}
+#endif
+
+vec2 Sample2D(INOUT(Sampler) s)
+{
+    if (!s.sobol) {
+        float x = rnd(s.seed);  // Apart:  C++ leaves the order of arguments open
+        float y = rnd(s.seed);
+        return vec2(x, y); }
+
+    uint dimSeed = hashCombine(s.seed, s.dim++);
+    uint index = nestedUniformScramble(s.index, dimSeed);
+    uint x = nestedUniformScramble(bitfieldReverse(index), hashCombine(dimSeed, 0u));
+    uint y = nestedUniformScramble(sobol1(index), hashCombine(dimSeed, 1u));
+    return vec2(uintToUnit(x), uintToUnit(y));
+}
+
+float Sample1D(INOUT(Sampler) s)
+{
+    if (!s.sobol)
+        return rnd(s.seed);
+
+    uint dimSeed = hashCombine(s.seed, s.dim++);
+    uint index = nestedUniformScramble(s.index, dimSeed);
+    return uintToUnit(nestedUniformScramble(bitfieldReverse(index), hashCombine(dimSeed, 0u)));
+}
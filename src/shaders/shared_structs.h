@@ -44,6 +44,7 @@ struct ObjDesc
   uint64_t indexAddress;          // Address of the index buffer
   uint64_t materialAddress;       // Address of the material buffer
   uint64_t materialIndexAddress;  // Address of the triangle material index buffer
+  uint64_t emitterIndexAddress;   // Address of each triangle's index in the emitter list, or -1
 };
 
 
@@ -72,6 +73,14 @@ struct PushConstantRaster
 #define ALIGNAS(N)
 #endif
 
+// An inout parameter of a function compiled as both GLSL and C++ (as in
+// path.h):  a reference in C++.
+#ifdef __cplusplus
+#define INOUT(T) T&
+#else
+#define INOUT(T) inout T
+#endif
+
 // For structures used by both C++ and GLSL, byte alignment
 // differs between the two languages.  Ints, uints, and floats align
 // nicely, but bool's do not.
@@ -100,10 +109,15 @@ struct PushConstantRay
     // ALIGNAS(16) vec4 tempLightInt;  // TEMPORARY: vec4(2.5, 2.5, 2.5, 0.0);
     // ALIGNAS(16) vec4 tempAmbient;   // TEMPORARY: vec4(0.2);
     // @@ Pathtracing: Remove these 3 values because path tracing finds light by tracing rays.
-    ALIGNAS(4) int frameSeed;
-    ALIGNAS(4) float rr;        // Russian-Roulette Threshold
-    ALIGNAS(4) int depth;       // Maximum Depth based on rr value
+    ALIGNAS(4) int frameSeed;       // Redrawn every frame
+    ALIGNAS(4) int sequenceSeed;    // Redrawn at every clear (see sampler.glsl)
+    ALIGNAS(4) int sampleIndex;     // Frames since the last clear
+    ALIGNAS(4) int samplerChoice;   // eSamplerRandom or eSamplerSobol
+    ALIGNAS(4) int minDepth;    // Path segments traced before Russian roulette may end a path
+    ALIGNAS(4) int maxDepth;    // Hard limit on path segments
     ALIGNAS(4) bool explicitLight;
+    ALIGNAS(4) bool mis;            // Weight explicit light and BRDF hits by MIS;  else 0.5 each
+    ALIGNAS(4) int lightChoice;     // eLightUniform, eLightPower or eLightTree
 
     ALIGNAS(4) bool clear;  // Tell the ray generation shader to start accumulation from scratch
     ALIGNAS(4) float exposure;
@@ -136,19 +150,81 @@ struct Emitter
     vec3 normal;        // Its normal
     float area;         // Its traingle area
     uint index;         // The triangle index in the model's list of triangles
+
+    // Power-weighted choice (SampleLight) with Walker's alias method:
+    // slot i of the list keeps emitter i with probability aliasProb,
+    // and otherwise gives emitter alias.  Built by buildEmitterList.
+    float pdf;          // Chance of choosing this emitter:  its share of the total luminance x area
+    float aliasProb;
+    uint alias;
+
+    uint treeTrail;     // Its leaf in the light tree:  bit d is the turn at depth d, 1 for child+1
 };
 
+// A node of the light tree (see light_sampling.h):  bounds on the
+// positions, normals and power of the emitters below it, from which
+// raytrace.rgen estimates their contribution to a shading point.
+struct LightNode
+{
+    vec3  boundsMin;
+    float power;        // Total luminance x area below
+    vec3  boundsMax;
+    float cosAngle;     // Every normal is within acos(cosAngle) of +axis or -axis (emitters are two-sided)
+    vec3  axis;
+    int   child;        // Inner node:  children at child and child+1;  a leaf:  -1 - its emitter's index
+};
+
+START_ENUM(LightChoice)  // How SampleLight picks an emitter
+  eLightUniform = 0,
+  eLightPower   = 1,     // In proportion to power, from the alias table
+  eLightTree    = 2      // By estimated contribution, down the light tree
+END_ENUM();
+
+START_ENUM(SamplerChoice)  // Where the path tracer's sample values come from (see sampler.glsl)
+  eSamplerRandom = 0,    // The LCG of rng.glsl
+  eSamplerSobol  = 1     // Owen scrambled Sobol
+END_ENUM();
+
 
 // Push constant structure for the ray tracer
 struct PushConstantDenoise
 {
     float normFactor, depthFactor;
     int  stepwidth;  
+    float normScale, depthScale;  // 1/(stepwidth^2 normFactor) and 1/depthFactor, or 0 for factors of 0
 };
 
+// Normal:depth G-buffer (m_rtNdBuffer, an RG32UI image) packing,
+// shared by the ray tracer that writes it and the denoisers that read
+// it.  The unit normal is octahedral encoded into two 16 bit snorms
+// (.x) and the depth kept as a full float (.y).  The C++ side never
+// reads these images, so this is GLSL only.
+#ifndef __cplusplus
+vec2 octWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+uvec2 packNd(vec3 nrm, float depth)
+{
+    vec2 oct = nrm.xy / (abs(nrm.x) + abs(nrm.y) + abs(nrm.z));
+    if (nrm.z < 0.0)
+        oct = octWrap(oct);
+    return uvec2(packSnorm2x16(oct), floatBitsToUint(depth));
+}
+
+vec4 unpackNd(uvec2 nd)  // .xyz the normal, .w the depth
+{
+    vec2 oct = unpackSnorm2x16(nd.x);
+    vec3 nrm = vec3(oct, 1.0 - abs(oct.x) - abs(oct.y));
+    if (nrm.z < 0.0)
+        nrm.xy = octWrap(nrm.xy);
+    return vec4(normalize(nrm), uintBitsToFloat(nd.y));
+}
+#endif
+
 struct RayPayload
 {
-    uint seed;		// Used in Path Tracing step as random number seed
     bool hit;           // Does the ray intersect anything or not?
     float hitDist;      // Used in the denoising step
     vec3 hitPos;	// The world coordinates of the hit point.      
@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+// Startup stages as a dependency graph (see startup_graph.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include "startup_graph.h"
+#include "trace.h"
+
+void StartupGraph::add(const char* name, const std::vector<const char*>& deps, std::function<void()> fn,
+                       Affinity where)
+{
+    Stage stage;
+    stage.name = name;
+    stage.fn = std::move(fn);
+    stage.where = where;
+    stage.caller = m_lastCaller;
+    for (const char* dep : deps) {
+        int d = (int)m_stages.size() - 1;
+        while (d >= 0 && strcmp(m_stages[d].name, dep) != 0)
+            d--;
+        if (d < 0)
+            throw std::runtime_error(std::string("startup stage ") + name
+                                     + " depends on " + dep + ", which is not an earlier stage");
+        stage.deps.push_back(d); }
+
+    if (where == eCallingThread)
+        m_lastCaller = (int)m_stages.size();
+    m_stages.push_back(std::move(stage));
+}
+
+void StartupGraph::runStage(Stage& stage)
+{
+    stage.thread = JobSystem::currentWorker();
+    stage.startNs = traceNow();
+    stage.fn();
+    stage.endNs = traceNow();
+    stage.ran = true;
+    stage.fn = nullptr;
+}
+
+void StartupGraph::run()
+{
+    TRACE_FUNCTION();
+    JobSystem& jobs = JobSystem::instance();
+
+    // Stages are not added while running, so the references stay put.
+    std::exception_ptr error;
+    for (Stage& stage : m_stages) {
+        if (stage.where == eAnyThread) {
+            std::vector<JobHandle> deps;
+            for (int d : stage.deps)
+                deps.push_back(m_stages[d].job);  // Null for calling thread stages, all done by now
+            stage.job = jobs.submit(stage.name, [this, &stage]() { runStage(stage); }, deps);
+            continue; }
+
+        try {
+            for (int d : stage.deps)
+                jobs.wait(m_stages[d].job, false);
+            TRACE_SCOPE(stage.name);
+            runStage(stage); }
+        catch (...) {
+            error = std::current_exception();
+            break; } }
+
+    // Pooled stages use the caller's state;  let them all finish first.
+    for (Stage& stage : m_stages) {
+        try {
+            jobs.wait(stage.job, false); }
+        catch (...) {
+            if (!error)
+                error = std::current_exception(); } }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void StartupGraph::printTimeline() const
+{
+    std::vector<int> order;
+    for (int s=0;  s<(int)m_stages.size();  s++)
+        if (m_stages[s].ran)
+            order.push_back(s);
+    if (order.empty())
+        return;
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+        return m_stages[a].startNs < m_stages[b].startNs; });
+
+    // Back from the last to finish, through whatever it waited on that finished last.
+    std::vector<bool> critical(m_stages.size(), false);
+    int last = *std::max_element(order.begin(), order.end(), [this](int a, int b) {
+        return m_stages[a].endNs < m_stages[b].endNs; });
+    uint64_t criticalNs = 0, workNs = 0;
+    for (int s=last;  s >= 0; ) {
+        const Stage& stage = m_stages[s];
+        critical[s] = true;
+        criticalNs += stage.endNs - stage.startNs;
+        int next = -1;
+        std::vector<int> preds = stage.deps;
+        preds.push_back(stage.caller);
+        for (int p : preds)
+            if (p >= 0 && m_stages[p].ran && (next < 0 || m_stages[p].endNs > m_stages[next].endNs))
+                next = p;
+        s = next; }
+
+    printf("Startup stages (ms since the process started;  * on the critical path):\n");
+    printf("      %8s %8s  %-9s %s\n", "start", "ms", "thread", "stage");
+    for (int s : order) {
+        const Stage& stage = m_stages[s];
+        workNs += stage.endNs - stage.startNs;
+        char thread[16];
+        if (stage.thread < 0)
+            snprintf(thread, sizeof(thread), "main");
+        else
+            snprintf(thread, sizeof(thread), "worker %d", stage.thread);
+        printf("    %s %8.1f %8.1f  %-9s %s\n", critical[s] ? "*" : " ",
+               stage.startNs/1e6, (stage.endNs - stage.startNs)/1e6, thread, stage.name); }
+    printf("Startup: done at %.1f ms;  %.1f ms of stages, %.1f ms of them on the critical path\n",
+           m_stages[last].endNs/1e6, workNs/1e6, criticalNs/1e6);
+}
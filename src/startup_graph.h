@@ -0,0 +1,71 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Startup as a graph of named stages, run on the job system.
+//
+//     StartupGraph graph;
+//     graph.add("read model", {}, [&]() { ... }, StartupGraph::eAnyThread);
+//     graph.add("device", {"instance"}, [&]() { ... });
+//     graph.add("decode textures", {"read model", "device"}, [&]() { ... },
+//               StartupGraph::eAnyThread);
+//     graph.run();
+//     graph.printTimeline();
+//
+// A stage runs once every stage it names has finished.  An eAnyThread
+// stage goes to the job system as soon as run() reaches it.  The rest
+// -- anything that records into the upload context, or touches the
+// queue or the window -- run on the calling thread, in the order added.
+// Dependencies must name stages added earlier, so the graph is acyclic
+// by construction.  The order of adding is also the order in which the
+// calling thread takes its own stages, and submits the others:  add a
+// pooled stage right after the last calling thread stage it needs, and
+// a calling thread stage that needs a long pooled one as late as it
+// can go, so the thread has other things to do meanwhile.  The calling
+// thread waits without running jobs itself (see JobSystem::wait), so
+// it is never caught in a long one.
+//
+// run() returns once every stage it started has finished, and then
+// rethrows the first exception thrown;  stages after a failed one are
+// skipped.
+//
+// printTimeline() lists every stage's start and duration, in ms since
+// the process started (traceNow(), see trace.h), with its thread, and
+// marks the critical path:  back from the last stage to finish, through
+// whichever stage it waited on finished last.  Stage names are not
+// copied;  pass string literals.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "job_system.h"
+
+class StartupGraph
+{
+public:
+    enum Affinity { eCallingThread, eAnyThread };
+
+    void add(const char* name, const std::vector<const char*>& deps, std::function<void()> fn,
+             Affinity where=eCallingThread);
+    void run();
+    void printTimeline() const;
+
+private:
+    struct Stage
+    {
+        const char* name;
+        std::vector<int> deps;      // Indices of earlier stages
+        int caller{-1};             // The calling thread stage before this one:  an implicit dependency
+        std::function<void()> fn;
+        Affinity where;
+        JobHandle job;              // eAnyThread stages, once submitted
+        bool ran{false};
+        int thread{-1};             // JobSystem::currentWorker() while it ran
+        uint64_t startNs{0}, endNs{0};
+    };
+    std::vector<Stage> m_stages;
+    int m_lastCaller{-1};
+
+    void runStage(Stage& stage);
+};
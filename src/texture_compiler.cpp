@@ -0,0 +1,365 @@
+//////////////////////////////////////////////////////////////////////
+// Offline texture compiler.  Reads images with stb_image, builds the
+// full mip chain with a box filter, block compresses each level, and
+// writes a .rtex container (see texture_format.h) next to each input.
+//
+//   texc [-f] [-bc7] image ...
+//
+//   -f     Rebuild even if the .rtex file is newer than the image.
+//   -bc7   Use BC7 for opaque textures too (higher quality, twice the size).
+//
+// Opaque images are compressed to BC1; images with any alpha < 255
+// to BC7 (single subset, mode 6).
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_FAILURE_USERMSG
+#include "stb_image.h"
+
+#include "texture_format.h"
+
+struct Level
+{
+    int width, height;
+    std::vector<uint8_t> rgba;
+};
+
+// Box filter one level down to max(1,w/2) x max(1,h/2), the same
+// extents the runtime blit chain used.  Each output texel averages
+// the source texels its footprint covers, so odd sizes are handled.
+static Level downsample(const Level& src)
+{
+    Level dst;
+    dst.width  = std::max(1, src.width/2);
+    dst.height = std::max(1, src.height/2);
+    dst.rgba.resize(size_t(dst.width)*dst.height*4);
+
+    for (int y=0;  y<dst.height;  y++) {
+        int y0 = y*src.height/dst.height;
+        int y1 = std::max(y0+1, (y+1)*src.height/dst.height);
+        for (int x=0;  x<dst.width;  x++) {
+            int x0 = x*src.width/dst.width;
+            int x1 = std::max(x0+1, (x+1)*src.width/dst.width);
+            uint32_t sum[4] = {0,0,0,0};
+            for (int sy=y0;  sy<y1;  sy++)
+                for (int sx=x0;  sx<x1;  sx++)
+                    for (int c=0;  c<4;  c++)
+                        sum[c] += src.rgba[(size_t(sy)*src.width + sx)*4 + c];
+            uint32_t n = (y1-y0)*(x1-x0);
+            for (int c=0;  c<4;  c++)
+                dst.rgba[(size_t(y)*dst.width + x)*4 + c] = uint8_t((sum[c] + n/2)/n); } }
+
+    return dst;
+}
+
+// Fetch a 4x4 block, clamping to the image edge for small levels.
+static void fetchBlock(const Level& level, int bx, int by, uint8_t block[16][4])
+{
+    for (int j=0;  j<4;  j++)
+        for (int i=0;  i<4;  i++) {
+            int x = std::min(bx*4+i, level.width-1);
+            int y = std::min(by*4+j, level.height-1);
+            memcpy(block[j*4+i], &level.rgba[(size_t(y)*level.width + x)*4], 4); }
+}
+
+// Endpoints for a block: the extremes of its texels projected on the
+// principal axis (found by a few power iterations on the covariance).
+static void principalEndpoints(const uint8_t block[16][4], int channels, float lo[4], float hi[4])
+{
+    float mean[4] = {0,0,0,0};
+    for (int p=0;  p<16;  p++)
+        for (int c=0;  c<channels;  c++)
+            mean[c] += block[p][c]/16.0f;
+
+    float cov[4][4] = {};
+    for (int p=0;  p<16;  p++)
+        for (int a=0;  a<channels;  a++)
+            for (int b=0;  b<channels;  b++)
+                cov[a][b] += (block[p][a]-mean[a])*(block[p][b]-mean[b]);
+
+    float axis[4] = {1,1,1,1};
+    for (int iter=0;  iter<8;  iter++) {
+        float next[4] = {0,0,0,0};
+        float len = 0;
+        for (int a=0;  a<channels;  a++) {
+            for (int b=0;  b<channels;  b++)
+                next[a] += cov[a][b]*axis[b];
+            len += next[a]*next[a]; }
+        if (len < 1e-12f)
+            break;
+        len = std::sqrt(len);
+        for (int a=0;  a<channels;  a++)
+            axis[a] = next[a]/len; }
+
+    float tmin = 1e30f, tmax = -1e30f;
+    for (int p=0;  p<16;  p++) {
+        float t = 0;
+        for (int c=0;  c<channels;  c++)
+            t += (block[p][c]-mean[c])*axis[c];
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t); }
+
+    for (int c=0;  c<channels;  c++) {
+        lo[c] = std::clamp(mean[c] + tmin*axis[c], 0.0f, 255.0f);
+        hi[c] = std::clamp(mean[c] + tmax*axis[c], 0.0f, 255.0f); }
+}
+
+static int distance2(const uint8_t* a, const int* b, int channels)
+{
+    int d = 0;
+    for (int c=0;  c<channels;  c++)
+        d += (a[c]-b[c])*(a[c]-b[c]);
+    return d;
+}
+
+////////////////////////////////////////////////////////////////////////
+// BC1: two RGB565 endpoints and 2 bit indices; 4 color mode (c0 > c1).
+static uint16_t pack565(const float c[3])
+{
+    int r = std::lround(c[0]*31/255.0f);
+    int g = std::lround(c[1]*63/255.0f);
+    int b = std::lround(c[2]*31/255.0f);
+    return uint16_t((r<<11) | (g<<5) | b);
+}
+
+static void unpack565(uint16_t v, int c[3])
+{
+    int r = (v>>11)&31, g = (v>>5)&63, b = v&31;
+    c[0] = (r<<3)|(r>>2);
+    c[1] = (g<<2)|(g>>4);
+    c[2] = (b<<3)|(b>>2);
+}
+
+static void encodeBC1(const uint8_t block[16][4], uint8_t out[8])
+{
+    float lo[4], hi[4];
+    principalEndpoints(block, 3, lo, hi);
+    uint16_t c0 = pack565(hi), c1 = pack565(lo);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int palette[4][3];
+        unpack565(c0, palette[0]);
+        unpack565(c1, palette[1]);
+        for (int c=0;  c<3;  c++) {
+            palette[2][c] = (2*palette[0][c] + palette[1][c])/3;
+            palette[3][c] = (palette[0][c] + 2*palette[1][c])/3; }
+
+        for (int p=0;  p<16;  p++) {
+            int best = 0, bestDist = distance2(block[p], palette[0], 3);
+            for (int k=1;  k<4;  k++) {
+                int d = distance2(block[p], palette[k], 3);
+                if (d < bestDist) { best = k;  bestDist = d; } }
+            indices |= uint32_t(best) << (2*p); } }
+
+    memcpy(out+0, &c0, 2);
+    memcpy(out+2, &c1, 2);
+    memcpy(out+4, &indices, 4);
+}
+
+////////////////////////////////////////////////////////////////////////
+// BC7 mode 6: one subset, RGBA 7.7.7.7 endpoints each with a p-bit,
+// and 4 bit indices.
+static const int bc7Weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Quantize an RGBA endpoint to 7 bits per channel plus a shared p-bit,
+// choosing the p-bit that lands closest.
+static void quantizeBC7Endpoint(const float e[4], int q[4], int& pbit)
+{
+    int bestErr = INT32_MAX;
+    for (int p=0;  p<2;  p++) {
+        int err = 0, cand[4];
+        for (int c=0;  c<4;  c++) {
+            cand[c] = std::clamp((int)std::lround((e[c] - p)/2.0f), 0, 127);
+            int v = (cand[c]<<1) | p;
+            err += int((v-e[c])*(v-e[c])); }
+        if (err < bestErr) {
+            bestErr = err;
+            pbit = p;
+            memcpy(q, cand, sizeof(cand)); } }
+}
+
+struct BitWriter
+{
+    uint8_t* out;
+    int pos = 0;
+    void put(uint32_t value, int bits) {
+        for (int i=0;  i<bits;  i++, pos++)
+            if (value & (1u<<i))
+                out[pos>>3] |= uint8_t(1u << (pos&7)); }
+};
+
+static void encodeBC7(const uint8_t block[16][4], uint8_t out[16])
+{
+    float lo[4], hi[4];
+    principalEndpoints(block, 4, lo, hi);
+
+    int q[2][4], pbit[2];
+    quantizeBC7Endpoint(lo, q[0], pbit[0]);
+    quantizeBC7Endpoint(hi, q[1], pbit[1]);
+
+    int indices[16];
+    auto chooseIndices = [&]() {
+        int e[2][4], palette[16][4];
+        for (int k=0;  k<2;  k++)
+            for (int c=0;  c<4;  c++)
+                e[k][c] = (q[k][c]<<1) | pbit[k];
+        for (int w=0;  w<16;  w++)
+            for (int c=0;  c<4;  c++)
+                palette[w][c] = ((64-bc7Weights4[w])*e[0][c] + bc7Weights4[w]*e[1][c] + 32) >> 6;
+        for (int p=0;  p<16;  p++) {
+            int best = 0, bestDist = distance2(block[p], palette[0], 4);
+            for (int w=1;  w<16;  w++) {
+                int d = distance2(block[p], palette[w], 4);
+                if (d < bestDist) { best = w;  bestDist = d; } }
+            indices[p] = best; } };
+    chooseIndices();
+
+    // The anchor (first) index is stored with its top bit implied 0.
+    if (indices[0] & 8) {
+        std::swap(q[0], q[1]);
+        std::swap(pbit[0], pbit[1]);
+        for (int p=0;  p<16;  p++)
+            indices[p] = 15 - indices[p]; }
+
+    memset(out, 0, 16);
+    BitWriter bw{out};
+    bw.put(1u<<6, 7);                   // Mode 6
+    for (int c=0;  c<4;  c++) {
+        bw.put(q[0][c], 7);
+        bw.put(q[1][c], 7); }
+    bw.put(pbit[0], 1);
+    bw.put(pbit[1], 1);
+    bw.put(indices[0], 3);
+    for (int p=1;  p<16;  p++)
+        bw.put(indices[p], 4);
+}
+
+////////////////////////////////////////////////////////////////////////
+static bool compileTexture(const std::string& path, bool forceBC7)
+{
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+        printf("%s: %s\n", path.c_str(), stbi_failure_reason());
+        return false; }
+
+    std::vector<Level> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].rgba.assign(pixels, pixels + size_t(width)*height*4);
+    stbi_image_free(pixels);
+
+    bool hasAlpha = false;
+    for (size_t i=3;  i<levels[0].rgba.size();  i+=4)
+        if (levels[0].rgba[i] != 255) { hasAlpha = true;  break; }
+    uint32_t format = (hasAlpha || forceBC7) ? eRtexBC7 : eRtexBC1;
+
+    uint32_t mipLevels = uint32_t(std::floor(std::log2(std::max(width, height)))) + 1;
+    mipLevels = std::min<uint32_t>(mipLevels, RTEX_MAX_LEVELS);
+    while (levels.size() < mipLevels)
+        levels.push_back(downsample(levels.back()));
+
+    RtexHeader header{};
+    memcpy(header.magic, "RTEX", 4);
+    header.version = RTEX_VERSION;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.mipLevels = mipLevels;
+
+    uint32_t blockBytes = rtexBlockBytes(format);
+    std::vector<uint8_t> data;
+    uint64_t offset = (sizeof(RtexHeader) + 15) & ~uint64_t(15);
+    for (uint32_t l=0;  l<mipLevels;  l++) {
+        const Level& level = levels[l];
+        int bw = (level.width+3)/4, bh = (level.height+3)/4;
+        header.levelOffset[l] = offset;
+        header.levelSize[l] = uint64_t(bw)*bh*blockBytes;
+
+        size_t start = data.size();
+        data.resize(start + header.levelSize[l]);
+        uint8_t block[16][4];
+        for (int by=0;  by<bh;  by++)
+            for (int bx=0;  bx<bw;  bx++) {
+                fetchBlock(level, bx, by, block);
+                uint8_t* dst = &data[start + (size_t(by)*bw + bx)*blockBytes];
+                if (format == eRtexBC1) encodeBC1(block, dst);
+                else                    encodeBC7(block, dst); }
+
+        offset += (header.levelSize[l] + 15) & ~uint64_t(15);
+        data.resize(offset - ((sizeof(RtexHeader) + 15) & ~uint64_t(15))); }
+
+    std::ofstream stream(rtexPath(path), std::ios::binary | std::ios::trunc);
+    std::vector<uint8_t> headerBytes((sizeof(RtexHeader) + 15) & ~size_t(15), 0);
+    memcpy(headerBytes.data(), &header, sizeof(header));
+    stream.write((const char*)headerBytes.data(), headerBytes.size());
+    stream.write((const char*)data.data(), data.size());
+    if (!stream) {
+        printf("%s: write failed\n", rtexPath(path).c_str());
+        return false; }
+
+    printf("%s: %dx%d, %u levels, %s, %zu -> %zu bytes\n", path.c_str(), width, height, mipLevels,
+           format == eRtexBC1 ? "BC1" : "BC7", size_t(width)*height*4*4/3, data.size());
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool force = false, forceBC7 = false;
+    std::vector<std::string> files;
+    for (int i=1;  i<argc;  i++) {
+        if      (!strcmp(argv[i], "-f"))   force = true;
+        else if (!strcmp(argv[i], "-bc7")) forceBC7 = true;
+        else files.push_back(argv[i]); }
+
+    if (files.empty()) {
+        printf("usage: texc [-f] [-bc7] image ...\n");
+        return 1; }
+
+    // Skip images whose compiled texture is already up to date.
+    std::vector<std::string> todo;
+    for (const auto& f : files) {
+        std::error_code ec;
+        if (!force && fs::exists(rtexPath(f))
+            && fs::last_write_time(rtexPath(f), ec) >= fs::last_write_time(f, ec))
+            continue;
+        todo.push_back(f); }
+
+    // Compress files in parallel; each is independent.
+    stbi_set_flip_vertically_on_load(true);  // Match createTextureImages
+    std::atomic<size_t> next{0};
+    std::atomic<int> failures{0};
+    auto worker = [&]() {
+        for (size_t i=next++;  i<todo.size();  i=next++)
+            if (!compileTexture(todo[i], forceBC7))
+                failures++; };
+
+    unsigned int nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    nbThreads = (unsigned int)std::min<size_t>(nbThreads, std::max<size_t>(1, todo.size()));
+    std::vector<std::thread> threads;
+    for (unsigned int i=1;  i<nbThreads;  i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+
+    printf("texc: %zu compiled, %zu up to date, %d failed\n",
+           todo.size() - failures, files.size() - todo.size(), failures.load());
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// The ".rtex" texture container written by the offline texture
+// compiler (texture_compiler.cpp, "make texc") and read by
+// VkApp::createTextureImages.  A header followed by every mip level,
+// largest first, each 16-byte aligned and already in the layout
+// vkCmdCopyBufferToImage expects (tightly packed 4x4 blocks).
+//
+// Pixels are stored bottom row first, matching the
+// stbi_set_flip_vertically_on_load(true) used by the runtime loader.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#define RTEX_VERSION 1
+#define RTEX_MAX_LEVELS 16
+
+enum RtexFormat : uint32_t
+{
+    eRtexBC1  = 1,   // Opaque textures: 8 bytes per 4x4 block  (VK_FORMAT_BC1_RGB_UNORM_BLOCK)
+    eRtexBC7  = 2,   // Textures with alpha: 16 bytes per block (VK_FORMAT_BC7_UNORM_BLOCK)
+};
+
+struct RtexHeader
+{
+    char     magic[4];          // "RTEX"
+    uint32_t version;           // RTEX_VERSION
+    uint32_t format;            // RtexFormat
+    uint32_t width, height;     // Of level 0
+    uint32_t mipLevels;
+    uint64_t levelOffset[RTEX_MAX_LEVELS];  // Byte offset from start of file
+    uint64_t levelSize[RTEX_MAX_LEVELS];
+};
+
+// Block size in bytes of a format;  0 for one this reader does not know.
+inline uint32_t rtexBlockBytes(uint32_t format)
+{
+    return format == eRtexBC1 ? 8 : format == eRtexBC7 ? 16 : 0;
+}
+
+// Checks a header against the file it heads, fileSize bytes in all:
+// the format is known, the mip chain is no longer than a full one, and
+// each level is exactly the size its dimensions call for, 16-byte
+// aligned, after the one before, and inside the file.  Returns what is
+// wrong, or nullptr if nothing is.
+inline const char* rtexCheck(const RtexHeader& h, uint64_t fileSize)
+{
+    uint32_t blockBytes = rtexBlockBytes(h.format);
+    if (blockBytes == 0)
+        return "unknown format";
+    if (h.width == 0 || h.height == 0)
+        return "empty image";
+    uint32_t fullLevels = 1;
+    while ((std::max(h.width, h.height) >> fullLevels) != 0)
+        fullLevels++;
+    if (h.mipLevels == 0 || h.mipLevels > RTEX_MAX_LEVELS || h.mipLevels > fullLevels)
+        return "bad mip level count";
+    
+    uint64_t end = sizeof(RtexHeader);
+    for (uint32_t l=0;  l<h.mipLevels;  l++) {
+        uint64_t w = std::max(1u, h.width >> l), hh = std::max(1u, h.height >> l);
+        if (h.levelSize[l] != ((w+3)/4) * ((hh+3)/4) * blockBytes)
+            return "bad level size";
+        if (h.levelOffset[l] < end || h.levelOffset[l] % 16 != 0
+            || h.levelOffset[l] > fileSize || h.levelSize[l] > fileSize - h.levelOffset[l])
+            return "bad level offset";
+        end = h.levelOffset[l] + h.levelSize[l]; }
+    return nullptr;
+}
+
+// The compiled texture that goes with a source image file.
+inline std::string rtexPath(const std::string& path) { return path + ".rtex"; }
@@ -0,0 +1,149 @@
+//////////////////////////////////////////////////////////////////////
+// CPU-side scoped tracing (see trace.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+std::atomic<bool> g_traceEnabled{false};
+
+namespace {
+
+struct TraceEvent
+{
+    const char* name;
+    uint64_t startNs;
+    uint64_t durNs;
+};
+
+// Written only by its owning thread;  count and next are published
+// with release stores so traceWrite() can walk the list concurrently.
+struct TraceBlock
+{
+    static const uint32_t kSize = 4096;
+    TraceEvent events[kSize];
+    std::atomic<uint32_t> count{0};
+    std::atomic<TraceBlock*> next{nullptr};
+};
+
+struct ThreadBuffer
+{
+    uint32_t tid;
+    std::atomic<const char*> name{nullptr};
+    TraceBlock* head;
+    TraceBlock* tail;   // Owning thread only
+};
+
+const std::chrono::steady_clock::time_point s_epoch = std::chrono::steady_clock::now();
+
+std::mutex s_registryMutex;
+std::vector<ThreadBuffer*> s_registry;   // Never shrinks:  buffers outlive their threads
+
+thread_local ThreadBuffer* t_buffer = nullptr;
+
+ThreadBuffer* threadBuffer()
+{
+    if (t_buffer)
+        return t_buffer;
+
+    ThreadBuffer* buf = new ThreadBuffer;
+    buf->head = buf->tail = new TraceBlock;
+
+    std::lock_guard<std::mutex> lock(s_registryMutex);
+    buf->tid = (uint32_t)s_registry.size() + 1;
+    s_registry.push_back(buf);
+    t_buffer = buf;
+    return buf;
+}
+
+void writeJsonString(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (;  *s;  s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, f); }
+    fputc('"', f);
+}
+
+}  // namespace
+
+void traceEnable(bool enable)
+{
+    if (enable && !t_buffer)
+        traceThreadName("main");   // Whoever turns tracing on is almost surely the main thread
+    g_traceEnabled.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - s_epoch).count();
+}
+
+void traceThreadName(const char* name)
+{
+    threadBuffer()->name.store(name, std::memory_order_release);
+}
+
+void traceRecord(const char* name, uint64_t startNs, uint64_t endNs)
+{
+    ThreadBuffer* buf = threadBuffer();
+    TraceBlock* block = buf->tail;
+    uint32_t n = block->count.load(std::memory_order_relaxed);
+    if (n == TraceBlock::kSize) {
+        TraceBlock* fresh = new TraceBlock;
+        block->next.store(fresh, std::memory_order_release);
+        buf->tail = block = fresh;
+        n = 0; }
+
+    block->events[n] = {name, startNs, endNs - startNs};
+    block->count.store(n+1, std::memory_order_release);
+}
+
+bool traceWrite(const std::string& path)
+{
+    std::vector<ThreadBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        buffers = s_registry;
+    }
+
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        printf("Could not write trace file %s\n", path.c_str());
+        return false; }
+
+    // Complete ("X") events, in microseconds.
+    size_t eventCount = 0;
+    fprintf(f, "{\"traceEvents\":[\n");
+    const char* sep = "";
+    for (ThreadBuffer* buf : buffers) {
+        if (const char* name = buf->name.load(std::memory_order_acquire)) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    sep, buf->tid);
+            writeJsonString(f, name);
+            fprintf(f, "}}");
+            sep = ",\n"; }
+
+        for (TraceBlock* block = buf->head;  block;  block = block->next.load(std::memory_order_acquire)) {
+            uint32_t n = block->count.load(std::memory_order_acquire);
+            for (uint32_t i=0;  i<n;  i++) {
+                const TraceEvent& e = block->events[i];
+                fprintf(f, "%s{\"name\":", sep);
+                writeJsonString(f, e.name);
+                fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                        e.startNs/1000.0, e.durNs/1000.0, buf->tid);
+                sep = ",\n"; }
+            eventCount += n; } }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+
+    printf("Trace: %zu events from %zu threads written to %s\n", eventCount, buffers.size(), path.c_str());
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// CPU-side scoped tracing, exported as Chrome trace_event JSON
+// (load the file in chrome://tracing or https://ui.perfetto.dev).
+//
+//     void VkApp::createDevice()
+//     {
+//         TRACE_FUNCTION();
+//         ...
+//         { TRACE_SCOPE("queues");  ... }
+//
+// Each thread appends complete events to a buffer of its own, a list
+// of fixed size blocks.  Appending never takes a lock;  a block's
+// event count is published with a release store, so traceWrite() can
+// run (say, from a keypress) while other threads are still tracing.
+// A thread's buffer is registered under a mutex the first time it
+// records anything, and lives until exit.
+//
+// Tracing is off until traceEnable(true).  A scope then costs one
+// relaxed load and a branch.  Defining RTRT_NO_TRACE compiles the
+// scopes out altogether.
+//
+// Names are not copied:  pass string literals (or __func__).
+////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+extern std::atomic<bool> g_traceEnabled;
+
+void     traceEnable(bool enable);
+bool     traceWrite(const std::string& path);   // Everything recorded so far, by every thread
+void     traceThreadName(const char* name);     // Label the calling thread in the viewer
+uint64_t traceNow();                            // Nanoseconds since the process started
+void     traceRecord(const char* name, uint64_t startNs, uint64_t endNs);
+
+class TraceScope
+{
+public:
+    TraceScope(const char* _name)
+    {
+        if (g_traceEnabled.load(std::memory_order_relaxed)) {
+            name = _name;
+            start = traceNow(); }
+    }
+    ~TraceScope()
+    {
+        if (name)
+            traceRecord(name, start, traceNow());
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name{nullptr};
+    uint64_t start{0};
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+#ifdef RTRT_NO_TRACE
+#define TRACE_SCOPE(name) do {} while (0)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+#endif
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
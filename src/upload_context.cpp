@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////////////
+// Batched host to device uploads (see upload_context.h).
+////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+#include <cstring>
+
+#include "upload_context.h"
+#include "vkapp.h"
+
+static uint64_t alignUp(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+void UploadContext::init(VkApp* _VK, VkDeviceSize ringSize)
+{
+    VK = _VK;
+    VkResult result;
+
+    VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+        | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolCreateInfo.queueFamilyIndex = VK->m_graphicsQueueIndex;
+    result = vkCreateCommandPool(VK->m_device, &poolCreateInfo, nullptr, &m_cmdPool);
+    assert(result == VK_SUCCESS);
+
+    VkSemaphoreTypeCreateInfo timelineInfo{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    semaphoreInfo.pNext = &timelineInfo;
+    result = vkCreateSemaphore(VK->m_device, &semaphoreInfo, nullptr, &m_timeline);
+    assert(result == VK_SUCCESS);
+
+    m_ringSize = ringSize;
+    m_ring = VK->createBufferWrap(m_ringSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_ringMapped = (uint8_t*)m_ring.alloc.mapped;
+    m_head = m_tail = 0;
+}
+
+void UploadContext::destroy()
+{
+    waitIdle();
+    assert(m_pending.empty());
+
+    if (!m_freeCmds.empty())
+        vkFreeCommandBuffers(VK->m_device, m_cmdPool, (uint32_t)m_freeCmds.size(), m_freeCmds.data());
+    m_freeCmds.clear();
+    vkDestroyCommandPool(VK->m_device, m_cmdPool, nullptr);
+    vkDestroySemaphore(VK->m_device, m_timeline, nullptr);
+    m_ring.destroy(VK->m_device);
+}
+
+VkCommandBuffer UploadContext::cmd()
+{
+    if (m_recording)
+        return m_current.cmd;
+
+    retire();
+    if (m_freeCmds.empty()) {
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.commandPool        = m_cmdPool;
+        allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VkCommandBuffer cmdBuffer;
+        vkAllocateCommandBuffers(VK->m_device, &allocateInfo, &cmdBuffer);
+        m_freeCmds.push_back(cmdBuffer); }
+
+    m_current = Batch();
+    m_current.cmd = m_freeCmds.back();
+    m_freeCmds.pop_back();
+
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(m_current.cmd, &beginInfo);
+    m_recording = true;
+    return m_current.cmd;
+}
+
+StagingSpan UploadContext::stage(VkDeviceSize size, VkDeviceSize alignment)
+{
+    m_bytesStaged += size;
+
+    if (size > m_ringSize) {
+        BufferWrap staging = VK->createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                                  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        cmd();  // The buffer belongs to the batch being recorded
+        m_current.oversize.push_back(staging);
+        return {staging.alloc.mapped, staging.buffer, 0}; }
+
+    for (;;) {
+        cmd();  // Staged bytes belong to the batch being recorded
+
+        // Never straddle the end of the ring:  skip to its start instead.
+        uint64_t start = alignUp(m_head, alignment);
+        if (start % m_ringSize + size > m_ringSize)
+            start = alignUp(start, m_ringSize);
+
+        if (start + size - m_tail <= m_ringSize) {
+            m_head = start + size;
+            return {m_ringMapped + start % m_ringSize, m_ring.buffer, start % m_ringSize}; }
+
+        // Full.  Submit what is recorded, then wait for the oldest batch.
+        retire();
+        if (m_recording)
+            flush();
+        if (!m_pending.empty())
+            wait(m_pending.front().ticket);
+        if (m_pending.empty() && !m_recording)
+            m_head = m_tail = alignUp(m_head, m_ringSize); }  // Empty:  restart at the ring's start
+}
+
+void UploadContext::copyBuffer(const StagingSpan& src, VkBuffer dst,
+                               VkDeviceSize dstOffset, VkDeviceSize size)
+{
+    VkBufferCopy copyRegion{src.offset, dstOffset, size};
+    vkCmdCopyBuffer(cmd(), src.buffer, dst, 1, &copyRegion);
+}
+
+void UploadContext::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset,
+                                 const void* data, VkDeviceSize size)
+{
+    if (size == 0)
+        return;
+    StagingSpan span = stage(size);
+    memcpy(span.mapped, data, size);
+    copyBuffer(span, dst, dstOffset, size);
+}
+
+uint64_t UploadContext::flush()
+{
+    if (!m_recording)
+        return m_lastTicket;
+
+    vkEndCommandBuffer(m_current.cmd);
+    m_current.ticket = ++m_lastTicket;
+    m_current.ringEnd = m_head;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues    = &m_current.ticket;
+
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext                = &timelineInfo;
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &m_current.cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &m_timeline;
+    VkResult result = vkQueueSubmit(VK->m_queue, 1, &submitInfo, VK_NULL_HANDLE);
+    assert(result == VK_SUCCESS);
+
+    m_pending.push_back(std::move(m_current));
+    m_current = Batch();
+    m_recording = false;
+    m_submitCount++;
+    return m_lastTicket;
+}
+
+bool UploadContext::isDone(uint64_t ticket)
+{
+    uint64_t value;
+    vkGetSemaphoreCounterValue(VK->m_device, m_timeline, &value);
+    return value >= ticket;
+}
+
+void UploadContext::wait(uint64_t ticket)
+{
+    assert(ticket <= m_lastTicket);  // Waiting on an unsubmitted batch would never return
+    if (ticket == 0)
+        return;
+
+    VkSemaphoreWaitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores    = &m_timeline;
+    waitInfo.pValues        = &ticket;
+    vkWaitSemaphores(VK->m_device, &waitInfo, UINT64_MAX);
+    retire();
+}
+
+void UploadContext::retire()
+{
+    uint64_t value;
+    vkGetSemaphoreCounterValue(VK->m_device, m_timeline, &value);
+
+    while (!m_pending.empty() && m_pending.front().ticket <= value) {
+        Batch& batch = m_pending.front();
+        m_tail = batch.ringEnd;
+        for (BufferWrap& staging : batch.oversize)
+            staging.destroy(VK->m_device);
+        vkResetCommandBuffer(batch.cmd, 0);
+        m_freeCmds.push_back(batch.cmd);
+        m_pending.pop_front(); }
+
+    // Nothing in flight or being recorded:  the whole ring is free.
+    if (m_pending.empty() && !m_recording)
+        m_tail = m_head;
+}
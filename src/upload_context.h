@@ -0,0 +1,94 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Batched host to device uploads.
+//
+// Data is written into a persistently mapped staging ring, and the
+// copies (plus any barriers a caller records through cmd()) go into
+// the command buffer of the current batch.  flush() submits the batch
+// and returns a ticket, the value the context's timeline semaphore
+// reaches when the batch completes.  Nothing blocks unless wait() is
+// called with a ticket whose result is actually needed.
+//
+// Ring space is reclaimed as batches complete.  When the ring fills,
+// the current batch is submitted and the oldest one waited for.  A
+// request larger than the whole ring gets a staging buffer of its
+// own, released when its batch completes.
+//
+// Work submitted here is ordered before anything submitted later to
+// the same queue, so a later command buffer only needs a pipeline
+// barrier (not a host wait) to consume an upload.
+//
+// Not thread safe:  used from the main thread only.
+////////////////////////////////////////////////////////////////////////
+
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "buffer_wrap.h"
+
+class VkApp;
+
+// Staging memory:  write through mapped, then copy from (buffer, offset).
+struct StagingSpan
+{
+    void*        mapped{nullptr};
+    VkBuffer     buffer{};
+    VkDeviceSize offset{0};
+};
+
+class UploadContext
+{
+public:
+    void init(VkApp* _VK, VkDeviceSize ringSize);
+    void destroy();
+
+    // Staging space for size bytes, good until the batch that reads it
+    // completes.  This may submit the current batch to make room, so
+    // call cmd() after staging, not before.
+    StagingSpan stage(VkDeviceSize size, VkDeviceSize alignment=16);
+
+    // The command buffer of the batch being recorded (begun on demand).
+    VkCommandBuffer cmd();
+
+    // Stage data and queue its copy into dst.
+    void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+    void copyBuffer(const StagingSpan& src, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size);
+
+    uint64_t flush();             // Submit the current batch, if any; returns the latest ticket
+    void wait(uint64_t ticket);   // Block until that batch has completed
+    bool isDone(uint64_t ticket);
+    void waitIdle() { wait(flush()); }
+
+    // For reporting
+    uint32_t     m_submitCount{0};
+    VkDeviceSize m_bytesStaged{0};
+
+private:
+    struct Batch
+    {
+        VkCommandBuffer cmd{};
+        uint64_t ticket{0};
+        uint64_t ringEnd{0};                 // Ring position freed when this batch completes
+        std::vector<BufferWrap> oversize;    // Staging too large for the ring
+    };
+
+    VkApp* VK{nullptr};
+    VkCommandPool m_cmdPool{};
+    VkSemaphore   m_timeline{};
+    uint64_t      m_lastTicket{0};
+
+    BufferWrap    m_ring;
+    uint8_t*      m_ringMapped{nullptr};
+    VkDeviceSize  m_ringSize{0};
+    uint64_t      m_head{0};   // Monotonic positions; the ring offset is position % m_ringSize
+    uint64_t      m_tail{0};   // Oldest byte still in use by a batch
+
+    bool  m_recording{false};
+    Batch m_current;
+    std::deque<Batch> m_pending;            // Submitted, in ticket order
+    std::vector<VkCommandBuffer> m_freeCmds;
+
+    void retire();   // Recycle every completed batch
+};
@@ -15,6 +15,7 @@
 #include "vkapp.h"
 
 #include "app.h"
+#include "startup_graph.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_SWIZZLE
@@ -22,82 +23,186 @@
 
 VkApp::VkApp(App* _app) : app(_app)
 {
+    TRACE_SCOPE("VkApp::VkApp");
 
     // @@ Initialize Light/Camera value
     app->myCamera.reset(glm::vec3(2.28f, 1.68f, 6.64f), 0.7f, -20.0f, 10.66f, 0.57f, 0.1f, 1000.0f);
     nonrtLightAmbient = 0.2f;
     nonrtLightIntensity = 1.0f;
     nonrtLightPosition = vec3(0.5f, 2.5f, 3.0f);
-    
-    createInstance(app->doApiDump);	// -> m_instance
-    assert (m_instance);
-    createPhysicalDevice();		// -> m_physicalDevice i.e. the GPU
-    chooseQueueIndex();		// -> m_graphicsQueueIndex
-    createDevice();			// -> m_device
-    getCommandQueue();		// -> m_queue
-
-    loadExtensions();		// Auto generated; loads namespace of all known extensions
-
-    getSurface();			// -> m_surface
-    createCommandPool();		// -> m_cmdPool
-    
-    createSwapchain();		// -> m_swapchain
-    createDepthResource();		// -> m_depthImage, ...
-    createPostRenderPass();		// -> m_postRenderPass
-    createPostFrameBuffers();	// -> m_framebuffers
-
-    createScBuffer();		// -> m_scImageBuffer
-    createPostDescriptor();		// -> m_postDesc
-    createPostPipeline();		// -> m_postPipelineLayout
-
-    #ifdef GUI
-    initGUI();
-    #endif
-    
-    myloadModel("models/living_room/living_room.obj", glm::mat4(1.0));
-
-    createMatrixBuffer();
-    createObjDescriptionBuffer();
-    
-    createScanlineRenderPass();
-    createScDescriptorSet();
-    createScPipeline();
-
-    // @@ Raycasting ...: Initialize ray tracing capabilities
-    createRtBuffers();
-    initRayTracing();
-    createRtAccelerationStructure();
-    createRtDescriptorSet();
-    createRtPipeline();
-    createRtShaderBindingTable();
-
-    // @@ Denoising: Initialize denoising capabilities
-    createDenoiseBuffer();
-    createDenoiseDescriptorSet();
-    createDenoiseCompPipeline();
 
+    // Startup is a graph of stages (see startup_graph.h).  The CPU-bound
+    // ones go to the job system:  the model is read (scene cache or
+    // assimp) while the device and the swapchain are created, its
+    // textures decode once the device's formats are known, and each
+    // pipeline compiles as soon as its descriptor set layout exists --
+    // the ray tracing pipeline, usually the longest, alongside the model
+    // upload and the acceleration structure build.  Everything recording
+    // into m_upload, or touching the window, stays on this thread.  The
+    // stages share ownership of what they fill in, so nothing dangles
+    // should one throw.
+    auto model = std::make_shared<ModelSource>();
+    auto textures = std::make_shared<std::vector<DecodedTexture>>();
+    const StartupGraph::Affinity pool = StartupGraph::eAnyThread;
+    StartupGraph graph;
+
+    graph.add("read model", {}, [model]() {
+        readModel("models/living_room/living_room.obj", *model); }, pool);
+    graph.add("instance", {}, [this]() {
+        createInstance(app->doApiDump);	// -> m_instance
+        assert (m_instance); });
+    graph.add("device", {"instance"}, [this]() {
+        createPhysicalDevice();		// -> m_physicalDevice i.e. the GPU
+        chooseQueueIndex();		// -> m_graphicsQueueIndex
+        createDevice();			// -> m_device
+        chooseRenderTargetFormats();	// -> m_rtFormats
+        getCommandQueue();		// -> m_queue
+        loadExtensions(); });		// Auto generated; loads namespace of all known extensions
+    graph.add("decode textures", {"read model", "device"}, [this, model, textures]() {
+        *textures = decodeTextures(*model->textures); }, pool);
+    graph.add("pipeline cache", {"device"}, [this]() {
+        m_pipelineCache.init(this, "pipeline_cache.bin"); }, pool);	// -> m_pipelineCache.m_cache
+    graph.add("descriptor layouts", {"device", "read model"}, [this, model]() {
+        createRtDescriptorSet();	// -> m_rtDesc, unwritten
+        createScDescriptorSet((uint32_t)model->textures->size()); }, pool);  // -> m_scDesc, unwritten
+    graph.add("ray tracing pipeline", {"descriptor layouts", "pipeline cache"},
+              [this]() { createRtPipeline(); }, pool);
+
+    graph.add("surface", {"instance", "device"}, [this]() {
+        if (!app->headless)
+            getSurface(); });		// -> m_surface;  checks present support on m_graphicsQueueIndex
+    graph.add("command pool", {"device"}, [this]() {
+        createCommandPool();		// -> m_cmdPool
+        m_upload.init(this, 64<<20); });	// -> staging ring;  destroy with m_upload.destroy()
+    graph.add("swapchain", {"surface", "command pool"}, [this]() {
+        if (app->headless)
+            createOffscreenTargets();	// -> m_offscreenTargets, standing in for a swapchain
+        else
+            createSwapchain();		// -> m_swapchain
+        createFrameResources();		// -> m_frames
+        createDepthResource();		// -> m_depthImage, ...
+        createPostRenderPass();		// -> m_postRenderPass
+        createPostFrameBuffers(); });	// -> m_framebuffers
+    graph.add("render targets", {"swapchain"}, [this]() {
+        createScBuffer();		// -> m_scImageBuffer
+        createScanlineRenderPass();	// -> m_scanlineRenderPass, m_scanlineFramebuffer
+        createPostDescriptor();		// -> m_postDesc
+        createRtBuffers();		// -> m_rtColBuffer, ...
+        createDenoiseBuffer();		// -> m_denoiseBuffer
+        createDenoiseDescriptorSet(); });	// -> m_denoiseDesc
+    graph.add("scanline pipeline", {"render targets", "descriptor layouts", "pipeline cache"},
+              [this]() { createScPipeline(); }, pool);
+    graph.add("post pipeline", {"render targets", "pipeline cache"},
+              [this]() { createPostPipeline(); }, pool);
+    graph.add("denoise pipelines", {"render targets", "pipeline cache"},
+              [this]() { createDenoiseCompPipeline(); }, pool);
+    graph.add("gui", {"swapchain", "pipeline cache"}, [this]() {
+        #ifdef GUI
+        if (!app->headless)
+            initGUI();
+        #endif
+        });
+
+    graph.add("upload model", {"decode textures", "command pool", "swapchain"}, [this, model, textures]() {
+        uploadModel(*model, *textures, glm::mat4(1.0));
+        createMatrixBuffer();		// One per frame in flight:  needs m_framesInFlight
+        createObjDescriptionBuffer(); });
+    graph.add("acceleration structures", {"upload model"}, [this]() {
+        initRayTracing();
+        createRtAccelerationStructure(); });
+    graph.add("write descriptor sets", {"acceleration structures", "render targets", "descriptor layouts"},
+              [this]() {
+        writeScDescriptorSet();
+        writeRtDescriptorSet(); });
+    graph.add("shader binding table", {"ray tracing pipeline", "acceleration structures"},
+              [this]() { createRtShaderBindingTable(); });	// Needs m_rtPipeline, and handleSize from initRayTracing
+
+    graph.run();
+    graph.printTimeline();
+
+    // Setup queued its uploads without waiting;  wait once, here.
+    m_upload.waitIdle();
+    printf("Uploads: %d submits, %.1f MB staged\n",
+           m_upload.m_submitCount, m_upload.m_bytesStaged/1048576.0);
 }
 
 void VkApp::drawFrame()
 {
-
-    prepareFrame();
+    TRACE_FUNCTION();
+
+    // An out of date swap chain gave no image to draw into, so there is
+    // nothing to record or submit this time round.  The UI frame begun
+    // for it still has to be closed.
+    if (!prepareFrame()) {
+        #ifdef GUI
+        if (!app->headless)
+            ImGui::EndFrame();
+        #endif
+        return; }
     
     VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
     {   // Extra indent for code clarity
-        updateCameraBuffer();
+        m_profiler.beginFrame(m_commandBuffer, m_frameIndex);
+        
+        // The render targets are shared by all frames in flight, so
+        // order this frame's accesses to each after the previous
+        // frame's, at the stages that make them.  The history images:
+        // written by the ray tracer, and read by it (as Prev), by
+        // denoise's compute shader, and by its copy when it does not
+        // filter.
+        imageAccessBarrier(m_commandBuffer,
+                           {m_rtColBuffer[0].image, m_rtColBuffer[1].image,
+                            m_rtKdBuffer[0].image, m_rtKdBuffer[1].image,
+                            m_rtNdBuffer[0].image, m_rtNdBuffer[1].image},
+                           VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                           | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_ACCESS_SHADER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                           VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+        // The display images:  written by denoise (filter or copy) or
+        // the rasterizer, and read by denoise and postProcess.
+        imageAccessBarrier(m_commandBuffer, {m_scImageBuffer.image, m_denoiseBuffer.image},
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+                           | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+                           | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                           VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+                           | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+                           | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                           VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+                           | VK_ACCESS_TRANSFER_WRITE_BIT
+                           | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+        // The depth buffer, which both render passes clear:  its old
+        // contents are not needed, only its last writes finished.
+        imageAccessBarrier(m_commandBuffer, {m_depthImage.image},
+                           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                           VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+                           | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                           VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                           VK_IMAGE_ASPECT_DEPTH_BIT);
+        
+        {   GpuZone zone(m_profiler, m_commandBuffer, "updateCameraBuffer");
+            updateCameraBuffer(); }
         
         // Draw scene
         if (useRaytracer) {
-            raytrace();
-            denoise(); 
+            {   GpuZone zone(m_profiler, m_commandBuffer, "raytrace");
+                raytrace(); }
+            {   GpuZone zone(m_profiler, m_commandBuffer, "denoise");
+                denoise(); }
         }
-        else
-            rasterize();
+        else {
+            GpuZone zone(m_profiler, m_commandBuffer, "rasterize");
+            rasterize(); }
+        
+        {   GpuZone zone(m_profiler, m_commandBuffer, "postProcess");
+            postProcess(); } //  tone mapper and output to swapchain image.
         
-        postProcess(); //  tone mapper and output to swapchain image.
+        m_profiler.endFrame(m_commandBuffer);
         
     }   // Done recording;  Execute!
     
@@ -105,6 +210,49 @@ void VkApp::drawFrame()
     submitFrame();  // Submit for display
 }
 
+void VkApp::createFrameResources()
+{
+    TRACE_FUNCTION();
+    // ImGui keeps one set of vertex buffers per swapchain image, which
+    // also bounds how many frames may be in flight.
+    m_framesInFlight = std::min<uint32_t>(std::max(1, app->framesInFlight), m_imageCount);
+    printf("Frames in flight: %d\n", m_framesInFlight);
+    
+    m_frames.resize(m_framesInFlight);
+    for (FrameData& frame : m_frames) {
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandPool        = m_cmdPool;
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VkResult result = vkAllocateCommandBuffers(m_device, &allocateInfo, &frame.cmd);
+        assert(result == VK_SUCCESS);
+        // Nothing to destroy -- the pool owns the command buffer.
+
+        // Created signaled, so the first wait on each frame returns at once.
+        VkFenceCreateInfo fenceCreateInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+        fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        vkCreateFence(m_device, &fenceCreateInfo, nullptr, &frame.fence);
+
+        VkSemaphoreCreateInfo semCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+        vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &frame.acquired); }
+    m_frameIndex = 0;
+    m_commandBuffer = m_frames[0].cmd;
+
+    // GPU timestamps, one set per frame in flight.
+    m_profiler.init(this, m_framesInFlight);
+    if (!app->csvPath.empty())
+        m_profiler.openCsv(app->csvPath);
+    // To destroy: destroyFrameResources();
+}
+
+void VkApp::destroyFrameResources()
+{
+    for (FrameData& frame : m_frames) {
+        vkDestroyFence(m_device, frame.fence, nullptr);
+        vkDestroySemaphore(m_device, frame.acquired, nullptr); }
+    m_frames.clear();
+    m_profiler.destroy();
+}
 
 VkCommandBuffer VkApp::createTempCmdBuffer()
 {
@@ -133,24 +281,83 @@ void VkApp::submitTempCmdBuffer(VkCommandBuffer cmdBuffer)
     vkFreeCommandBuffers(m_device, m_cmdPool, 1, &cmdBuffer);
 }
 
-void VkApp::prepareFrame()
+bool VkApp::prepareFrame()
 {
-    // Use a fence to wait until the command buffer has finished execution before using it again
-    while (VK_TIMEOUT == vkWaitForFences(m_device, 1, &m_waitFence, VK_TRUE, 1'000'000))
-    {}
+    TRACE_FUNCTION();
+    // Uploads queued since the last frame go to the queue ahead of it.
+    m_upload.flush();
+
+    FrameData& frame = m_frames[m_frameIndex];
+    m_commandBuffer = frame.cmd;
+    
+    // Wait until the GPU is done with this frame's command buffer, the
+    // one submitted m_framesInFlight frames ago.  This blocks in the
+    // driver rather than spinning.
+    double waitStart = app->time();
+    vkWaitForFences(m_device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+    m_profiler.collect(m_frameIndex);  // Its timestamps are ready now
+
+    // Headless, the offscreen targets are used in turn.  There are at
+    // least as many as frames in flight, so the one m_imageCount frames
+    // back is done with (its frame's fence has been waited on).
+    if (app->headless) {
+        m_swapchainIndex = (m_swapchainIndex + 1) % m_imageCount;
+        m_frameWaitMs = 1000.0*(app->time() - waitStart);
+        updateFrameStats();
+        return true; }
 
     // Acquire the next image from the swap chain --> m_swapchainIndex
-    VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_readSemaphore,
+    VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, frame.acquired,
                                             (VkFence)VK_NULL_HANDLE, &m_swapchainIndex);
+    m_frameWaitMs = 1000.0*(app->time() - waitStart);
 
-    // Check if window has been resized -- or other(??) swapchain specific event
+    // Check if window has been resized -- or other(??) swapchain specific event.
+    // Out of date, no image was acquired and frame.acquired will never be
+    // signaled:  skip the frame.  Suboptimal, the image is still usable.
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-        recreateSizedResources(windowSize); }
+        recreateSizedResources(windowSize);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+            return false; }
+
+    updateFrameStats();
+    return true;
+}
+
+// Folds this frame's numbers into m_frameStats.  The GPU time is that
+// of the frame last recorded into this slot, which has just completed.
+void VkApp::updateFrameStats()
+{
+    double now = app->time();
+    float frameMs = m_lastFrameTime > 0 ? float(1000.0*(now - m_lastFrameTime)) : 0.0f;
+    m_lastFrameTime = now;
+
+    float gpuMs = m_profiler.lastMs("frame");
+
+    const float a = 0.05f;  // Exponential smoothing
+    FrameStats& s = m_frameStats;
+    s.frameMs += a*(frameMs - s.frameMs);
+    s.waitMs  += a*(float(m_frameWaitMs) - s.waitMs);
+    s.cpuMs   += a*(frameMs - float(m_frameWaitMs) - s.cpuMs);
+    s.gpuMs   += a*(gpuMs - s.gpuMs);
 }
 
 void VkApp::submitFrame()
 {
-    vkResetFences(m_device, 1, &m_waitFence);
+    TRACE_FUNCTION();
+    FrameData& frame = m_frames[m_frameIndex];
+    vkResetFences(m_device, 1, &frame.fence);
+
+    // Headless:  nothing to wait for, nothing to present.
+    if (app->headless) {
+        VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers    = &m_commandBuffer;
+        if (vkQueueSubmit(m_queue, 1, &submitInfo, frame.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit draw command buffer!"); }
+        m_frameIndex = (m_frameIndex + 1) % m_framesInFlight;
+        return; }
+
+    VkSemaphore presentSemaphore = m_presentSemaphores[m_swapchainIndex];
 
     // Pipeline stage at which the queue submission will wait (via pWaitSemaphores)
     const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
@@ -160,32 +367,35 @@ void VkApp::submitFrame()
     _si_.pNext             = nullptr;
     _si_.pWaitDstStageMask = &waitStageMask; //  pipeline stages to wait for
     _si_.waitSemaphoreCount   = 1;  
-    _si_.pWaitSemaphores = &m_readSemaphore;  // waited upon before execution
+    _si_.pWaitSemaphores = &frame.acquired;  // waited upon before execution
     _si_.signalSemaphoreCount = 1;
-    _si_.pSignalSemaphores    = &m_writtenSemaphore; // signaled when execution finishes
+    _si_.pSignalSemaphores    = &presentSemaphore; // signaled when execution finishes
     _si_.commandBufferCount = 1;
     _si_.pCommandBuffers = &m_commandBuffer;
-    if (vkQueueSubmit(m_queue, 1, &_si_, m_waitFence) != VK_SUCCESS) {
+    if (vkQueueSubmit(m_queue, 1, &_si_, frame.fence) != VK_SUCCESS) {
         throw std::runtime_error("failed to submit draw command buffer!"); }
     
     // Present frame
     VkPresentInfoKHR _i_{VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
     _i_.waitSemaphoreCount = 1;
-    _i_.pWaitSemaphores    = &m_writtenSemaphore;;
+    _i_.pWaitSemaphores    = &presentSemaphore;
     _i_.swapchainCount     = 1;
     _i_.pSwapchains        = &m_swapchain;
     _i_.pImageIndices      = &m_swapchainIndex;
     if (vkQueuePresentKHR(m_queue, &_i_) != VK_SUCCESS) {
         throw std::runtime_error("failed to present swap chain image!"); }
+
+    // On to the next frame's resources
+    m_frameIndex = (m_frameIndex + 1) % m_framesInFlight;
 }
 
 
-VkShaderModule VkApp::createShaderModule(std::string code)
+VkShaderModule VkApp::createShaderModule(const FileView& code)
 {
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType                    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.codeSize                 = code.size();
-    createInfo.pCode                    = (uint32_t*) code.data();
+    createInfo.pCode                    = code.as<uint32_t>();  // FileView data is aligned
 
     VkShaderModule shaderModule = VK_NULL_HANDLE;
     if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
@@ -194,7 +404,7 @@ VkShaderModule VkApp::createShaderModule(std::string code)
     return shaderModule;
 }
 
-VkPipelineShaderStageCreateInfo VkApp::createShaderStageInfo(const std::string&    code,
+VkPipelineShaderStageCreateInfo VkApp::createShaderStageInfo(const FileView&       code,
                                                                    VkShaderStageFlagBits stage,
                                                                    const char* entryPoint)
 {
@@ -208,6 +418,7 @@ VkPipelineShaderStageCreateInfo VkApp::createShaderStageInfo(const std::string&
 #ifdef GUI
 void VkApp::initGUI()
 {
+    TRACE_FUNCTION();
     uint subpassID = 0;
     
     // UI
@@ -230,7 +441,7 @@ void VkApp::initGUI()
     init_info.Device                    = m_device;
     init_info.QueueFamily               = m_graphicsQueueIndex;
     init_info.Queue                     = m_queue;
-    init_info.PipelineCache             = VK_NULL_HANDLE;
+    init_info.PipelineCache             = m_pipelineCache.m_cache;
     init_info.DescriptorPool            = m_imguiDescPool;
     init_info.Subpass                   = subpassID;
     init_info.MinImageCount             = 2;
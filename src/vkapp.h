@@ -2,6 +2,7 @@
 #pragma once
 
 #include <algorithm>
+#include <random>
 #include "vulkan/vulkan_core.h"
 //#include <vulkan/vulkan.hpp>  // A modern C++ API for Vulkan. Beware 14K lines of code
 
@@ -28,7 +29,14 @@
 #include "buffer_wrap.h"
 #include "image_wrap.h"
 #include "descriptor_wrap.h"
+#include "gpu_profiler.h"
+#include "trace.h"
 #include "acceleration_wrap.h"
+#include "upload_context.h"
+#include "pipeline_cache.h"
+#include "file_view.h"
+#include "scene_cache.h"
+#include "image_io.h"
 
 //#include "raytracing_wrap.h"
 #define GLM_FORCE_CTOR_INIT  // May be needed by recent versions of GLM;
@@ -47,6 +55,7 @@ struct ObjData
     BufferWrap indexBuffer;     // Buffer of triangle indices
     BufferWrap matColorBuffer;  // Buffer of materials
     BufferWrap matIndexBuffer;  // Buffer of each triangle's material index
+    BufferWrap emitterIndexBuffer;  // Buffer of each triangle's emitter index, or -1
 };
 
 #define NAME(handle, objType, name)  { \
@@ -59,6 +68,37 @@ struct ObjData
         vkSetDebugUtilsObjectNameEXT(m_device, &imageNameInfo); }
 
 
+// A texture read into memory by VkApp::decodeTextures, ready for
+// createTextureImages:  either stb_image's RGBA8 level 0, or a view
+// of a compiled .rtex file with its whole mip chain.
+struct DecodedTexture
+{
+    int width{0}, height{0};
+    uint32_t mipLevels{0};
+    VkFormat format{VK_FORMAT_UNDEFINED};
+    unsigned char* pixels{nullptr};  // From stbi_load;  freed by createTextureImages
+    FileView rtex;
+    VkDeviceSize size{0};            // Bytes of texel data to upload
+};
+
+// A model read into memory by VkApp::readModel, ready for uploadModel.
+// The arrays point into either the memory-mapped scene cache or, after
+// an assimp import, meshdata and emitters.
+struct ModelSource
+{
+    SceneCache cache;
+    ModelData meshdata;
+    std::vector<Emitter> emitters;
+
+    const Vertex*   vertices{nullptr};
+    const uint32_t* indices{nullptr};
+    const Material* materials{nullptr};
+    const int32_t*  matIndx{nullptr};
+    const Emitter*  emitterData{nullptr};
+    size_t nbVertices{0}, nbIndices{0}, nbMaterials{0}, nbMatIndx{0}, nbEmitters{0};
+    const std::vector<std::string>* textures{nullptr};
+};
+
 // Pair each instance with its instance transform
 struct ObjInst
 {
@@ -99,8 +139,8 @@ public:
     void recreateSizedResources(VkExtent2D size);
     VkCommandBuffer createTempCmdBuffer();
     void submitTempCmdBuffer(VkCommandBuffer cmdBuffer);
-    VkShaderModule createShaderModule(std::string code);
-    VkPipelineShaderStageCreateInfo createShaderStageInfo(const std::string&    code,
+    VkShaderModule createShaderModule(const FileView& code);  // SPIR-V, used in place
+    VkPipelineShaderStageCreateInfo createShaderStageInfo(const FileView&       code,
                                                           VkShaderStageFlagBits stage,
                                                           const char* entryPoint = "main");
                             
@@ -115,8 +155,13 @@ public:
     void chooseQueueIndex();
 
     VkDevice m_device{};
+    bool m_textureCompressionBC{false};  // BC1..BC7 formats usable (for compiled .rtex textures)
+    bool m_memoryBudget{false};          // VK_EXT_memory_budget enabled
     void createDevice();
 
+    // All buffer and image memory comes from here (see memory_allocator.h)
+    MemoryAllocator m_allocator;
+
     VkQueue m_queue{};
     void getCommandQueue();
     
@@ -126,21 +171,60 @@ public:
     void getSurface();
     
     VkCommandPool m_cmdPool{VK_NULL_HANDLE};
-    VkCommandBuffer m_commandBuffer{};
     void createCommandPool();
 
+    // Frames in flight:  the CPU records one frame while the GPU still
+    // executes earlier ones.  Each frame has its own command buffer,
+    // fence and acquire semaphore;  m_commandBuffer is the current one's.
+    struct FrameData
+    {
+        VkCommandBuffer cmd{};
+        VkFence         fence{};             // Signaled when the GPU is done with the frame
+        VkSemaphore     acquired{};          // Signaled when its swapchain image is available
+    };
+    uint32_t m_framesInFlight{2};
+    std::vector<FrameData> m_frames;
+    uint32_t m_frameIndex{0};
+    VkCommandBuffer m_commandBuffer{};
+    void createFrameResources();
+    void destroyFrameResources();
+
+    // Smoothed per-frame timings for the GUI
+    struct FrameStats
+    {
+        float frameMs{0};    // Wall time between frames
+        float cpuMs{0};      // frameMs less the time blocked on the GPU
+        float waitMs{0};     // Blocked on a frame fence or image acquire
+        float gpuMs{0};      // The profiler's "frame" zone
+    } m_frameStats;
+    double m_lastFrameTime{0};
+    double m_frameWaitMs{0};
+    void updateFrameStats();
+
+    // Per pass GPU times (see gpu_profiler.h)
+    GpuProfiler m_profiler;
+
+    // Buffer/image uploads, batched into a few submits (see upload_context.h)
+    UploadContext m_upload;
+
+    // Every pipeline is created through this, and it persists (see pipeline_cache.h)
+    PipelineCache m_pipelineCache;
+
     VkSwapchainKHR m_swapchain{VK_NULL_HANDLE};
     uint32_t       m_imageCount{0};
     std::vector<VkImage>     m_swapchainImages{};  // from vkGetSwapchainImagesKHR
     std::vector<VkImageView> m_imageViews{};
     std::vector<VkImageMemoryBarrier> m_barriers{};  // Filled in  VkImageMemoryBarrier objects
-    VkFence m_waitFence{}; 
-    VkSemaphore m_readSemaphore{};
-    VkSemaphore m_writtenSemaphore{};
+    std::vector<VkSemaphore> m_presentSemaphores;  // Per swapchain image:  rendering done, ok to present
     VkExtent2D windowSize{0, 0}; // Size of the window
     void createSwapchain();
     void destroySwapchain();
 
+    // Headless (App::headless):  post pass targets in place of a swapchain
+    std::vector<ImageWrap> m_offscreenTargets;
+    void createOffscreenTargets();
+    void destroyOffscreenTargets();
+
     ImageWrap m_depthImage;
     void createDepthResource();
     
@@ -169,14 +253,34 @@ public:
     void destroyRaytracingResources();
     void destroyDenoiseResources();
     
-    ImageWrap m_rtColCurrBuffer{}; 
-    ImageWrap m_rtColPrevBuffer{};
-    
-    ImageWrap m_rtKdCurrBuffer{};
-    ImageWrap m_rtKdPrevBuffer{};
+    // Render target formats, per buffer.  The defaults cut the
+    // G-buffer and display traffic roughly in half;  -fp32 makes every
+    // float target RGBA32F, as a reference.  The accumulated color
+    // stays RGBA32F either way:  With a 16 bit float, (C-ave)/N drops
+    // below half an ulp of the average after a few hundred samples and
+    // the running average stops converging.
+    struct RenderTargetFormats {
+        VkFormat color;    // m_rtColBuffer:  running average, sample count in .w
+        VkFormat kd;       // m_rtKdBuffer
+        VkFormat nd;       // m_rtNdBuffer:  always RG32UI (see packNd in shared_structs.h)
+        VkFormat display;  // m_denoiseBuffer and m_scImageBuffer (the scanline pass's target)
+    };
+    RenderTargetFormats m_rtFormats{};
+    void chooseRenderTargetFormats();
+
+    // Copy an image to a FloatImage, or to a PFM or PNG file (see image_io.h)
+    FloatImage readImage(ImageWrap& image, VkImageLayout layout=VK_IMAGE_LAYOUT_GENERAL);
+    void saveImage(ImageWrap& image, const std::string& path,
+                   VkImageLayout layout=VK_IMAGE_LAYOUT_GENERAL);
     
-    ImageWrap m_rtNdCurrBuffer{};
-    ImageWrap m_rtNdPrevBuffer{};
+    // History pairs:  the ray tracer writes [m_historyIndex] (Curr)
+    // and reads [1-m_historyIndex] (Prev).  The index flips every
+    // frame, so nothing needs copying from Curr to Prev.  Descriptor
+    // set i of m_rtDesc and m_denoiseDesc binds the pairs for index i.
+    ImageWrap m_rtColBuffer[2]{};
+    ImageWrap m_rtKdBuffer[2]{};
+    ImageWrap m_rtNdBuffer[2]{};
+    uint32_t m_historyIndex{0};
     
     void createRtBuffers();
     
@@ -194,24 +298,31 @@ public:
     std::vector<ImageWrap>  m_objText{}; // All textures of the scene
     std::vector<ObjInst>  m_objInst{}; // Instances paring an object and a transform
     BufferWrap m_lightBuff{};          // Buffer of light list
+    BufferWrap m_lightTreeBuff{};      // The light tree over it (see light_sampling.h)
     std::vector<Emitter> emitterList;
-    void myloadModel(const std::string& filename, glm::mat4 transform);
+    void myloadModel(const std::string& filename, glm::mat4 transform);  // readModel, decodeTextures, uploadModel
+    static void readModel(const std::string& filename, ModelSource& model);  // CPU only
+    void uploadModel(const ModelSource& model, std::vector<DecodedTexture>& textures, glm::mat4 transform);
 
     BufferWrap m_objDescriptionBW{};  // Device buffer of the OBJ descriptions
     void createObjDescriptionBuffer();
 
     DescriptorWrap m_scDesc{};
-    void createScDescriptorSet();
+    uint32_t m_scDescTextures{0};  // Size of its texture array
+    void createScDescriptorSet(uint32_t nbTxt);  // Layout and set;  written by writeScDescriptorSet
+    void writeScDescriptorSet();
 
     VkPipelineLayout            m_scanlinePipelineLayout{};
     VkPipeline                  m_scanlinePipeline{};
     void createScPipeline();
 
-    BufferWrap m_matrixBW{};  // Device-Host of the camera matrices
+    BufferWrap m_matrixBW{};  // Device-Host of the camera matrices, one slice per frame in flight
+    VkDeviceSize m_matrixStride{0};  // Bytes between slices (a dynamic uniform buffer offset)
     void   createMatrixBuffer();
     
     float m_maxAnis = 0;
     PushConstantRay m_pcRay{};  // Push constant for ray tracer
+    std::mt19937 m_rng{1};      // Frame seeds;  fixed seed, for reproducible runs
     int m_num_atrous_iterations = 5;
     PushConstantDenoise m_pcDenoise{};
     uint32_t handleSize{};
@@ -230,7 +341,8 @@ public:
 
     // Raytrace descriptor set objects and functions
     DescriptorWrap m_rtDesc{};
-    void createRtDescriptorSet();
+    void createRtDescriptorSet();  // Layout and sets;  written by writeRtDescriptorSet
+    void writeRtDescriptorSet();
 
     VkPipelineLayout m_rtPipelineLayout{};
     VkPipeline       m_rtPipeline{};
@@ -250,7 +362,9 @@ public:
     void createDenoiseDescriptorSet();
     
     VkPipelineLayout m_denoiseCompPipelineLayout{};
-    VkPipeline       m_denoisePipeline{};
+    VkPipeline       m_denoisePipeline{};        // Tiled, shared memory kernel
+    VkPipeline       m_denoiseSimplePipeline{};  // One pixel per invocation
+    bool             m_denoiseTiled = true;
     void createDenoiseCompPipeline();
 
     void CmdCopyImage(ImageWrap& src, ImageWrap& dst);
@@ -260,9 +374,19 @@ public:
                             VkImageLayout oldImageLayout,
                             VkImageLayout newImageLayout,
                             VkImageAspectFlags aspectMask=VK_IMAGE_ASPECT_COLOR_BIT);
+    // Orders images' srcAccessMask accesses in srcStageMask before their
+    // dstAccessMask accesses in dstStageMask;  they stay in
+    // VK_IMAGE_LAYOUT_GENERAL unless told otherwise.
+    void imageAccessBarrier(VkCommandBuffer cmdbuffer,
+                            const std::vector<VkImage>& images,
+                            VkPipelineStageFlags srcStageMask, VkAccessFlags srcAccessMask,
+                            VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask,
+                            VkImageLayout oldImageLayout=VK_IMAGE_LAYOUT_GENERAL,
+                            VkImageLayout newImageLayout=VK_IMAGE_LAYOUT_GENERAL,
+                            VkImageAspectFlags aspectMask=VK_IMAGE_ASPECT_COLOR_BIT);
     // Run loop 
     bool useRaytracer = true;
-    void prepareFrame();
+    bool prepareFrame();  // False: skip this frame
     void ResetRtAccumulation();
     
     glm::mat4 m_priorViewProj{};
@@ -270,25 +394,25 @@ public:
     void rasterize();
     void raytrace();
     void denoise();
+    VkDescriptorSet denoiseSet(int a, int n);
     
     uint32_t m_swapchainIndex{0};
     
     void postProcess();
     void submitFrame();
     
-    std::string loadFile(const std::string& filename);
+    FileView loadFile(const std::string& filename);
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     
-    BufferWrap createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
-                                      const VkDeviceSize&    size,
+    // The copy is queued on m_upload; flush it (and barrier) before use.
+    BufferWrap createStagedBufferWrap(const VkDeviceSize&    size,
                                       const void*            data,
                                       VkBufferUsageFlags     usage);
     template <typename T>
-    BufferWrap createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
-                                      const std::vector<T>&  data,
+    BufferWrap createStagedBufferWrap(const std::vector<T>&  data,
                                       VkBufferUsageFlags     usage)
     {
-        return createStagedBufferWrap(cmdBuf, sizeof(T)*data.size(), data.data(), usage);
+        return createStagedBufferWrap(sizeof(T)*data.size(), data.data(), usage);
     }
     
 
@@ -304,7 +428,10 @@ public:
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
     
     ImageWrap createTextureImage(std::string fileName);
-    ImageWrap createBufferImage(VkExtent2D& size);
+    std::vector<ImageWrap> createTextureImages(const std::vector<std::string>& fileNames);
+    std::vector<DecodedTexture> decodeTextures(const std::vector<std::string>& fileNames);  // CPU only
+    std::vector<ImageWrap> createTextureImages(std::vector<DecodedTexture>& decoded);
+    ImageWrap createBufferImage(VkExtent2D& size, VkFormat format);
     
     ImageWrap createImageWrap(uint32_t width, uint32_t height,
                               VkFormat format,
@@ -313,9 +440,12 @@ public:
                               uint32_t mipLevels=1);
 
     VkImageView createImageView(VkImage image, VkFormat format,
-                                VkImageAspectFlagBits aspect=VK_IMAGE_ASPECT_COLOR_BIT);
+                                VkImageAspectFlagBits aspect=VK_IMAGE_ASPECT_COLOR_BIT,
+                                uint32_t mipLevels=1);
     VkSampler createTextureSampler();
     
     void generateMipmaps(VkImage image, VkFormat imageFormat,
                          int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
+    void recordMipmaps(VkCommandBuffer commandBuffer, VkImage image,
+                       int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
 };
@@ -15,36 +15,62 @@ using namespace glm;
 #include "app.h"
 #include "shaders/shared_structs.h"
 
-#define GROUP_SIZE 128
+#define GROUP_SIZE 128  // denoiseSimple.comp:  One row of pixels per workgroup
+#define TILE_SIZE 16     // denoise.comp:  TILE_SIZE x TILE_SIZE pixels per workgroup
 
 
 void VkApp::createDenoiseBuffer()
 {
-    m_denoiseBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_denoiseBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    TRACE_FUNCTION();
+    m_denoiseBuffer = createBufferImage(windowSize, m_rtFormats.display);
+    transitionImageLayout(m_denoiseBuffer.image, m_rtFormats.display,
                           VK_IMAGE_LAYOUT_UNDEFINED,
                           VK_IMAGE_LAYOUT_GENERAL, 1);
     // @@ destroy m_denoiseBuffer
 }
 
+// The filter ping-pongs between m_denoiseBuffer and m_scImageBuffer
+// (which postProcess samples), so each iteration needs its own
+// pairing of input and output images.  The first iteration reads the
+// ray tracer's color output directly.  Four pairings per history
+// index, each with that index's Kd and Nd buffers.  See denoiseSet().
 void VkApp::createDenoiseDescriptorSet()
 {
+    TRACE_FUNCTION();
     m_denoiseDesc.setBindings(m_device, {
             {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
             {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
             {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
             {3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
-        });
-
-    m_denoiseDesc.write(m_device, 0, m_scImageBuffer.Descriptor());   // The input image
-    m_denoiseDesc.write(m_device, 1, m_denoiseBuffer.Descriptor());   // The output image
-    m_denoiseDesc.write(m_device, 2, m_rtKdCurrBuffer.Descriptor());  // The color buffer
-    m_denoiseDesc.write(m_device, 3, m_rtNdCurrBuffer.Descriptor());  // The normal:depth buffer
+        }, 2*4);
+
+    for (int h=0;  h<2;  h++) {
+        ImageWrap* pairs[4][2] = {   // {input, output}
+            {&m_rtColBuffer[h], &m_scImageBuffer},
+            {&m_rtColBuffer[h], &m_denoiseBuffer},
+            {&m_scImageBuffer,  &m_denoiseBuffer},
+            {&m_denoiseBuffer,  &m_scImageBuffer} };
+        for (int k=0;  k<4;  k++) {
+            int set = 4*h + k;
+            m_denoiseDesc.write(m_device, 0, pairs[k][0]->Descriptor(), set); // The input image
+            m_denoiseDesc.write(m_device, 1, pairs[k][1]->Descriptor(), set); // The output image
+            m_denoiseDesc.write(m_device, 2, m_rtKdBuffer[h].Descriptor(), set);  // The color buffer
+            m_denoiseDesc.write(m_device, 3, m_rtNdBuffer[h].Descriptor(), set); } } // The normal:depth buffer
     // @@ destroy m_denoiseDesc
 }
 
+// The descriptor set for iteration a of n:  Outputs alternate so that
+// the last iteration lands in m_scImageBuffer.
+VkDescriptorSet VkApp::denoiseSet(int a, int n)
+{
+    bool toSc = (n-1-a) % 2 == 0;
+    int k = (a == 0) ? (toSc ? 0 : 1) : (toSc ? 3 : 2);
+    return m_denoiseDesc.descSets[4*m_historyIndex + k];
+}
+
 void VkApp::createDenoiseCompPipeline()
 {
+    TRACE_FUNCTION();
     // pushing time
     VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise)};
     VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
@@ -59,11 +85,23 @@ void VkApp::createDenoiseCompPipeline()
 
     cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/denoise.comp.spv"),
                                                VK_SHADER_STAGE_COMPUTE_BIT);
-    vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_denoisePipeline);
+    PipelineCache::Feedback feedback(m_pipelineCache, "denoise");
+    cpCreateInfo.pNext = feedback.chain();
+    vkCreateComputePipelines(m_device, m_pipelineCache.m_cache, 1, &cpCreateInfo, nullptr, &m_denoisePipeline);
+    feedback.report();
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    // The untiled kernel, same layout, for comparison
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/denoiseSimple.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    PipelineCache::Feedback feedbackSimple(m_pipelineCache, "denoiseSimple");
+    cpCreateInfo.pNext = feedbackSimple.chain();
+    vkCreateComputePipelines(m_device, m_pipelineCache.m_cache, 1, &cpCreateInfo, nullptr, &m_denoiseSimplePipeline);
+    feedbackSimple.report();
     vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
 
     // @@ destroy m_denoiseCompPipelineLayout
-    // @@ destroy m_denoisePipeline
+    // @@ destroy m_denoisePipeline and m_denoiseSimplePipeline
 }
 
 void VkApp::denoise()
@@ -71,54 +109,81 @@ void VkApp::denoise()
     m_pcDenoise.normFactor = 0.003;
     m_pcDenoise.depthFactor = 0.007;
 
-    // Wait for RT to finish
-    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-    VkImageMemoryBarrier    imgMemBarrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-    imgMemBarrier.srcAccessMask    = VK_ACCESS_SHADER_WRITE_BIT;
-    imgMemBarrier.dstAccessMask    = VK_ACCESS_SHADER_READ_BIT;
-    imgMemBarrier.image            = m_scImageBuffer.image;
-    imgMemBarrier.oldLayout        = VK_IMAGE_LAYOUT_GENERAL;
-    imgMemBarrier.newLayout        = VK_IMAGE_LAYOUT_GENERAL;
-    imgMemBarrier.subresourceRange = range;
-
-    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &imgMemBarrier);
+    // No filtering:  Just hand the ray traced image to postProcess,
+    // once RT has finished writing it, and its fragment shader the copy.
+    if (m_num_atrous_iterations <= 0) {
+        imageAccessBarrier(m_commandBuffer, {m_rtColBuffer[m_historyIndex].image},
+                           VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        CmdCopyImage(m_rtColBuffer[m_historyIndex], m_scImageBuffer);
+        imageAccessBarrier(m_commandBuffer, {m_scImageBuffer.image},
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        return; }
+
+    // Wait for RT to finish writing the Col, Kd and Nd images
+    imageAccessBarrier(m_commandBuffer,
+                       {m_rtColBuffer[m_historyIndex].image, m_rtKdBuffer[m_historyIndex].image,
+                        m_rtNdBuffer[m_historyIndex].image},
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+    // Select the compute shader (the same for every iteration)
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      m_denoiseTiled ? m_denoisePipeline : m_denoiseSimplePipeline);
 
     int stepwidth = 1;
     for (int a=0; a<m_num_atrous_iterations; a++) {
 
-        // Tell the A-Trous algorithm its "hole" size
-        m_pcDenoise.stepwidth = stepwidth;
+        // Tell the A-Trous algorithm its "hole" size, and precompute
+        // the per-stepwidth weight scales.
+        int s = stepwidth;
+        m_pcDenoise.stepwidth = s;
+        m_pcDenoise.normScale = m_pcDenoise.normFactor == 0.0f ? 0.0f
+            : 1.0f/(s*s*m_pcDenoise.normFactor);
+        m_pcDenoise.depthScale = m_pcDenoise.depthFactor == 0.0f ? 0.0f
+            : 1.0f/m_pcDenoise.depthFactor;
         stepwidth *= 2;
 
-        // Select the compute shader, and its descriptor set and push constant
-        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
+        GpuZone zone(m_profiler, m_commandBuffer, "atrous " + std::to_string(a));
+
+        // Select this iteration's input/output pairing, and the push constant
+        VkDescriptorSet descSet = denoiseSet(a, m_num_atrous_iterations);
         vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
                                 m_denoiseCompPipelineLayout, 0, 1,
-                                &m_denoiseDesc.descSet, 0, nullptr);
+                                &descSet, 0, nullptr);
         vkCmdPushConstants(m_commandBuffer, m_denoiseCompPipelineLayout,
                            VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise),
                            &m_pcDenoise);
 
-        // Dispatch the shader in batches of 128x1 (WHY???)
-        // This MUST match the shaders's line:
-        //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
-        vkCmdDispatch(m_commandBuffer,
-                      (windowSize.width + GROUP_SIZE-1) / GROUP_SIZE,
-                      windowSize.height, 1);
-
-        // Wait until denoise shader is done writing to m_denoiseBuffer
-        imgMemBarrier.image = m_denoiseBuffer.image;
+        if (m_denoiseTiled) {
+            // Each workgroup covers a TILE_SIZE x TILE_SIZE grid of
+            // pixels s apart, so a (TILE_SIZE*s)^2 square of pixels
+            // takes s x s workgroups.  This MUST match the shaders's
+            //    layout(local_size_x=TILE, local_size_y=TILE, local_size_z=1) in;
+            uint32_t span = TILE_SIZE*s;
+            vkCmdDispatch(m_commandBuffer,
+                          (windowSize.width + span-1) / span * s,
+                          (windowSize.height + span-1) / span * s, 1); }
+        else {
+            // Dispatch the shader in batches of 128x1
+            // This MUST match the shaders's line:
+            //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
+            vkCmdDispatch(m_commandBuffer,
+                          (windowSize.width + GROUP_SIZE-1) / GROUP_SIZE,
+                          windowSize.height, 1); }
+
+        // The next iteration reads this one's output, and overwrites
+        // this one's input.  The last output goes to postProcess's
+        // fragment shader instead.
+        bool last = a == m_num_atrous_iterations-1;
+        VkMemoryBarrier memBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        memBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+            | (last ? 0 : VK_ACCESS_SHADER_WRITE_BIT);
         vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                             VK_DEPENDENCY_DEVICE_GROUP_BIT,
-                             0, nullptr, 0, nullptr, 1, &imgMemBarrier);
-
-        // @@ Copy the denoised results (in m_denoiseBuffer) back to
-        // the input buffer (m_scImageBuffer) for the next denoising
-        // loop pass.  See VkApp::raytrace for 4 examples of using
-        // VkApp::CmdCopyImage to copy an image.
-        CmdCopyImage(m_denoiseBuffer, m_scImageBuffer);
+                             last ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+                                  : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &memBarrier, 0, nullptr, 0, nullptr);
     }
 }
@@ -4,12 +4,15 @@
 #include <iostream>     // std::cout
 #include <fstream>      // std::ifstream
 
+#include <cstring>
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
 
 #include "vkapp.h"
 #include "app.h"
+#include "image_io.h"
+#include <glm/gtc/packing.hpp>  // unpackHalf1x16
 #include "extensions_vk.hpp"
 
 #ifdef GUI
@@ -21,6 +24,7 @@
 
 void VkApp::destroyAllVulkanResources()
 {
+    TRACE_FUNCTION();
 
     // @@
     vkDeviceWaitIdle(m_device);  // Uncomment this when you have an m_device created.
@@ -30,12 +34,14 @@ void VkApp::destroyAllVulkanResources()
 
     // Desrtoy ImGui stuff
     #ifdef GUI
-    vkDestroyDescriptorPool(m_device, m_imguiDescPool, nullptr);
-    ImGui_ImplVulkan_Shutdown();
+    if (!app->headless) {
+        vkDestroyDescriptorPool(m_device, m_imguiDescPool, nullptr);
+        ImGui_ImplVulkan_Shutdown(); }
     #endif
 
     vkDestroyPipelineLayout(m_device, m_denoiseCompPipelineLayout, nullptr);
     vkDestroyPipeline(m_device, m_denoisePipeline, nullptr);
+    vkDestroyPipeline(m_device, m_denoiseSimplePipeline, nullptr);
     m_denoiseDesc.destroy(m_device);
     m_denoiseBuffer.destroy(m_device);
 
@@ -47,12 +53,10 @@ void VkApp::destroyAllVulkanResources()
     m_rtDesc.destroy(m_device);
     m_rtBuilder.destroy();
 
-    m_rtNdPrevBuffer.destroy(m_device);
-    m_rtNdCurrBuffer.destroy(m_device);
-    m_rtKdPrevBuffer.destroy(m_device);
-    m_rtKdCurrBuffer.destroy(m_device);
-    m_rtColPrevBuffer.destroy(m_device);
-    m_rtColCurrBuffer.destroy(m_device);
+    for (int i=0;  i<2;  i++) {
+        m_rtNdBuffer[i].destroy(m_device);
+        m_rtKdBuffer[i].destroy(m_device);
+        m_rtColBuffer[i].destroy(m_device); }
 
     // Destroy Pipeline
     vkDestroyPipelineLayout(m_device, m_scanlinePipelineLayout, nullptr);
@@ -70,6 +74,7 @@ void VkApp::destroyAllVulkanResources()
 
     //Destroy Texture/Model Data
     m_lightBuff.destroy(m_device);
+    m_lightTreeBuff.destroy(m_device);
 
     for (ImageWrap& t : m_objText)
         t.destroy(m_device);
@@ -80,6 +85,7 @@ void VkApp::destroyAllVulkanResources()
         ob.indexBuffer.destroy(m_device);
         ob.matColorBuffer.destroy(m_device);
         ob.matIndexBuffer.destroy(m_device);
+        ob.emitterIndexBuffer.destroy(m_device);
     }
 
     // Destroy Post-Pipeline
@@ -96,10 +102,18 @@ void VkApp::destroyAllVulkanResources()
     }
     vkDestroyRenderPass(m_device, m_postRenderPass, nullptr);
     m_depthImage.destroy(m_device);
-    destroySwapchain();
+    if (app->headless)
+        destroyOffscreenTargets();
+    else
+        destroySwapchain();
+    destroyFrameResources();
     vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
     vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
 
+    m_upload.destroy();
+    m_pipelineCache.destroy();  // Saves it for the next run
+    m_allocator.printStats();
+    m_allocator.destroy();
     vkDestroyDevice(m_device, nullptr);
     vkDestroyInstance(m_instance, nullptr);
 }
@@ -113,8 +127,12 @@ void VkApp::recreateSizedResources(VkExtent2D size)
  
 void VkApp::createInstance(bool doApiDump)
 {
+    TRACE_FUNCTION();
+    // Headless there is no GLFW, and no surface extensions are needed.
     uint32_t countGLFWextensions{0};
-    const char** reqGLFWextensions = glfwGetRequiredInstanceExtensions(&countGLFWextensions);
+    const char** reqGLFWextensions = nullptr;
+    if (!app->headless)
+        reqGLFWextensions = glfwGetRequiredInstanceExtensions(&countGLFWextensions);
 
     // @@
     // Append each GLFW required extension in reqGLFWextensions to reqInstanceExtensions
@@ -150,6 +168,18 @@ void VkApp::createInstance(bool doApiDump)
     std::cout << "\n";
     // ...  use availableLayers[i].layerName
 
+    // Render farm and CI machines often lack the validation layers;
+    // run without them rather than fail to create the instance.
+    for (auto layer = reqInstanceLayers.begin();  layer != reqInstanceLayers.end(); ) {
+        bool found = false;
+        for (const VkLayerProperties& available : availableLayers)
+            found = found || strcmp(available.layerName, *layer) == 0;
+        if (found)
+            ++layer;
+        else {
+            printf("Layer %s is not available;  continuing without it\n", *layer);
+            layer = reqInstanceLayers.erase(layer); } }
+
     // Another two step dance
     vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
     std::vector<VkExtensionProperties> availableExtensions(count);
@@ -189,8 +219,45 @@ void VkApp::createInstance(bool doApiDump)
     assert(result == VK_SUCCESS);
 }
 
+// Device preference when several are suitable:  discrete first, CPU
+// implementations (such as lavapipe) last.  Zero means unsuitable.
+static int deviceTypeRank(VkPhysicalDeviceType type)
+{
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   return 4;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 3;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    return 2;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:            return 1;
+    default:                                     return 0; }
+}
+
+// The features createDevice relies on, beyond the required extensions.
+static bool hasRequiredFeatures(VkPhysicalDevice physicalDevice)
+{
+    VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeature{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR};
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR, &rtPipelineFeature};
+    VkPhysicalDeviceVulkan12Features features12{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES, &accelFeature};
+    VkPhysicalDeviceFeatures2 features2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, &features12};
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+    return rtPipelineFeature.rayTracingPipeline && accelFeature.accelerationStructure
+        && features12.bufferDeviceAddress
+        && features2.features.shaderStorageImageReadWithoutFormat
+        && features2.features.shaderStorageImageWriteWithoutFormat;
+}
+
 void VkApp::createPhysicalDevice()
 {
+    TRACE_FUNCTION();
+    // Headless, nothing is presented.
+    if (app->headless)
+        reqDeviceExtensions.erase(std::remove(reqDeviceExtensions.begin(), reqDeviceExtensions.end(),
+                                              std::string(VK_KHR_SWAPCHAIN_EXTENSION_NAME)),
+                                  reqDeviceExtensions.end());
+
     // Get the GPU list;  Another two-step list retrieval procedure:
     uint physicalDevicesCount;
     vkEnumeratePhysicalDevices(m_instance, &physicalDevicesCount, nullptr);
@@ -201,6 +268,7 @@ void VkApp::createPhysicalDevice()
   
     printf("%d devices\n", physicalDevicesCount);
     int i = 0;
+    int bestRank = 0;
 
     // For each GPU:
     for (auto physicalDevice : physicalDevices) {
@@ -232,7 +300,10 @@ void VkApp::createPhysicalDevice()
         //      That is: for all i, there exists a j such that:
         //                 reqDeviceExtensions[i] == extensionProperties[j].extensionName
 
-        bool isGPUTypeCompatible = (GPUproperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU);
+        // Integrated and CPU devices are accepted too, if they have
+        // everything needed;  see deviceTypeRank.
+        int typeRank = deviceTypeRank(GPUproperties.deviceType);
+        bool isGPUTypeCompatible = typeRank > 0;
         bool isExtensionCompatible = true;
 
         std::set<std::string> deviceExtensions;
@@ -249,17 +320,17 @@ void VkApp::createPhysicalDevice()
             }
         }
 
-        //  If a GPU is found to be compatible save it in m_physicalDevice.
-        if (isGPUTypeCompatible && isExtensionCompatible)
-            m_physicalDevice = physicalDevice;
+        bool isFeatureCompatible = isExtensionCompatible && hasRequiredFeatures(physicalDevice);
 
-        //  If none are found, declare failure and abort
-        //     (And then find a better GPU for this class.)
-        //assert(isGPUTypeCompatible || isExtensionCompatible);
+        //  If a GPU is found to be compatible save it in m_physicalDevice,
+        //  unless an earlier one is of a preferred type.
+        if (isGPUTypeCompatible && isFeatureCompatible && typeRank > bestRank) {
+            m_physicalDevice = physicalDevice;
+            bestRank = typeRank; }
 
         //  If several are found, tell me all about your system
-        if (isGPUTypeCompatible || isExtensionCompatible)
-            std::cout << GPUproperties.deviceName << "\n";
+        std::cout << GPUproperties.deviceName
+                  << (isGPUTypeCompatible && isFeatureCompatible ? "" : "  (unsuitable)") << "\n";
 
         // Hint: Instead of a double nested pair of loops consider
         // making an std::unordered_set of all the device's
@@ -267,6 +338,10 @@ void VkApp::createPhysicalDevice()
         // each required extension.
     }
     std::cout << "\n";
+
+    //  If none are found, declare failure and abort
+    if (m_physicalDevice == VK_NULL_HANDLE)
+        throw std::runtime_error("No device supports the required ray tracing extensions and features!");
     
     // @@ Document the GPU accepted, and any GPUs rejected.
     // Oddly, there is nothing to destroy here.
@@ -275,6 +350,7 @@ void VkApp::createPhysicalDevice()
 
 void VkApp::chooseQueueIndex()
 {
+    TRACE_FUNCTION();
     VkQueueFlags requiredQueueFlags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT
                                       | VK_QUEUE_TRANSFER_BIT;
 
@@ -311,6 +387,7 @@ void VkApp::chooseQueueIndex()
 
 void VkApp::createDevice()
 {
+    TRACE_FUNCTION();
     // @@
     // Build a pNext chain of the following six "feature" structures:
     //   features2->features11->features12->features13->accelFeature->rtPipelineFeature->NULL
@@ -349,6 +426,13 @@ void VkApp::createDevice()
 
     // Let Vulkan fill in all structures on the pNext chain
     vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features2);
+    m_textureCompressionBC = features2.features.textureCompressionBC;
+
+    // The ray tracing and denoise shaders declare their float storage
+    // images without a format (see VkApp::RenderTargetFormats).
+    if (!features2.features.shaderStorageImageReadWithoutFormat
+        || !features2.features.shaderStorageImageWriteWithoutFormat)
+        throw std::runtime_error("Device cannot access storage images without a format!");
 
     float priority = 1.0;
     VkDeviceQueueCreateInfo queueInfo{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
@@ -362,8 +446,20 @@ void VkApp::createDevice()
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pQueueCreateInfos    = &queueInfo;
     
-    deviceCreateInfo.enabledExtensionCount   = static_cast<uint32_t>(reqDeviceExtensions.size());
-    deviceCreateInfo.ppEnabledExtensionNames = reqDeviceExtensions.data();
+    // VK_EXT_memory_budget is optional; with it the allocator can
+    // report how much of each heap the whole process is using.
+    std::vector<const char*> deviceExtensions = reqDeviceExtensions;
+    uint32_t extCount;
+    vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extCount, nullptr);
+    std::vector<VkExtensionProperties> extensionProperties(extCount);
+    vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extCount, extensionProperties.data());
+    for (auto& ext : extensionProperties)
+        if (strcmp(ext.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            m_memoryBudget = true; }
+    
+    deviceCreateInfo.enabledExtensionCount   = static_cast<uint32_t>(deviceExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
     VkResult result = vkCreateDevice(m_physicalDevice, &deviceCreateInfo, nullptr, &m_device);
     
@@ -371,10 +467,29 @@ void VkApp::createDevice()
     // Verify VK_SUCCESS
     // To destroy: vkDestroyDevice(m_device, nullptr);
     assert(result == VK_SUCCESS);
+
+    // To destroy: m_allocator.destroy();
+    m_allocator.init(m_physicalDevice, m_device, m_memoryBudget);
+}
+
+// See VkApp::RenderTargetFormats.  Every format here is one Vulkan
+// requires support for as a storage image, so nothing is queried.
+void VkApp::chooseRenderTargetFormats()
+{
+    TRACE_FUNCTION();
+    m_rtFormats.color = VK_FORMAT_R32G32B32A32_SFLOAT;
+    m_rtFormats.nd    = VK_FORMAT_R32G32_UINT;
+    if (app->fp32) {
+        m_rtFormats.kd      = VK_FORMAT_R32G32B32A32_SFLOAT;
+        m_rtFormats.display = VK_FORMAT_R32G32B32A32_SFLOAT; }
+    else {
+        m_rtFormats.kd      = VK_FORMAT_R8G8B8A8_UNORM;
+        m_rtFormats.display = VK_FORMAT_R16G16B16A16_SFLOAT; }
 }
 
 void VkApp::getCommandQueue()
 {
+    TRACE_FUNCTION();
     vkGetDeviceQueue(m_device, m_graphicsQueueIndex, 0, &m_queue);
     // Returns void -- nothing to verify
     // Nothing to destroy -- the queue is owned by the device.
@@ -386,6 +501,7 @@ void VkApp::getCommandQueue()
 // extension.  This be (indistinguishable from) magic.
 void VkApp::loadExtensions()
 {
+    TRACE_FUNCTION();
     load_VK_EXTENSIONS(m_instance, vkGetInstanceProcAddr, m_device, vkGetDeviceProcAddr);
 }
 
@@ -393,6 +509,7 @@ void VkApp::loadExtensions()
 //  manages the window, it creates the VkSurface at our request.
 void VkApp::getSurface()
 {
+    TRACE_FUNCTION();
     VkBool32 isSupported;   // Supports drawing(presenting) on a screen
 
     VkResult glfwCreateResult = glfwCreateWindowSurface(m_instance, app->GLFW_window, nullptr, &m_surface);
@@ -414,6 +531,7 @@ void VkApp::getSurface()
 // Use the command pool to also create a command buffer.
 void VkApp::createCommandPool()
 {
+    TRACE_FUNCTION();
     VkResult result;
 
     VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
@@ -424,22 +542,14 @@ void VkApp::createCommandPool()
     // To destroy: vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
     // destroy in destroyAllVulkanResources()
     assert(result == VK_SUCCESS);
-    
 
-    // Create a command buffer
-    VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
-    allocateInfo.commandPool        = m_cmdPool;
-    allocateInfo.commandBufferCount = 1;
-    allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    result = vkAllocateCommandBuffers(m_device, &allocateInfo, &m_commandBuffer);
-    // @@ Verify VK_SUCCESS
-    // Nothing to destroy -- the pool owns the command buffer.
-    assert(result == VK_SUCCESS);
+    // The per-frame command buffers are allocated in createFrameResources.
 }
  
 // 
 void VkApp::createSwapchain()
 {
+    TRACE_FUNCTION();
     VkResult       err;
     VkSwapchainKHR oldSwapchain = m_swapchain;
 
@@ -631,19 +741,14 @@ void VkApp::createSwapchain()
                          nullptr, m_imageCount, m_barriers.data());
     submitTempCmdBuffer(cmd);
 
-    // Create the three synchronization objects.  These are not
-    // technically part of the swap chain, but they are used
-    // exclusively for synchronizing the swap chain, so I include them
-    // here.
-    VkFenceCreateInfo fenceCreateInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    vkCreateFence(m_device, &fenceCreateInfo, nullptr, &m_waitFence);
-    
+    // One "rendering done" semaphore per swapchain image:  presentation
+    // of an image may still hold its semaphore when a later frame is
+    // submitted, so these cannot be per frame in flight.  (The fences
+    // and acquire semaphores are per frame; see createFrameResources.)
     VkSemaphoreCreateInfo semCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
-    vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &m_readSemaphore);
-    vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &m_writtenSemaphore);
-    //NAME(m_readSemaphore, VK_OBJECT_TYPE_SEMAPHORE, "m_readSemaphore");
-    //NAME(m_writtenSemaphore, VK_OBJECT_TYPE_SEMAPHORE, "m_writtenSemaphore");
+    m_presentSemaphores.resize(m_imageCount);
+    for (VkSemaphore& semaphore : m_presentSemaphores)
+        vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &semaphore);
     //NAME(m_queue, VK_OBJECT_TYPE_QUEUE, "m_queue");
         
     windowSize = swapchainExtent;
@@ -662,9 +767,9 @@ void VkApp::destroySwapchain()
     }
 
     // Destroy the synchronization items: 
-    vkDestroyFence(m_device, m_waitFence, nullptr);
-    vkDestroySemaphore(m_device, m_readSemaphore, nullptr);
-    vkDestroySemaphore(m_device, m_writtenSemaphore, nullptr);
+    for (VkSemaphore semaphore : m_presentSemaphores)
+        vkDestroySemaphore(m_device, semaphore, nullptr);
+    m_presentSemaphores.clear();
 
     // Destroy the actual swapchain with: vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
     vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
@@ -674,10 +779,41 @@ void VkApp::destroySwapchain()
     m_barriers.clear();
 }
 
+// Headless, the post pass renders into these instead of swapchain
+// images.  They fill in m_swapchainImages and m_imageViews, so the
+// framebuffers and frames in flight work just as with a swapchain.
+void VkApp::createOffscreenTargets()
+{
+    TRACE_FUNCTION();
+    windowSize = VkExtent2D{uint32_t(app->headlessWidth), uint32_t(app->headlessHeight)};
+    m_imageCount = 3;
+
+    m_offscreenTargets.resize(m_imageCount);
+    for (ImageWrap& target : m_offscreenTargets) {
+        target = createImageWrap(windowSize.width, windowSize.height, VK_FORMAT_B8G8R8A8_UNORM,
+                                 VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        target.imageView = createImageView(target.image, VK_FORMAT_B8G8R8A8_UNORM);
+        m_swapchainImages.push_back(target.image);
+        m_imageViews.push_back(target.imageView); }
+    // To destroy:  destroyOffscreenTargets();
+}
+
+void VkApp::destroyOffscreenTargets()
+{
+    vkDeviceWaitIdle(m_device);
+    for (ImageWrap& target : m_offscreenTargets)
+        target.destroy(m_device);  // Also destroys its view
+    m_offscreenTargets.clear();
+    m_swapchainImages.clear();
+    m_imageViews.clear();
+}
+
 
 
 void VkApp::createDepthResource() 
 {
+    TRACE_FUNCTION();
     uint mipLevels = 1;
 
     // Note m_depthImage is type ImageWrap; a tiny wrapper around
@@ -746,27 +882,28 @@ ImageWrap VkApp::createImageWrap(uint32_t width, uint32_t height,
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(m_device, myImage.image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    // Render targets and storage images get memory of their own;
+    // textures are sub-allocated.
+    VkImageUsageFlags targetUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+        | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    myImage.alloc = m_allocator.allocate(memRequirements, properties,
+                                         (usage & targetUsage) ? eMemDedicated : eMemImage);
 
     VkResult result;
-    result = vkAllocateMemory(m_device, &allocInfo, nullptr, &myImage.memory);
-    // @@ Verify success for vkCreateImage
-    assert(result == VK_SUCCESS);
-    
-    result = vkBindImageMemory(m_device, myImage.image, myImage.memory, 0);
-    // @@ Verify success for vkAllocateMemory
+    result = vkBindImageMemory(m_device, myImage.image, myImage.alloc.memory, myImage.alloc.offset);
+    // @@ Verify success for vkBindImageMemory
     assert(result == VK_SUCCESS);
 
     myImage.imageView = VK_NULL_HANDLE;
     myImage.sampler = VK_NULL_HANDLE;
+    myImage.format = format;
 
     return myImage;
 }
 
 VkImageView VkApp::createImageView(VkImage image, VkFormat format,
-                                         VkImageAspectFlagBits aspect)
+                                         VkImageAspectFlagBits aspect,
+                                         uint32_t mipLevels)
 {
     VkImageViewCreateInfo viewInfo{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
     viewInfo.image = image;
@@ -774,7 +911,7 @@ VkImageView VkApp::createImageView(VkImage image, VkFormat format,
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspect;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
     
@@ -788,11 +925,13 @@ VkImageView VkApp::createImageView(VkImage image, VkFormat format,
 
 void VkApp::createPostRenderPass()
 {  
+    TRACE_FUNCTION();
     std::array<VkAttachmentDescription, 2> attachments{};
     // Color attachment
     attachments[0].format      = VK_FORMAT_B8G8R8A8_UNORM;
     attachments[0].loadOp      = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[0].finalLayout = app->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL  // For saveImage
+                                               : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     attachments[0].samples     = VK_SAMPLE_COUNT_1_BIT;
 
     // Depth attachment
@@ -839,6 +978,7 @@ void VkApp::createPostRenderPass()
 // usually a color buffer and a depth buffer.
 void VkApp::createPostFrameBuffers()
 {
+    TRACE_FUNCTION();
     std::array<VkImageView, 2> fbattachments{};
     
     // Create frame buffers for every swap chain image
@@ -869,6 +1009,7 @@ void VkApp::createPostFrameBuffers()
 
 void VkApp::createPostPipeline()
 {
+    TRACE_FUNCTION();
 
     // Creating the pipeline layout
     VkPipelineLayoutCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
@@ -997,8 +1138,11 @@ void VkApp::createPostPipeline()
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+    PipelineCache::Feedback feedback(m_pipelineCache, "post");
+    pipelineInfo.pNext = feedback.chain();
+    vkCreateGraphicsPipelines(m_device, m_pipelineCache.m_cache, 1, &pipelineInfo, nullptr,
                               &m_postPipeline);
+    feedback.report();
 
     // The pipeline has fully compiled copies of the shaders, so these
     // intermediate (SPV) versions can be destroyed.
@@ -1014,19 +1158,14 @@ void VkApp::createPostPipeline()
 
 }
 
-std::string VkApp::loadFile(const std::string& filename)
+// Shaders are used in place from the view (mapped if possible), with
+// no copy.  A missing file comes back empty, and fails module creation.
+FileView VkApp::loadFile(const std::string& filename)
 {
-    std::string   result;
-    std::ifstream stream(filename, std::ios::ate | std::ios::binary);  //ate: Open at file end
-
-    if(!stream.is_open())
-        return result;
-
-    result.reserve(stream.tellg()); // tellg() is last char position in file (i.e.,  length)
-    stream.seekg(0, std::ios::beg);
-
-    result.assign((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
-    return result;
+    FileView file(filename);
+    if (!file.isOpen())
+        printf("Could not read %s\n", filename.c_str());
+    return file;
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -1059,9 +1198,59 @@ void VkApp::postProcess()
         vkCmdDraw(m_commandBuffer, 3, 1, 0, 0);
 
         #ifdef GUI
-        ImGui::Render();  // Rendering UI
-        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), m_commandBuffer);
+        if (!app->headless) {
+            ImGui::Render();  // Rendering UI
+            ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), m_commandBuffer); }
         #endif
     }
     vkCmdEndRenderPass(m_commandBuffer);
 }
+
+// Read an RGBA32F, RGBA16F or 8 bit RGBA/BGRA image back from the GPU,
+// keeping its RGB.  Waits for the device to go idle;  for use at exit.
+FloatImage VkApp::readImage(ImageWrap& image, VkImageLayout layout)
+{
+    assert(image.format == VK_FORMAT_R32G32B32A32_SFLOAT
+           || image.format == VK_FORMAT_R16G16B16A16_SFLOAT
+           || image.format == VK_FORMAT_R8G8B8A8_UNORM
+           || image.format == VK_FORMAT_B8G8R8A8_UNORM);
+    bool half = image.format == VK_FORMAT_R16G16B16A16_SFLOAT;
+    bool unorm = image.format == VK_FORMAT_R8G8B8A8_UNORM || image.format == VK_FORMAT_B8G8R8A8_UNORM;
+    bool bgr = image.format == VK_FORMAT_B8G8R8A8_UNORM;
+    uint32_t width = windowSize.width, height = windowSize.height;
+    VkDeviceSize size = VkDeviceSize(width)*height*(unorm ? 4 : half ? 8 : 16);
+
+    vkDeviceWaitIdle(m_device);
+    BufferWrap readback = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                           | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {width, height, 1};
+    vkCmdCopyImageToBuffer(m_upload.cmd(), image.image, layout, readback.buffer, 1, &region);
+    m_upload.waitIdle();
+
+    FloatImage pfm;
+    pfm.width = width;
+    pfm.height = height;
+    pfm.rgb.resize(size_t(width)*height*3);
+    for (size_t i=0;  i<size_t(width)*height;  i++)
+        for (int c=0;  c<3;  c++)
+            pfm.rgb[3*i+c] = unorm
+                ? ((uint8_t*)readback.alloc.mapped)[4*i + (bgr ? 2-c : c)]/255.0f
+                : half
+                ? glm::unpackHalf1x16(((uint16_t*)readback.alloc.mapped)[4*i+c])
+                : ((float*)readback.alloc.mapped)[4*i+c];
+    readback.destroy(m_device);
+    return pfm;
+}
+
+// readImage, written to a PFM or PNG file (see writeImage).
+void VkApp::saveImage(ImageWrap& image, const std::string& path, VkImageLayout layout)
+{
+    FloatImage pfm = readImage(image, layout);
+    if (writeImage(path, pfm))
+        printf("Saved %s (%dx%d)\n", path.c_str(), pfm.width, pfm.height);
+}
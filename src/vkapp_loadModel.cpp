@@ -8,6 +8,7 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <chrono>
 #include <math.h>
 
 #include <filesystem>
@@ -29,26 +30,27 @@ using namespace glm;
 #include "stb_image.h"
 
 #include "app.h"
+#include "scene_cache.h"
+#include "mesh_flatten.h"
+#include "light_sampling.h"
 #include "shaders/shared_structs.h"
 
-// Local objects and procedures defined and used here:
-struct ModelData
-{
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    std::vector<Material> materials;
-    std::vector<int32_t>     matIndx;
-    std::vector<std::string> textures;
+// The assimp import flags.  These are part of the scene cache key, so
+// changing them invalidates any cached scene.
+static const uint32_t assimpImportFlags = aiProcess_Triangulate|aiProcess_GenSmoothNormals;
 
-    void readAssimpFile(const std::string& path, const mat4& M);
-};
+// Local objects and procedures defined and used here:
 
-void recurseModelNodes(ModelData* meshdata,
+void recurseModelNodes(std::vector<MeshInstance>& instances,
+                       size_t& nbVertices,
+                       size_t& nbTriangles,
                        const  aiScene* aiscene,
                        const  aiNode* node,
                        const aiMatrix4x4& parentTr,
                        const int level=0);
 
+std::vector<Emitter> buildEmitterList(const ModelData& meshdata);
+
 
 // Returns an address (as VkDeviceAddress=uint64_t) of a buffer on the GPU.
 VkDeviceAddress getBufferDeviceAddress(VkDevice device, VkBuffer buffer) {
@@ -59,99 +61,162 @@ VkDeviceAddress getBufferDeviceAddress(VkDevice device, VkBuffer buffer) {
 
 void VkApp::myloadModel(const std::string& filename, glm::mat4 transform)
 {
-    ModelData meshdata;
-    meshdata.readAssimpFile(filename.c_str(), glm::mat4());
-
-    printf("vertices: %zd\n", meshdata.vertices.size());
-    printf("indices: %zd (%zd)\n", meshdata.indices.size(), meshdata.indices.size()/3);
-    printf("materials: %zd\n", meshdata.materials.size());
-    printf("matIndx: %zd\n", meshdata.matIndx.size());
-    printf("textures: %zd\n", meshdata.textures.size());
+    TRACE_FUNCTION();
+    ModelSource model;
+    readModel(filename, model);
+    std::vector<DecodedTexture> textures = decodeTextures(*model.textures);
+    uploadModel(model, textures, transform);
+}
 
+// Reads a model into memory:  from its scene cache if that is up to
+// date, else with assimp (writing the cache for next time).  Touches no
+// Vulkan object, so it can run on the job system while the device is
+// being created.
+void VkApp::readModel(const std::string& filename, ModelSource& model)
+{
+    TRACE_FUNCTION();
+    auto loadStart = std::chrono::high_resolution_clock::now();
+    
+    // The SANM build adds geometry to the loaded model, so it gets its own cache.
 #ifdef SANM
+    const std::string cacheVariant = "SANM";
 #else
+    const std::string cacheVariant = "";
 #endif
-                
+    uint64_t cacheKey = SceneCache::sourceKey(filename, assimpImportFlags, cacheVariant);
+    std::string cacheFile = SceneCache::cachePath(filename);
+
+    // Either the cache supplies the flattened model (pointing into a
+    // memory mapping of the cache file), or assimp builds it in meshdata.
+    SceneCache& cache = model.cache;
+    ModelData& meshdata = model.meshdata;
+    std::vector<Emitter>& emitters = model.emitters;
+
+    if (cache.open(cacheFile, cacheKey)) {
+        model.vertices    = cache.vertices;     model.nbVertices  = cache.header->vertexCount;
+        model.indices     = cache.indices;      model.nbIndices   = cache.header->indexCount;
+        model.materials   = cache.materials;    model.nbMaterials = cache.header->materialCount;
+        model.matIndx     = cache.matIndx;      model.nbMatIndx   = cache.header->matIndxCount;
+        model.emitterData = cache.emitters;     model.nbEmitters  = cache.header->emitterCount;
+        model.textures    = &cache.textures;
+        
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - loadStart).count();
+        printf("Scene cache hit: %s  %.1f ms  (assimp path took %.1f ms)\n",
+               cacheFile.c_str(), ms, cache.header->importMs); }
+
+    else {
+        meshdata.readAssimpFile(filename.c_str(), glm::mat4());
+    
 #ifdef SANM
-    vec3 T0(0,0,1);
-    vec3 T1( 0.866, 0, -0.5);
-    vec3 T2(-0.866, 0, -0.5);
-    vec3 Z(0,0,0);
-    vec3 LC(21.50, 20.39, 2.29);
-    int Nv = meshdata.vertices.size();
-    int Nm = meshdata.materials.size();
+        vec3 T0(0,0,1);
+        vec3 T1( 0.866, 0, -0.5);
+        vec3 T2(-0.866, 0, -0.5);
+        vec3 Z(0,0,0);
+        vec3 LC(21.50, 20.39, 2.29);
+        int Nv = meshdata.vertices.size();
+        int Nm = meshdata.materials.size();
     
-    // vec3 Sun(200,200,200);
-    // meshdata.vertices.push_back({LC+T0, vec3(0,1,0), vec2(1,0)});
-    // meshdata.vertices.push_back({LC+T1, vec3(0,1,0), vec2(0,1)});
-    // meshdata.vertices.push_back({LC+T2, vec3(0,1,0), vec2(1,1)});
-    // meshdata.indices.push_back(Nv+0);
-    // meshdata.indices.push_back(Nv+1);
-    // meshdata.indices.push_back(Nv+2);
-    // meshdata.materials.push_back({Z, Z, Sun, 0.0, -1});
-    // meshdata.matIndx.push_back(Nm);
-
-    // LC += vec3(0,1,0);
-    // Nv += 3;
-    // Nm += 1;
-    float s = 50;
-    vec3 Sky(5,5,5);
-    meshdata.vertices.push_back({vec3( 6.5,15, 0), vec3(0,1,0), vec2(0,0)});
-    meshdata.vertices.push_back({vec3( 6.5,15,13), vec3(0,1,0), vec2(0,0)});
-    meshdata.vertices.push_back({vec3(23.0,15, 0), vec3(0,1,0), vec2(0,0)});
-    meshdata.vertices.push_back({vec3(23.0,15,13), vec3(0,1,0), vec2(0,0)});
-    meshdata.indices.push_back(Nv+0);
-    meshdata.indices.push_back(Nv+1);
-    meshdata.indices.push_back(Nv+2);
-    meshdata.indices.push_back(Nv+2);
-    meshdata.indices.push_back(Nv+1);
-    meshdata.indices.push_back(Nv+3);
-    meshdata.materials.push_back({Z, Z, Sky, 0.0, -1});
-    meshdata.matIndx.push_back(Nm);                       
-    meshdata.matIndx.push_back(Nm);                             
+        // vec3 Sun(200,200,200);
+        // meshdata.vertices.push_back({LC+T0, vec3(0,1,0), vec2(1,0)});
+        // meshdata.vertices.push_back({LC+T1, vec3(0,1,0), vec2(0,1)});
+        // meshdata.vertices.push_back({LC+T2, vec3(0,1,0), vec2(1,1)});
+        // meshdata.indices.push_back(Nv+0);
+        // meshdata.indices.push_back(Nv+1);
+        // meshdata.indices.push_back(Nv+2);
+        // meshdata.materials.push_back({Z, Z, Sun, 0.0, -1});
+        // meshdata.matIndx.push_back(Nm);
+
+        // LC += vec3(0,1,0);
+        // Nv += 3;
+        // Nm += 1;
+        float s = 50;
+        vec3 Sky(5,5,5);
+        meshdata.vertices.push_back({vec3( 6.5,15, 0), vec3(0,1,0), vec2(0,0)});
+        meshdata.vertices.push_back({vec3( 6.5,15,13), vec3(0,1,0), vec2(0,0)});
+        meshdata.vertices.push_back({vec3(23.0,15, 0), vec3(0,1,0), vec2(0,0)});
+        meshdata.vertices.push_back({vec3(23.0,15,13), vec3(0,1,0), vec2(0,0)});
+        meshdata.indices.push_back(Nv+0);
+        meshdata.indices.push_back(Nv+1);
+        meshdata.indices.push_back(Nv+2);
+        meshdata.indices.push_back(Nv+2);
+        meshdata.indices.push_back(Nv+1);
+        meshdata.indices.push_back(Nv+3);
+        meshdata.materials.push_back({Z, Z, Sky, 0.0, -1});
+        meshdata.matIndx.push_back(Nm);                       
+        meshdata.matIndx.push_back(Nm);                             
 #endif
-    
-    printf("vertices: %zd\n", meshdata.vertices.size());
-    printf("indices: %zd (%zd)\n", meshdata.indices.size(), meshdata.indices.size()/3);
-    printf("materials: %zd\n", meshdata.materials.size());
-    printf("matIndx: %zd\n", meshdata.matIndx.size());
-    printf("textures: %zd\n", meshdata.textures.size());
-    
 
-    // @@ The raytracer will eventually need a list of lights, that is
-    // a list of triangle indices whose associated material type has a
-    // non-zero emission vec3.  Create such a list.  The vkapp.h header
-    // file has no data member for this, so create your own.
-    //
-    // Hint: The triangle at index i has:
-    //   vertices in meshdata.vertices, indexed by [3*i], [3*i+1], [3*i+2]
-    //   and a material in meshdata.materials, indexed by meshdata.matIndx[i]
+        emitters = buildEmitterList(meshdata);
+        
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - loadStart).count();
+        printf("Scene cache miss: assimp path took %.1f ms\n", ms);
+        if (SceneCache::write(cacheFile, cacheKey, ms, meshdata, emitters))
+            printf("Wrote scene cache: %s\n", cacheFile.c_str());
+        else
+            printf("Could not write scene cache: %s\n", cacheFile.c_str());
+
+        model.vertices    = meshdata.vertices.data();   model.nbVertices  = meshdata.vertices.size();
+        model.indices     = meshdata.indices.data();    model.nbIndices   = meshdata.indices.size();
+        model.materials   = meshdata.materials.data();  model.nbMaterials = meshdata.materials.size();
+        model.matIndx     = meshdata.matIndx.data();    model.nbMatIndx   = meshdata.matIndx.size();
+        model.emitterData = emitters.data();            model.nbEmitters  = emitters.size();
+        model.textures    = &meshdata.textures; }
     
-    ObjData object;
-    object.nbIndices  = static_cast<uint32_t>(meshdata.indices.size());
-    object.nbVertices = static_cast<uint32_t>(meshdata.vertices.size());
+    printf("vertices: %zd\n", model.nbVertices);
+    printf("indices: %zd (%zd)\n", model.nbIndices, model.nbIndices/3);
+    printf("materials: %zd\n", model.nbMaterials);
+    printf("matIndx: %zd\n", model.nbMatIndx);
+    printf("textures: %zd\n", model.textures->size());
+    printf("emitters: %zd\n", model.nbEmitters);
+}
 
-    // Create the buffers on Device and copy vertices, indices and materials
-    VkCommandBuffer    cmdBuf = createTempCmdBuffer();
+// Creates the model's buffers and textures on the device, from
+// readModel and decodeTextures, and adds it to the scene.
+void VkApp::uploadModel(const ModelSource& model, std::vector<DecodedTexture>& textures, glm::mat4 transform)
+{
+    TRACE_FUNCTION();
+    auto loadStart = std::chrono::high_resolution_clock::now();
+    const Vertex*   vertices    = model.vertices;     size_t nbVertices  = model.nbVertices;
+    const uint32_t* indices     = model.indices;      size_t nbIndices   = model.nbIndices;
+    const Material* materials   = model.materials;    size_t nbMaterials = model.nbMaterials;
+    const int32_t*  matIndx     = model.matIndx;      size_t nbMatIndx   = model.nbMatIndx;
+    const Emitter*  emitterData = model.emitterData;  size_t nbEmitters  = model.nbEmitters;
 
+    ObjData object;
+    object.nbIndices  = static_cast<uint32_t>(nbIndices);
+    object.nbVertices = static_cast<uint32_t>(nbVertices);
+
+    // Create the buffers on Device and queue copies of vertices, indices
+    // and materials.  On a cache hit these copy directly out of the mapped file.
     VkBufferUsageFlags flag = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
         | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     VkBufferUsageFlags rtFlags = flag
         | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
   
-    object.vertexBuffer = createStagedBufferWrap(cmdBuf, meshdata.vertices,
+    object.vertexBuffer = createStagedBufferWrap(nbVertices*sizeof(Vertex), vertices,
                                          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rtFlags);
-    object.indexBuffer = createStagedBufferWrap(cmdBuf, meshdata.indices,
+    object.indexBuffer = createStagedBufferWrap(nbIndices*sizeof(uint32_t), indices,
                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rtFlags);
-    object.matColorBuffer = createStagedBufferWrap(cmdBuf, meshdata.materials, flag);
-    object.matIndexBuffer = createStagedBufferWrap(cmdBuf, meshdata.matIndx, flag);
-  
-    submitTempCmdBuffer(cmdBuf);
+    object.matColorBuffer = createStagedBufferWrap(nbMaterials*sizeof(Material), materials, flag);
+    object.matIndexBuffer = createStagedBufferWrap(nbMatIndx*sizeof(int32_t), matIndx, flag);
+
+    // Each triangle's index in the emitter list, or -1:  for the light
+    // pdf of a BRDF sampled ray that hits an emitter.
+    std::vector<int32_t> emitterIndx(nbIndices/3, -1);
+    for (size_t e=0;  e<nbEmitters;  e++)
+        emitterIndx[emitterData[e].index] = int32_t(emitterList.size() + e);
+    object.emitterIndexBuffer = createStagedBufferWrap(emitterIndx.size()*sizeof(int32_t), emitterIndx.data(), flag);
     
     // Creates all textures on the GPU
+    auto texStart = std::chrono::high_resolution_clock::now();
     auto txtOffset = static_cast<uint32_t>(m_objText.size());  // Offset is current size
-    for(const auto& texName : meshdata.textures)
-        m_objText.push_back(createTextureImage(texName));
+    std::vector<ImageWrap> newTextures = createTextureImages(textures);
+    m_objText.insert(m_objText.end(), newTextures.begin(), newTextures.end());
+    printf("Created %zd textures in %.1f ms\n", newTextures.size(),
+           std::chrono::duration<double, std::milli>(
+               std::chrono::high_resolution_clock::now() - texStart).count());
 
     // Assuming one instance of an object with its supplied transform.
     // Could provide multiple transform here to make a vector of instances of this object.
@@ -167,21 +232,68 @@ void VkApp::myloadModel(const std::string& filename, glm::mat4 transform)
     desc.indexAddress         = getBufferDeviceAddress(m_device, object.indexBuffer.buffer);
     desc.materialAddress      = getBufferDeviceAddress(m_device, object.matColorBuffer.buffer);
     desc.materialIndexAddress = getBufferDeviceAddress(m_device, object.matIndexBuffer.buffer);
+    desc.emitterIndexAddress  = getBufferDeviceAddress(m_device, object.emitterIndexBuffer.buffer);
 
     m_objData.emplace_back(object);
     m_objDesc.emplace_back(desc);
 
+    emitterList.insert(emitterList.end(), emitterData, emitterData+nbEmitters);
+
+    // Over the whole list, every model's emitters, as the shader sees
+    // it:  alias indices and pdfs span all of them.
+    buildAliasTable(emitterList);
+
+    // Before the emitters go up:  it fills in their treeTrail.
+    auto treeStart = std::chrono::high_resolution_clock::now();
+    std::vector<LightNode> lightTree = buildLightTree(emitterList);
+    printf("Light tree: %zu nodes over %zu emitters in %.1f ms\n", lightTree.size(), emitterList.size(),
+           std::chrono::duration<double, std::milli>(
+               std::chrono::high_resolution_clock::now() - treeStart).count());
+
+    m_lightBuff = createBufferWrap(sizeof(emitterList[0]) * emitterList.size(),
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                    | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_upload.uploadBuffer(m_lightBuff.buffer, 0, emitterList.data(),
+                          sizeof(emitterList[0]) * emitterList.size());
+    m_lightTreeBuff = createBufferWrap(sizeof(lightTree[0]) * lightTree.size(),
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                    | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_upload.uploadBuffer(m_lightTreeBuff.buffer, 0, lightTree.data(),
+                          sizeof(lightTree[0]) * lightTree.size());
+    m_upload.flush();
+
+    double totalMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - loadStart).count();
+    printf("uploadModel: %.1f ms total (GPU upload submitted, not waited on)\n", totalMs);
+    m_allocator.printStats();
+
+    // @@ At shutdown:
+    // destroy in destroyAllVulkanResources()
+    //   Destroy all textures with:  for (t:m_objText) t.destroy(m_device); 
+    //   Destroy all buffers with:   for (ob:objDesc) ob.destroy(m_device);
+}
+
+// The raytracer's list of lights: every triangle whose material has a
+// non-zero emission.  The triangle at index i has:
+//   vertices in meshdata.vertices, indexed by [3*i], [3*i+1], [3*i+2]
+//   and a material in meshdata.materials, indexed by meshdata.matIndx[i]
+std::vector<Emitter> buildEmitterList(const ModelData& meshdata)
+{
+    std::vector<Emitter> emitters;
+    
     // Loop through all traingles
     for (uint i = 0; i < meshdata.matIndx.size(); i++)
     {
         // Get triangle i's material
-        Material& mat = meshdata.materials[meshdata.matIndx[i]];
+        const Material& mat = meshdata.materials[meshdata.matIndx[i]];
         
         // Test if triangle i is an emitter
         if (glm::dot(mat.emission, mat.emission) > 0.0f)
         {
             // Retrieve the traingle's vertices:
-            Emitter emitter;
+            Emitter emitter{};  // Zeroed, so cache files are deterministic
             emitter.v0 = meshdata.vertices[meshdata.indices[3 * i + 0]].pos;
             emitter.v1 = meshdata.vertices[meshdata.indices[3 * i + 1]].pos;
             emitter.v2 = meshdata.vertices[meshdata.indices[3 * i + 2]].pos;
@@ -189,28 +301,17 @@ void VkApp::myloadModel(const std::string& filename, glm::mat4 transform)
             emitter.emission = mat.emission;
             emitter.index = i;
             emitter.normal = normalize(cross(emitter.v1 - emitter.v0, emitter.v2 - emitter.v0));
-            emitter.area = 0.5f * cross(emitter.v1 - emitter.v0, emitter.v2 - emitter.v0).length();
+            emitter.area = 0.5f * glm::length(cross(emitter.v1 - emitter.v0, emitter.v2 - emitter.v0));
 
-            emitterList.emplace_back(emitter);
+            emitters.emplace_back(emitter);
         }
     }
-    m_lightBuff = createBufferWrap(sizeof(emitterList[0]) * emitterList.size(),
-                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-                    | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
-    vkCmdUpdateBuffer(commandBuffer, m_lightBuff.buffer, 0,
-        sizeof(emitterList[0]) * emitterList.size(), emitterList.data());
-    submitTempCmdBuffer(commandBuffer);
-
-    // @@ At shutdown:
-    // destroy in destroyAllVulkanResources()
-    //   Destroy all textures with:  for (t:m_objText) t.destroy(m_device); 
-    //   Destroy all buffers with:   for (ob:objDesc) ob.destroy(m_device);
+    return emitters;
 }
 
 void ModelData::readAssimpFile(const std::string& path, const mat4& M)
 {
+    TRACE_FUNCTION();
     printf("ReadAssimpFile File:  %s \n", path.c_str());
   
     aiMatrix4x4 modelTr(M[0][0], M[1][0], M[2][0], M[3][0],
@@ -227,8 +328,7 @@ void ModelData::readAssimpFile(const std::string& path, const mat4& M)
     // Invoke assimp to read the file.
     printf("Assimp %d.%d Reading %s\n", aiGetVersionMajor(), aiGetVersionMinor(), path.c_str());
     Assimp::Importer importer;
-    const aiScene* aiscene = importer.ReadFile(path.c_str(),
-                                               aiProcess_Triangulate|aiProcess_GenSmoothNormals);
+    const aiScene* aiscene = importer.ReadFile(path.c_str(), assimpImportFlags);
     
     if (!aiscene) {
         printf("... Failed to read.\n");
@@ -288,16 +388,31 @@ void ModelData::readAssimpFile(const std::string& path, const mat4& M)
         materials.push_back(newmat);
     }
     
-    recurseModelNodes(this, aiscene, aiscene->mRootNode, modelTr);
+    auto flattenStart = std::chrono::high_resolution_clock::now();
+
+    // Pass 1: find every (node, mesh) pair and its exact output offsets.
+    std::vector<MeshInstance> instances;
+    size_t nbVertices  = vertices.size();
+    size_t nbTriangles = matIndx.size();
+    recurseModelNodes(instances, nbVertices, nbTriangles, aiscene, aiscene->mRootNode, modelTr);
+
+    // Pass 2: transform and write into preallocated arrays, in parallel.
+    flattenMeshInstances(this, instances, nbVertices, nbTriangles);
+
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - flattenStart).count();
+    printf("Flattened %zd mesh instances (%zd vertices, %zd triangles) in %.1f ms\n",
+           instances.size(), vertices.size(), matIndx.size(), ms);
 
 }
 
 // Recursively traverses the assimp node hierarchy, accumulating
-// modeling transformations, and creating and transforming any meshes
-// found.  Meshes comming from assimp can have associated surface
-// properties, so each mesh *copies* the current BRDF as a starting
-// point and modifies it from the assimp data structure.
-void recurseModelNodes(ModelData* meshdata,
+// modeling transformations and recording each mesh found, along with
+// the exact offsets at which its vertices and triangles will land in
+// the flattened output.  The traversal order is the output order.
+void recurseModelNodes(std::vector<MeshInstance>& instances,
+                       size_t& nbVertices,
+                       size_t& nbTriangles,
                        const aiScene* aiscene,
                        const aiNode* node,
                        const aiMatrix4x4& parentTr,
@@ -309,40 +424,22 @@ void recurseModelNodes(ModelData* meshdata,
 
     // Accumulating transformations while traversing down the hierarchy.
     aiMatrix4x4 childTr = parentTr*node->mTransformation;
-    aiMatrix3x3 normalTr = aiMatrix3x3(childTr); // Really should be inverse-transpose for full generality
      
     // Loop through this node's meshes
     for (unsigned int m=0;  m<node->mNumMeshes; ++m) {
         aiMesh* aimesh = aiscene->mMeshes[node->mMeshes[m]];
         //printf("  %d: %d:%d\n", m, aimesh->mNumVertices, aimesh->mNumFaces);
 
-        // Loop through all vertices and record the
-        // vertex/normal/texture/tangent data with the node's model
-        // transformation applied.
-        uint faceOffset = meshdata->vertices.size();
-        for (unsigned int t=0;  t<aimesh->mNumVertices;  ++t) {
-            aiVector3D aipnt = childTr*aimesh->mVertices[t];
-            aiVector3D ainrm = aimesh->HasNormals() ? normalTr*aimesh->mNormals[t] : aiVector3D(0,0,1);
-            aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
-            aiVector3D aitan = aimesh->HasTangentsAndBitangents() ? normalTr*aimesh->mTangents[t] :  aiVector3D(1,0,0);
-
-
-            meshdata->vertices.push_back({{aipnt.x, aipnt.y, aipnt.z},
-                                          {ainrm.x, ainrm.y, ainrm.z},
-                                          {aitex.x, aitex.y}});
-        }
+        instances.push_back({aimesh, childTr, nbVertices, nbTriangles});
         
-        // Loop through all faces, recording indices
-        for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t) {
-            aiFace* aiface = &aimesh->mFaces[t];
-            for (int i=2;  i<aiface->mNumIndices;  i++) {
-                meshdata->matIndx.push_back(aimesh->mMaterialIndex);
-                meshdata->indices.push_back(aiface->mIndices[0]+faceOffset);
-                meshdata->indices.push_back(aiface->mIndices[i-1]+faceOffset);
-                meshdata->indices.push_back(aiface->mIndices[i]+faceOffset); } }; }
-
+        // Each face of n indices becomes a fan of n-2 triangles.
+        nbVertices += aimesh->mNumVertices;
+        for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t)
+            if (aimesh->mFaces[t].mNumIndices > 2)
+                nbTriangles += aimesh->mFaces[t].mNumIndices - 2; }
 
     // Recurse onto this node's children
     for (unsigned int i=0;  i<node->mNumChildren;  ++i)
-        recurseModelNodes(meshdata, aiscene, node->mChildren[i], childTr, level+1);
+        recurseModelNodes(instances, nbVertices, nbTriangles,
+                          aiscene, node->mChildren[i], childTr, level+1);
 }
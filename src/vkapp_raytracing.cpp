@@ -4,9 +4,11 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <thread>
 #include <math.h>
 
 #include "vkapp.h"
+#include "job_system.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_SWIZZLE
@@ -19,36 +21,21 @@ using namespace glm;
 
 void VkApp::createRtBuffers()
 {
-    // Note: This will grow to create more than the single buffer m_rtColCurrBuffer.
-    // Color
-    m_rtColCurrBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtColCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_GENERAL, 1);
-    m_rtColPrevBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtColPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_GENERAL, 1);
-
-    // Kd
-    m_rtKdCurrBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtKdCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_GENERAL, 1);
-    m_rtKdPrevBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtKdPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_GENERAL, 1);
-
-    // Nd
-    m_rtNdCurrBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtNdCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_GENERAL, 1);
-    m_rtNdPrevBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtNdPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_GENERAL, 1);
+    TRACE_FUNCTION();
+    // Color, Kd and Nd, each a Curr/Prev pair whose roles alternate by frame
+    for (int i=0;  i<2;  i++) {
+        m_rtColBuffer[i] = createBufferImage(windowSize, m_rtFormats.color);
+        transitionImageLayout(m_rtColBuffer[i].image, m_rtFormats.color,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_GENERAL, 1);
+        m_rtKdBuffer[i] = createBufferImage(windowSize, m_rtFormats.kd);
+        transitionImageLayout(m_rtKdBuffer[i].image, m_rtFormats.kd,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_GENERAL, 1);
+        m_rtNdBuffer[i] = createBufferImage(windowSize, m_rtFormats.nd);
+        transitionImageLayout(m_rtNdBuffer[i].image, m_rtFormats.nd,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_GENERAL, 1); }
 
     // @@ Destroy whatever buffers were created.
 
@@ -57,7 +44,15 @@ void VkApp::createRtBuffers()
 // Initialize ray tracing
 void VkApp::initRayTracing()
 {
+    TRACE_FUNCTION();
     m_pcRay.exposure = 2.0;
+    m_pcRay.explicitLight = app->explicitLight;
+    m_pcRay.mis = app->mis;
+    m_pcRay.lightChoice = app->lightChoice;
+    m_pcRay.minDepth = app->minDepth;
+    m_pcRay.maxDepth = app->maxDepth;
+    m_pcRay.samplerChoice = app->samplerChoice;
+    m_num_atrous_iterations = app->denoiseIterations;
     
     // Requesting ray tracing properties
     VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
@@ -88,6 +83,7 @@ void VkApp::initRayTracing()
 //
 void VkApp::createRtDescriptorSet()
 {
+    TRACE_FUNCTION();
     m_rtDesc.setBindings(m_device, {
             {0, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1,  // TLAS
              VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
@@ -95,35 +91,46 @@ void VkApp::createRtDescriptorSet()
              VK_SHADER_STAGE_RAYGEN_BIT_KHR},
             {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,   // EmitterList aka. explicit lighting
             VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT},
-            {3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtColPrevBuffer
+            {3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // Col Prev
             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-            {4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtNdCurrBuffer
+            {4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // Nd Curr
             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-            {5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtNdPrevBuffer
+            {5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // Nd Prev
             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-            {6, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtKdCurrBuffer
+            {6, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // Kd Curr
             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-            {7, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtKdPrevBuffer
+            {7, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // Kd Prev
             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-        });
-    
+            {8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,   // Light tree
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+        }, 2);  // One set per history index
+}
 
+// Once the TLAS, the light buffer and the images exist.
+void VkApp::writeRtDescriptorSet()
+{
+    TRACE_FUNCTION();
     // Note: This will grow to include more buffers.
 
     m_rtDesc.write(m_device, 0, m_rtBuilder.getAccelerationStructure());
-    m_rtDesc.write(m_device, 1, m_rtColCurrBuffer.Descriptor());
     m_rtDesc.write(m_device, 2, m_lightBuff.buffer);
-    m_rtDesc.write(m_device, 3, m_rtColPrevBuffer.Descriptor());
-    m_rtDesc.write(m_device, 4, m_rtNdCurrBuffer.Descriptor());
-    m_rtDesc.write(m_device, 5, m_rtNdPrevBuffer.Descriptor());
-    m_rtDesc.write(m_device, 6, m_rtKdCurrBuffer.Descriptor());
-    m_rtDesc.write(m_device, 7, m_rtKdPrevBuffer.Descriptor());
+    m_rtDesc.write(m_device, 8, m_lightTreeBuff.buffer);
+
+    // Set i writes the [i] images and reads the [1-i] images.
+    for (int i=0;  i<2;  i++) {
+        m_rtDesc.write(m_device, 1, m_rtColBuffer[i].Descriptor(), i);
+        m_rtDesc.write(m_device, 3, m_rtColBuffer[1-i].Descriptor(), i);
+        m_rtDesc.write(m_device, 4, m_rtNdBuffer[i].Descriptor(), i);
+        m_rtDesc.write(m_device, 5, m_rtNdBuffer[1-i].Descriptor(), i);
+        m_rtDesc.write(m_device, 6, m_rtKdBuffer[i].Descriptor(), i);
+        m_rtDesc.write(m_device, 7, m_rtKdBuffer[1-i].Descriptor(), i); }
 }
 
 // Pipeline for the ray tracer: all shaders, raygen, chit, miss
 //
 void VkApp::createRtPipeline()
 {
+    TRACE_FUNCTION();
     ////////////////////////////////////////////////////////////////////////////////////////////
     // stages: Array of shaders: 1 raygen, 1 miss, 1 hit (later: an additional hit/miss pair.)
 
@@ -208,7 +215,39 @@ void VkApp::createRtPipeline()
     rayPipelineInfo.maxPipelineRayRecursionDepth = 10;  // Ray depth
     rayPipelineInfo.layout                       = m_rtPipelineLayout;
 
-    vkCreateRayTracingPipelinesKHR(m_device, {}, {}, 1, &rayPipelineInfo, nullptr, &m_rtPipeline);
+    PipelineCache::Feedback feedback(m_pipelineCache, "raytrace");
+    rayPipelineInfo.pNext = feedback.chain();
+
+    // The driver may split the compile into pieces that any number
+    // of threads can pick up (VK_KHR_deferred_host_operations).  This
+    // thread and as many of the job system's workers as it will use
+    // join in.  Without a deferred operation, the compile runs here.
+    VkDeferredOperationKHR deferred = VK_NULL_HANDLE;
+    if (vkCreateDeferredOperationKHR(m_device, nullptr, &deferred) != VK_SUCCESS)
+        deferred = VK_NULL_HANDLE;
+    VkResult result = vkCreateRayTracingPipelinesKHR(m_device, deferred, m_pipelineCache.m_cache,
+                                                     1, &rayPipelineInfo, nullptr, &m_rtPipeline);
+    if (result == VK_OPERATION_DEFERRED_KHR) {
+        JobSystem& jobs = JobSystem::instance();
+        unsigned int nbThreads = std::max(1u, std::min(jobs.workerCount() + 1,
+                                                       vkGetDeferredOperationMaxConcurrencyKHR(m_device, deferred)));
+        // IDLE:  no work right now but maybe later;  DONE or SUCCESS:  none
+        // left for this thread, and a second join returns at once.
+        jobs.parallelFor("deferred join", nbThreads, [this, deferred](size_t) {
+            while (vkDeferredOperationJoinKHR(m_device, deferred) == VK_THREAD_IDLE_KHR)
+                std::this_thread::yield(); });
+
+        // Every joiner returned, but the last piece may still be finishing.
+        while ((result = vkGetDeferredOperationResultKHR(m_device, deferred)) == VK_NOT_READY)
+            std::this_thread::yield();
+        printf("Ray tracing pipeline:  deferred across up to %u threads\n", nbThreads); }
+    else if (result == VK_OPERATION_NOT_DEFERRED_KHR)
+        result = VK_SUCCESS;  // Completed synchronously
+    if (deferred != VK_NULL_HANDLE)
+        vkDestroyDeferredOperationKHR(m_device, deferred, nullptr);
+    if (result != VK_SUCCESS)
+        throw std::runtime_error("failed to create ray tracing pipeline!");
+    feedback.report();
     for (auto& s : stages)
         vkDestroyShaderModule(m_device, s.module, nullptr);
 
@@ -229,6 +268,7 @@ constexpr integral align_up(integral x, size_t a) noexcept
 
 void VkApp::createRtShaderBindingTable()
 {
+    TRACE_FUNCTION();
     uint32_t missCount{1};
     uint32_t hitCount{1};
 
@@ -274,9 +314,7 @@ void VkApp::createRtShaderBindingTable()
     VkDeviceSize sbtSize = m_rgenRegion.size + m_missRegion.size
         + m_hitRegion.size + m_callRegion.size;
     
-    BufferWrap staging = createBufferWrap(sbtSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    StagingSpan staging = m_upload.stage(sbtSize);
     m_shaderBindingTableBW = createBufferWrap(sbtSize,
                                   VK_BUFFER_USAGE_TRANSFER_DST_BIT
                                   | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
@@ -295,9 +333,8 @@ void VkApp::createRtShaderBindingTable()
     // Helper to retrieve the handle data
     auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
 
-    // Map the SBT buffer and write in the handles.
-    uint8_t* mappedMemAddress;
-    vkMapMemory(m_device, staging.memory, 0, sbtSize, 0, (void**)&mappedMemAddress);
+    // Write the handles into the staging memory.
+    uint8_t* mappedMemAddress = (uint8_t*)staging.mapped;
     uint8_t offset = 0;
 
     // Raygen
@@ -316,17 +353,16 @@ void VkApp::createRtShaderBindingTable()
         memcpy(mappedMemAddress+offset, getHandle(handleIdx++), handleSize);
         offset += m_hitRegion.stride; }
 
-    vkUnmapMemory(m_device, staging.memory);
     
-    copyBuffer(staging.buffer, m_shaderBindingTableBW.buffer, sbtSize);
-
-    staging.destroy(m_device);
+    m_upload.copyBuffer(staging, m_shaderBindingTableBW.buffer, 0, sbtSize);
 
     // @@ destroy acceleration structure with m_shaderBindingTableBW.destroy(m_device);
 }
 
 void VkApp::CmdCopyImage(ImageWrap& src, ImageWrap& dst)
 {
+    GpuZone zone(m_profiler, m_commandBuffer, "CmdCopyImage");
+
     VkImageCopy imageCopyRegion{};
     imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     imageCopyRegion.srcSubresource.layerCount = 1;
@@ -336,21 +372,26 @@ void VkApp::CmdCopyImage(ImageWrap& src, ImageWrap& dst)
     imageCopyRegion.extent.height             = windowSize.height;
     imageCopyRegion.extent.depth              = 1;
 
-    imageLayoutBarrier(m_commandBuffer, src.image,
-                       VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-    imageLayoutBarrier(m_commandBuffer, dst.image,
-                       VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    
-    vkCmdCopyImage(m_commandBuffer,
-                   src.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                   1, &imageCopyRegion);
-    
-    imageLayoutBarrier(m_commandBuffer, src.image,
-                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-    imageLayoutBarrier(m_commandBuffer, dst.image,
-                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-
+    // Both images stay in VK_IMAGE_LAYOUT_GENERAL, which copies and
+    // blits accept:  no layout transitions, so the caller's barriers
+    // (see imageAccessBarrier) alone order the copy.
+    if (src.format == dst.format)
+        vkCmdCopyImage(m_commandBuffer,
+                       src.image, VK_IMAGE_LAYOUT_GENERAL,
+                       dst.image, VK_IMAGE_LAYOUT_GENERAL,
+                       1, &imageCopyRegion);
+    else {
+        // Different formats (e.g. RGBA32F color to an RGBA16F display
+        // image) need a blit, which converts.
+        VkImageBlit blit{};
+        blit.srcSubresource = imageCopyRegion.srcSubresource;
+        blit.dstSubresource = imageCopyRegion.dstSubresource;
+        blit.srcOffsets[1] = {int32_t(windowSize.width), int32_t(windowSize.height), 1};
+        blit.dstOffsets[1] = blit.srcOffsets[1];
+        vkCmdBlitImage(m_commandBuffer,
+                       src.image, VK_IMAGE_LAYOUT_GENERAL,
+                       dst.image, VK_IMAGE_LAYOUT_GENERAL,
+                       1, &blit, VK_FILTER_NEAREST); }
 }
 
 void VkApp::raytrace()
@@ -363,12 +404,14 @@ void VkApp::raytrace()
     // @@ Pathtracing: Remove these because path tracing finds emitters defined in the model.
     // These values define a light near the ceiling of the living room model.
     m_pcRay.alignmentTest = 1234;
-    m_pcRay.frameSeed = rand() % 32768;
-    m_pcRay.rr = 0.7f;
-    m_pcRay.depth = 1;
-    while (float(rand()) / RAND_MAX < m_pcRay.rr)
-        m_pcRay.depth++;
-    m_pcRay.depth = std::min(m_pcRay.depth, 4);
+    // m_rng rather than rand():  a fixed seed, and the same sequence on
+    // every platform, so benchmark runs are reproducible.
+    m_pcRay.frameSeed = int(m_rng());
+    if (app->myCamera.modified) {
+        m_pcRay.sequenceSeed = int(m_rng());
+        m_pcRay.sampleIndex = 0; }
+    else
+        m_pcRay.sampleIndex++;
     m_pcRay.clear = app->myCamera.modified;
     app->myCamera.modified = false;
 
@@ -377,11 +420,14 @@ void VkApp::raytrace()
 
     // Bind the descriptor sets (the ray tracing specific one, and the
     // full model descriptor)
-    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet};
+    // Last frame's Curr images are this frame's Prev images.
+    m_historyIndex = 1 - m_historyIndex;
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSets[m_historyIndex], m_scDesc.descSet};
+    uint32_t matrixOffset = uint32_t(m_frameIndex * m_matrixStride);  // This frame's camera slice
     vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
                             m_rtPipelineLayout, 0,
                             descSets.size(), descSets.data(),
-                            0, nullptr);
+                            1, &matrixOffset);
 
     // Push the push constants
     vkCmdPushConstants(m_commandBuffer, m_rtPipelineLayout,
@@ -396,15 +442,10 @@ void VkApp::raytrace()
                       &m_callRegion, windowSize.width, windowSize.height, 1);
     frameCount++;
 
-    
-    // Copy the ray tracer output image to the scanline output image
-    // -- because we already have the operations needed to display
-    // that image on the screen.
-    CmdCopyImage(m_rtColCurrBuffer, m_scImageBuffer);
-
-    // @@ History and Denoising: The three Curr buffers need copying to the Prev buffers.
-    CmdCopyImage(m_rtColCurrBuffer, m_rtColPrevBuffer);
-    CmdCopyImage(m_rtKdCurrBuffer, m_rtKdPrevBuffer);
-    CmdCopyImage(m_rtNdCurrBuffer, m_rtNdPrevBuffer);
+    // The ray tracer output reaches the scanline output image
+    // (m_scImageBuffer, which postProcess displays) through denoise().
+
+    // History:  No copies from Curr to Prev; the next frame binds the
+    // other descriptor set instead.
 }
 
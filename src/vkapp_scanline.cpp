@@ -3,10 +3,14 @@
 #include <fstream>
 #include <string>
 #include <cstring>              // for memcpy
+#include <algorithm>
 #include <vector>
 #include <array>
 #include <math.h>
 
+#include <filesystem>
+namespace fs = std::filesystem;
+
 #include "vkapp.h"
 
 #define GLM_FORCE_RADIANS
@@ -18,6 +22,8 @@ using namespace glm;
 #include "stb_image.h"
 
 #include "app.h"
+#include "texture_format.h"
+#include "job_system.h"
 #include "shaders/shared_structs.h"
 
 VkAccessFlags accessFlagsForImageLayout(VkImageLayout layout)
@@ -95,57 +101,240 @@ void VkApp::imageLayoutBarrier(VkCommandBuffer cmdbuffer,
                          0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
 }
 
+void VkApp::imageAccessBarrier(VkCommandBuffer cmdbuffer,
+                               const std::vector<VkImage>& images,
+                               VkPipelineStageFlags srcStageMask, VkAccessFlags srcAccessMask,
+                               VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask,
+                               VkImageLayout oldImageLayout,
+                               VkImageLayout newImageLayout,
+                               VkImageAspectFlags aspectMask)
+{
+    std::vector<VkImageMemoryBarrier> barriers(images.size(),
+                                               {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER});
+    for (size_t i=0;  i<images.size();  i++) {
+        VkImageMemoryBarrier& barrier = barriers[i];
+        barrier.srcAccessMask       = srcAccessMask;
+        barrier.dstAccessMask       = dstAccessMask;
+        barrier.oldLayout           = oldImageLayout;
+        barrier.newLayout           = newImageLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = images[i];
+        barrier.subresourceRange    = {aspectMask, 0, VK_REMAINING_MIP_LEVELS,
+                                       0, VK_REMAINING_ARRAY_LAYERS}; }
+
+    vkCmdPipelineBarrier(cmdbuffer, srcStageMask, dstStageMask, 0,
+                         0, nullptr, 0, nullptr, uint32_t(barriers.size()), barriers.data());
+}
+
 ImageWrap VkApp::createTextureImage(std::string fileName)
 {
-    for (int i=0;  i<fileName.size();  i++)
-        if (fileName[i] == '\\') fileName[i] = '/';
-    
-    //VkImage& textureImage, VkDeviceMemory& textureImageMemory
-    int texWidth, texHeight, texChannels;
+    return createTextureImages({fileName})[0];
+}
 
-    stbi_set_flip_vertically_on_load(true);
-    stbi_uc* pixels = stbi_load(fileName.c_str(), &texWidth, &texHeight, &texChannels,
-                                STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+std::vector<ImageWrap> VkApp::createTextureImages(const std::vector<std::string>& fileNames)
+{
+    std::vector<DecodedTexture> decoded = decodeTextures(fileNames);
+    return createTextureImages(decoded);
+}
 
-    if (!pixels) {
+// Reads and decodes a model's textures on the job system;  touches no
+// Vulkan object, so it can run alongside other startup work once the
+// device's features are known.
+//
+// If an up to date compiled texture (<image>.rtex, see texture_format.h)
+// exists and the device supports BC formats, it is used instead: its
+// precomputed, block compressed mip chain is viewed in place, to be
+// copied in by createTextureImages with no blits.
+std::vector<DecodedTexture> VkApp::decodeTextures(const std::vector<std::string>& fileNames)
+{
+    TRACE_FUNCTION();
+    std::vector<DecodedTexture> decoded(fileNames.size());
+    if (fileNames.empty())
+        return decoded;
+
+    // Reads a compiled texture if there is a usable one; returns false to fall back.
+    auto readRtex = [this](const std::string& fileName, DecodedTexture& d) {
+        std::string path = rtexPath(fileName);
+        std::error_code ec;
+        if (!m_textureCompressionBC || !fs::exists(path, ec)
+            || fs::last_write_time(path, ec) < fs::last_write_time(fileName, ec))
+            return false;
+        
+        if (!d.rtex.open(path))
+            return false;
+        
+        const RtexHeader* h = d.rtex.as<RtexHeader>();
+        const char* invalid = nullptr;
+        if (d.rtex.size() < sizeof(RtexHeader) || memcmp(h->magic, "RTEX", 4) != 0
+            || h->version != RTEX_VERSION)
+            invalid = "not a compiled texture of this version";
+        else
+            invalid = rtexCheck(*h, d.rtex.size());
+        if (invalid) {
+            printf("Ignoring invalid compiled texture %s:  %s\n", path.c_str(), invalid);
+            d.rtex.close();
+            return false; }
+        
+        d.width = h->width;
+        d.height = h->height;
+        d.mipLevels = h->mipLevels;
+        d.format = h->format == eRtexBC1 ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+        return true; };
+
+    // Decode in parallel.  The flip flag is global to stb_image, so set it
+    // before any job starts.
+    stbi_set_flip_vertically_on_load(true);
+    JobSystem::instance().parallelFor("decode texture", fileNames.size(), [&](size_t i) {
+        std::string fileName = fileNames[i];
+        for (int c=0;  c<fileName.size();  c++)
+            if (fileName[c] == '\\') fileName[c] = '/';
+        DecodedTexture& d = decoded[i];
+        if (readRtex(fileName, d))
+            return;
+        
+        int texChannels;
+        d.pixels = stbi_load(fileName.c_str(), &d.width, &d.height, &texChannels, STBI_rgb_alpha);
+        d.format = VK_FORMAT_R8G8B8A8_UNORM;
+        if (d.pixels)
+            d.mipLevels = std::floor(std::log2(std::max(d.width, d.height))) + 1; });
+
+    // Size every texture's texel data.
+    bool failed = false;
+    int compiled = 0;
+    for (size_t i=0;  i<decoded.size();  i++) {
+        DecodedTexture& d = decoded[i];
+        if (d.rtex.isOpen()) {
+            const RtexHeader* h = d.rtex.as<RtexHeader>();
+            d.size = h->levelOffset[d.mipLevels-1] + h->levelSize[d.mipLevels-1] - h->levelOffset[0];
+            compiled++; }
+        else if (d.pixels)
+            d.size = VkDeviceSize(d.width) * d.height * 4;
+        else {
+            printf("Failed to load texture %s\n", fileNames[i].c_str());
+            failed = true; } }
+
+    if (failed) {
+        for (auto& d : decoded) {
+            stbi_image_free(d.pixels);
+            d.pixels = nullptr; }
         throw std::runtime_error("failed to load texture image!");
     }
+    printf("Textures: %d of %zd precompiled\n", compiled, decoded.size());
+    return decoded;
+}
 
-    BufferWrap staging = createBufferWrap(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    void* data;
-    vkMapMemory(m_device, staging.memory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(m_device, staging.memory);
-
-    stbi_image_free(pixels);
-
-    uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
+// Creates all of a model's textures at once, from decodeTextures.  The
+// pixels are staged through m_upload's ring and all the layout
+// transitions, copies and mip blits are recorded into its batch, which
+// is submitted but not waited on.  A compiled texture's mip chain goes
+// in with a single multi-region vkCmdCopyBufferToImage.
+std::vector<ImageWrap> VkApp::createTextureImages(std::vector<DecodedTexture>& decoded)
+{
+    TRACE_FUNCTION();
+    if (decoded.empty())
+        return {};
+
+    // Check if image format supports linear blitting;  only decoded
+    // RGBA8 textures have their mips blitted.
+    bool blitsMips = std::any_of(decoded.begin(), decoded.end(),
+                                 [](const DecodedTexture& d) { return !d.rtex.isOpen(); });
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+    if (blitsMips && !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+        throw std::runtime_error("texture image format does not support linear blitting!");
+    }
     
-    ImageWrap myImage = createImageWrap(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM,
-                                  VK_IMAGE_USAGE_TRANSFER_DST_BIT
-                                  | VK_IMAGE_USAGE_SAMPLED_BIT
-                                  | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                  mipLevels);
-
-    transitionImageLayout(myImage.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-
-    copyBufferToImage(staging.buffer, myImage.image, static_cast<uint32_t>(texWidth),
-                      static_cast<uint32_t>(texHeight));
-
-    staging.destroy(m_device);
+    std::vector<ImageWrap> images;
+    std::vector<VkImageMemoryBarrier> barriers;
+    for (auto& d : decoded) {
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        if (!d.rtex.isOpen())
+            usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;  // Source of the mip blits
+        ImageWrap myImage = createImageWrap(d.width, d.height, d.format, usage,
+                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                            d.mipLevels);
+        
+        VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = myImage.image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, d.mipLevels, 0, 1};
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers.push_back(barrier);
+        
+        images.push_back(myImage); }
+    
+    // Everything is recorded into m_upload's batch.  One barrier moves
+    // all images to TRANSFER_DST first;  should staging fill the ring,
+    // the batch is submitted and continued in a new command buffer,
+    // which queue submission order keeps behind that barrier.
+    vkCmdPipelineBarrier(m_upload.cmd(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr,    0, nullptr,
+                         (uint32_t)barriers.size(), barriers.data());
+
+    // Compiled textures end in a single barrier covering all their levels.
+    std::vector<VkImageMemoryBarrier> readBarriers;
+    
+    for (size_t i=0;  i<images.size();  i++) {
+        DecodedTexture& d = decoded[i];
+        StagingSpan staging = m_upload.stage(d.size);
+        VkCommandBuffer commandBuffer = m_upload.cmd();  // After stage(), which may have submitted
+        
+        if (d.rtex.isOpen()) {
+            const RtexHeader* h = d.rtex.as<RtexHeader>();
+            memcpy(staging.mapped, d.rtex.data() + h->levelOffset[0], static_cast<size_t>(d.size));
+            std::vector<VkBufferImageCopy> regions(d.mipLevels);
+            for (uint32_t l=0;  l<d.mipLevels;  l++) {
+                regions[l] = {};
+                regions[l].bufferOffset = staging.offset + h->levelOffset[l] - h->levelOffset[0];
+                regions[l].imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, l, 0, 1};
+                regions[l].imageExtent = {std::max(1u, uint32_t(d.width)>>l),
+                                          std::max(1u, uint32_t(d.height)>>l), 1}; }
+            vkCmdCopyBufferToImage(commandBuffer, staging.buffer, images[i].image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   (uint32_t)regions.size(), regions.data());
+            d.rtex.close();  // Release it now; the file may be large
+
+            VkImageMemoryBarrier barrier = barriers[i];
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            readBarriers.push_back(barrier);
+            continue; }
+
+        memcpy(staging.mapped, d.pixels, static_cast<size_t>(d.size));
+        stbi_image_free(d.pixels);
+        d.pixels = nullptr;
+        
+        VkBufferImageCopy region{};
+        region.bufferOffset = staging.offset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageExtent = {uint32_t(d.width), uint32_t(d.height), 1};
+        vkCmdCopyBufferToImage(commandBuffer, staging.buffer, images[i].image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        
+        recordMipmaps(commandBuffer, images[i].image, d.width, d.height, d.mipLevels); }
 
-    generateMipmaps(myImage.image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+    if (!readBarriers.empty())
+        vkCmdPipelineBarrier(m_upload.cmd(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             0, nullptr,    0, nullptr,
+                             (uint32_t)readBarriers.size(), readBarriers.data());
     
-    myImage.imageView = createImageView(myImage.image, VK_FORMAT_R8G8B8A8_UNORM);
-    myImage.sampler = createTextureSampler();
-    myImage.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    return myImage;
+    // Submit, but leave the waiting to whoever first needs the textures.
+    m_upload.flush();
+
+    for (size_t i=0;  i<images.size();  i++) {
+        images[i].imageView = createImageView(images[i].image, decoded[i].format,
+                                              VK_IMAGE_ASPECT_COLOR_BIT, decoded[i].mipLevels);
+        images[i].sampler = createTextureSampler();
+        images[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; }
+    
+    return images;
 }
 
 void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
@@ -160,7 +349,16 @@ void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
     }
 
     VkCommandBuffer commandBuffer = createTempCmdBuffer();
+    recordMipmaps(commandBuffer, image, texWidth, texHeight, mipLevels);
+    submitTempCmdBuffer(commandBuffer);
+}
 
+// Records the blit chain that fills mip levels 1..mipLevels-1 from
+// level 0, leaving every level in SHADER_READ_ONLY_OPTIMAL.  Level 0
+// must be in TRANSFER_DST_OPTIMAL and its copy already recorded.
+void VkApp::recordMipmaps(VkCommandBuffer commandBuffer, VkImage image,
+                          int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+{
     VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
     barrier.image = image;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -232,30 +430,15 @@ void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
                          0, nullptr,
                          0, nullptr,
                          1, &barrier);
-
-    submitTempCmdBuffer(commandBuffer);
 }
 
-BufferWrap VkApp::createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
-                                         const VkDeviceSize&    size,
+BufferWrap VkApp::createStagedBufferWrap(const VkDeviceSize&    size,
                                          const void*            data,
                                          VkBufferUsageFlags     usage)
 {
-    BufferWrap staging = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    void* dest;
-    vkMapMemory(m_device, staging.memory, 0, size, 0, &dest);
-    memcpy(dest, data, size);
-    vkUnmapMemory(m_device, staging.memory);
-
-    
     BufferWrap bw = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    copyBuffer(staging.buffer, bw.buffer, size);
-
-    staging.destroy(m_device);
+    m_upload.uploadBuffer(bw.buffer, 0, data, size);
     
     return bw;
 }
@@ -275,38 +458,31 @@ BufferWrap VkApp::createBufferWrap(VkDeviceSize size, VkBufferUsageFlags usage,
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(m_device, result.buffer, &memRequirements);
 
-    VkMemoryAllocateFlagsInfo memFlags = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, nullptr,
-        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
-
-    VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    allocInfo.pNext = &memFlags;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &result.memory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
+    // Staging buffers live only until their copy is done, so they are
+    // bump allocated; everything else shares buddy allocated blocks.
+    result.alloc = m_allocator.allocate(memRequirements, properties,
+                                        usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT ? eMemStaging : eMemBuffer);
         
-    vkBindBufferMemory(m_device, result.buffer, result.memory, 0);
+    vkBindBufferMemory(m_device, result.buffer, result.alloc.memory, result.alloc.offset);
 
     return result;
 }
 
+// copyBuffer, copyBufferToImage and transitionImageLayout only record
+// into the current m_upload batch;  nothing waits for them.
 void VkApp::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
 {
-    VkCommandBuffer commandBuffer =  createTempCmdBuffer();
+    VkCommandBuffer commandBuffer = m_upload.cmd();
 
     VkBufferCopy copyRegion{};
     copyRegion.size = size;
     vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    submitTempCmdBuffer(commandBuffer);
 }
 
 
 void VkApp::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
 {
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
+    VkCommandBuffer commandBuffer = m_upload.cmd();
 
     VkBufferImageCopy region{};
     region.bufferOffset = 0;
@@ -320,8 +496,6 @@ void VkApp::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, ui
     region.imageExtent = {width, height, 1};
 
     vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-    
-    submitTempCmdBuffer(commandBuffer);
 }
 
 void VkApp::transitionImageLayout(VkImage image,
@@ -330,7 +504,7 @@ void VkApp::transitionImageLayout(VkImage image,
                                         VkImageLayout newLayout,
                                         uint32_t mipLevels)
 {
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
+    VkCommandBuffer commandBuffer = m_upload.cmd();
 
     VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
     barrier.oldLayout = oldLayout;
@@ -351,8 +525,6 @@ void VkApp::transitionImageLayout(VkImage image,
 
     vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0,
                          0, nullptr,    0, nullptr,    1, &barrier);
-    
-    submitTempCmdBuffer(commandBuffer);
 }
 
 VkSampler VkApp::createTextureSampler()
@@ -373,6 +545,7 @@ VkSampler VkApp::createTextureSampler()
     samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;  // Use every level the image view has
 
     VkSampler textureSampler;
     if (vkCreateSampler(m_device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
@@ -383,6 +556,7 @@ VkSampler VkApp::createTextureSampler()
 
 void VkApp::createPostDescriptor()
 {
+    TRACE_FUNCTION();
     m_postDesc.setBindings(m_device, {
             {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT}
         });
@@ -394,23 +568,22 @@ void VkApp::createPostDescriptor()
 
 void VkApp::createScBuffer()
 {
-    m_scImageBuffer = createBufferImage(windowSize);
+    TRACE_FUNCTION();
+    m_scImageBuffer = createBufferImage(windowSize, m_rtFormats.display);
 
-    VkCommandBuffer    cmdBuf = createTempCmdBuffer();
-    imageLayoutBarrier(cmdBuf, m_scImageBuffer.image,
+    imageLayoutBarrier(m_upload.cmd(), m_scImageBuffer.image,
                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-    submitTempCmdBuffer(cmdBuf);
     
     // @@ [DONE]
     //  Destroy with m_scImageBuffer.destroy(m_device);
 }
 
-ImageWrap VkApp::createBufferImage(VkExtent2D& size)
+ImageWrap VkApp::createBufferImage(VkExtent2D& size, VkFormat format)
 {
     //uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
     uint mipLevels = 1;
 
-    ImageWrap myImage = createImageWrap(size.width, size.height, VK_FORMAT_R32G32B32A32_SFLOAT,
+    ImageWrap myImage = createImageWrap(size.width, size.height, format,
                                   VK_IMAGE_USAGE_TRANSFER_DST_BIT
                                   | VK_IMAGE_USAGE_SAMPLED_BIT
                                   | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
@@ -419,7 +592,7 @@ ImageWrap VkApp::createBufferImage(VkExtent2D& size)
                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                                   mipLevels);
 
-    myImage.imageView = createImageView(myImage.image, VK_FORMAT_R32G32B32A32_SFLOAT);
+    myImage.imageView = createImageView(myImage.image, format);
     myImage.sampler = createTextureSampler();
     myImage.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
     return myImage;
@@ -428,8 +601,9 @@ ImageWrap VkApp::createBufferImage(VkExtent2D& size)
 // The scanline renderpass outputs to m_scImageBuffer (as wrapped by m_scanlineFramebuffer)
 void VkApp::createScanlineRenderPass()
 {
+    TRACE_FUNCTION();
     VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    colorAttachment.format = m_rtFormats.display;  // m_scImageBuffer's format
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
@@ -462,7 +636,8 @@ void VkApp::createScanlineRenderPass()
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
     
-    VkSubpassDependency dependency{};
+    std::array<VkSubpassDependency, 2> dependencies{};
+    VkSubpassDependency& dependency = dependencies[0];
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
     dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
@@ -472,6 +647,16 @@ void VkApp::createScanlineRenderPass()
         | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
         | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    // postProcess's fragment shader reads the image, after its
+    // transition back to GENERAL.
+    VkSubpassDependency& toPost = dependencies[1];
+    toPost.srcSubpass = 0;
+    toPost.dstSubpass = VK_SUBPASS_EXTERNAL;
+    toPost.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    toPost.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    toPost.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    toPost.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
     
     std::array<VkAttachmentDescription, 2> attachmentsDsc = {colorAttachment, depthAttachment};
     VkRenderPassCreateInfo renderPassInfo{};
@@ -480,8 +665,8 @@ void VkApp::createScanlineRenderPass()
     renderPassInfo.pAttachments = attachmentsDsc.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
     
     if (vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_scanlineRenderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create scanline render pass!");
@@ -504,15 +689,17 @@ void VkApp::createScanlineRenderPass()
     // Destroy with vkDestroyFramebuffer(m_device, m_scanlineFramebuffer, nullptr);
 }
 
-void VkApp::createScDescriptorSet()
+// The layout and set, sized for nbTxt textures, so the pipelines can
+// be created before the model's buffers and textures exist;
+// writeScDescriptorSet fills it in once they do.
+void VkApp::createScDescriptorSet(uint32_t nbTxt)
 {
-    auto nbTxt = static_cast<uint32_t>(m_objText.size());
-
+    TRACE_FUNCTION();
     // Note: This descriptor set is being created for both the
     // scanline and raytracing pipelines; Note the mention of VERTEX,
     // FRAGMENT, and RAYGEN shader stages.
     m_scDesc.setBindings(m_device, {
-            {ScBindings::eMatrices, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+            {ScBindings::eMatrices, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1,
                 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
             {ScBindings::eObjDescs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
@@ -520,17 +707,25 @@ void VkApp::createScDescriptorSet()
             {ScBindings::eTextures, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nbTxt,
                 VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR}
         });
-              
-    m_scDesc.write(m_device, ScBindings::eMatrices, m_matrixBW.buffer);
-    m_scDesc.write(m_device, ScBindings::eObjDescs, m_objDescriptionBW.buffer);
-    m_scDesc.write(m_device, ScBindings::eTextures, m_objText);    
+    m_scDescTextures = nbTxt;
 
     // @@ [DONE]
     // Destroy with m_scDesc.destroy(m_device);
 }
 
+void VkApp::writeScDescriptorSet()
+{
+    TRACE_FUNCTION();
+    if (m_objText.size() != m_scDescTextures)
+        throw std::runtime_error("scene texture count does not match the descriptor set!");
+    m_scDesc.write(m_device, ScBindings::eMatrices, m_matrixBW.buffer, sizeof(MatrixUniforms));
+    m_scDesc.write(m_device, ScBindings::eObjDescs, m_objDescriptionBW.buffer);
+    m_scDesc.write(m_device, ScBindings::eTextures, m_objText);    
+}
+
 void VkApp::createScPipeline()
 {
+    TRACE_FUNCTION();
     VkPushConstantRange pushConstantRanges = {
         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantRaster)};
 
@@ -654,9 +849,12 @@ void VkApp::createScPipeline()
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_scanlinePipeline) != VK_SUCCESS) {
+    PipelineCache::Feedback feedback(m_pipelineCache, "scanline");
+    pipelineInfo.pNext = feedback.chain();
+    if (vkCreateGraphicsPipelines(m_device, m_pipelineCache.m_cache, 1, &pipelineInfo, nullptr, &m_scanlinePipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create scanline pipeline!");
     }
+    feedback.report();
 
     // Done with the temporary spv shader modules.
     vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
@@ -669,13 +867,21 @@ void VkApp::createScPipeline()
 }
 
 // Create a Vulkan buffer to hold the camera matrices, products and inverses.
-// Will be included in a descriptor set for use in shaders.
+// Will be included in a descriptor set for use in shaders.  It holds one
+// slice per frame in flight, written directly by the host, and bound
+// with a dynamic offset selecting the current frame's slice.
 void VkApp::createMatrixBuffer()
 {
-    m_matrixBW = createBufferWrap(sizeof(MatrixUniforms),
-                               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-                               | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    TRACE_FUNCTION();
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    VkDeviceSize align = properties.limits.minUniformBufferOffsetAlignment;
+    m_matrixStride = (sizeof(MatrixUniforms) + align - 1) / align * align;
+    
+    m_matrixBW = createBufferWrap(m_matrixStride * m_framesInFlight,
+                               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                               | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
     // @@ [DONE]
     // Destroy with m_matrixBW.destroy(m_device);
@@ -686,10 +892,9 @@ void VkApp::createMatrixBuffer()
 // included in a descriptor set for use in shaders.
 void VkApp::createObjDescriptionBuffer()
 {
-    VkCommandBuffer cmdBuf = createTempCmdBuffer();
-    m_objDescriptionBW  = createStagedBufferWrap(cmdBuf, m_objDesc,
+    TRACE_FUNCTION();
+    m_objDescriptionBW  = createStagedBufferWrap(m_objDesc,
                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-    submitTempCmdBuffer(cmdBuf);
     // @@ [DONE]
     // Destroy with m_objDescriptionBW.destroy(m_device);
 }
@@ -711,8 +916,9 @@ void VkApp::rasterize()
     vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_INLINE);
 
     vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_scanlinePipeline);
+    uint32_t matrixOffset = uint32_t(m_frameIndex * m_matrixStride);  // This frame's camera slice
     vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_scanlinePipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
+                            m_scanlinePipelineLayout, 0, 1, &m_scDesc.descSet, 1, &matrixOffset);
 
     for(const ObjInst& inst : m_objInst) {
         auto& object            = m_objData[inst.objIndex];
@@ -745,7 +951,7 @@ void VkApp::updateCameraBuffer()
     const float    aspectRatio = windowSize.width / static_cast<float>(windowSize.height);
     MatrixUniforms hostUBO     = {};
 
-    glm::mat4    view = app->myCamera.view(glfwGetTime());
+    glm::mat4    view = app->myCamera.view(app->cameraTime());
     glm::mat4    proj = app->myCamera.perspective(aspectRatio);
   
     hostUBO.priorViewProj = m_priorViewProj;
@@ -754,35 +960,8 @@ void VkApp::updateCameraBuffer()
     hostUBO.viewInverse = glm::inverse(view);
     hostUBO.projInverse = glm::inverse(proj);
 
-    // UBO on the device, and what stages access it.
-    VkBuffer deviceUBO      = m_matrixBW.buffer;
-    auto     uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
-                            | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
-
-    // Ensure that the modified UBO is not visible to previous frames.
-    VkBufferMemoryBarrier beforeBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    beforeBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    beforeBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    beforeBarrier.buffer        = deviceUBO;
-    beforeBarrier.offset        = 0;
-    beforeBarrier.size          = sizeof(hostUBO);
-    vkCmdPipelineBarrier(m_commandBuffer, uboUsageStages, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &beforeBarrier, 0, nullptr);
-
-
-    // Schedule the host-to-device upload. (hostUBO is copied into the cmd
-    // buffer so it is okay to deallocate when the function returns).
-    vkCmdUpdateBuffer(m_commandBuffer, m_matrixBW.buffer, 0, sizeof(MatrixUniforms), &hostUBO);
-
-    // Making sure the updated UBO will be visible.
-    VkBufferMemoryBarrier afterBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    afterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    afterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    afterBarrier.buffer        = deviceUBO;
-    afterBarrier.offset        = 0;
-    afterBarrier.size          = sizeof(hostUBO);
-    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, uboUsageStages,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &afterBarrier, 0, nullptr);
+    // Write this frame's slice.  The GPU is done with it (its fence was
+    // waited on in prepareFrame), and the submit makes the write visible.
+    memcpy((uint8_t*)m_matrixBW.alloc.mapped + m_frameIndex*m_matrixStride,
+           &hostUBO, sizeof(MatrixUniforms));
 }